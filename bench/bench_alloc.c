@@ -0,0 +1,335 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// runs the same synthetic workloads against one allocator and prints a csv line for each, the
+// allocator is picked at build time as described in bench_backend.h:
+//
+//   bench_alloc [ops] [live] [header]
+//
+// ops is the number of calls per workload, live the number of allocations a workload keeps
+// around and header 0 leaves out the csv header so the output of several builds can be joined
+
+#include "bench_backend.h"
+
+// the allocators that aren't thread safe are called under this lock by the producer/consumer
+// workload
+#if defined(bench_v1) || (defined(bench_v2) && !defined(allocator_thread_safe))
+    #define bench_needs_lock 1
+#else
+    #define bench_needs_lock 0
+#endif
+
+pthread_mutex_t bench_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+    void* ptr;
+    size_t size;
+} bench_slot_t;
+
+typedef struct bench_run_t {
+    // latency of every call in nanoseconds, NULL while measuring throughput
+    uint32_t* latencies;
+    size_t n_latencies;
+    // bytes requested by the allocations that haven't been freed
+    size_t live_bytes;
+    // largest footprint seen and the live bytes at that point
+    size_t peak_footprint;
+    size_t peak_live_bytes;
+    size_t n_ops;
+    size_t n_allocs;
+    size_t n_failed;
+    int locked;
+    // the other thread of the producer/consumer workload, whose live bytes are added to ours
+    struct bench_run_t* peer;
+    uint64_t rng;
+} bench_run_t;
+
+uint64_t bench_rand(bench_run_t* run) {
+    run->rng ^= run->rng << 13;
+    run->rng ^= run->rng >> 7;
+    run->rng ^= run->rng << 17;
+    return run->rng;
+}
+
+uint64_t bench_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+// the footprint is only sampled while latencies are measured, so the throughput pass doesn't
+// pay for it
+void bench_sample(bench_run_t* run) {
+    if ( run->latencies == NULL || (run->n_allocs & 255) ) { return; }
+    if ( run->locked ) { pthread_mutex_lock(&bench_lock); }
+    size_t footprint = bench_footprint();
+    if ( run->locked ) { pthread_mutex_unlock(&bench_lock); }
+    // the peer's count is read without synchronization, which is close enough for a sample
+    size_t live_bytes = run->live_bytes + (run->peer != NULL ? run->peer->live_bytes : 0);
+    if ( footprint > run->peak_footprint ) {
+        run->peak_footprint = footprint;
+        run->peak_live_bytes = live_bytes;
+    }
+}
+
+void bench_alloc(bench_run_t* run, bench_slot_t* slot, size_t size) {
+
+    uint64_t start = run->latencies != NULL ? bench_now_ns() : 0;
+    if ( run->locked ) { pthread_mutex_lock(&bench_lock); }
+    slot->ptr = memalloc(size);
+    if ( run->locked ) { pthread_mutex_unlock(&bench_lock); }
+    if ( run->latencies != NULL ) { run->latencies[run->n_latencies++] = bench_now_ns() - start; }
+
+    run->n_ops++;
+    run->n_allocs++;
+    bench_sample(run);
+    if ( slot->ptr == NULL ) {
+        run->n_failed++;
+        return;
+    }
+
+    // touch the block like a real user would
+    *(char*)slot->ptr = (char)size;
+    slot->size = size;
+    run->live_bytes += size;
+
+}
+
+void bench_free(bench_run_t* run, bench_slot_t* slot) {
+
+    uint64_t start = run->latencies != NULL ? bench_now_ns() : 0;
+    if ( run->locked ) { pthread_mutex_lock(&bench_lock); }
+    memfree(slot->ptr);
+    if ( run->locked ) { pthread_mutex_unlock(&bench_lock); }
+    if ( run->latencies != NULL ) { run->latencies[run->n_latencies++] = bench_now_ns() - start; }
+
+    run->n_ops++;
+    run->live_bytes -= slot->size;
+    slot->ptr = NULL;
+
+}
+
+size_t bench_size_uniform(bench_run_t* run) {
+    return 16 + bench_rand(run) % 497;
+}
+
+// mostly small objects with a long tail of large buffers
+size_t bench_size_skewed(bench_run_t* run) {
+    uint64_t r = bench_rand(run);
+    uint64_t bucket = r % 100;
+    r >>= 8;
+    if ( bucket < 80 ) { return 8 + r % 57; }
+    if ( bucket < 95 ) { return 64 + r % 449; }
+    if ( bucket < 99 ) { return 512 + r % 3585; }
+    return 4096 + r % 61441;
+}
+
+void bench_free_all(bench_run_t* run, bench_slot_t* slots, size_t n) {
+    for ( size_t i = 0; i < n; i++ ) {
+        if ( slots[i].ptr != NULL ) { bench_free(run, &slots[i]); }
+    }
+}
+
+// allocates live blocks and frees them in reverse order
+void bench_lifo(bench_run_t* run, bench_slot_t* slots, size_t n_live, size_t n_ops) {
+    while ( run->n_ops < n_ops ) {
+        for ( size_t i = 0; i < n_live; i++ ) { bench_alloc(run, &slots[i], bench_size_uniform(run)); }
+        for ( size_t i = n_live; i-- > 0; ) {
+            if ( slots[i].ptr != NULL ) { bench_free(run, &slots[i]); }
+        }
+    }
+}
+
+// keeps live blocks in a queue and frees the oldest one before every allocation
+void bench_fifo(bench_run_t* run, bench_slot_t* slots, size_t n_live, size_t n_ops) {
+    for ( size_t i = 0; run->n_ops < n_ops; i = (i + 1) % n_live ) {
+        if ( slots[i].ptr != NULL ) { bench_free(run, &slots[i]); }
+        bench_alloc(run, &slots[i], bench_size_uniform(run));
+    }
+    bench_free_all(run, slots, n_live);
+}
+
+// frees or allocates a random slot, so every block lives for a random time
+void bench_random(bench_run_t* run, bench_slot_t* slots, size_t n_live, size_t n_ops) {
+    while ( run->n_ops < n_ops ) {
+        bench_slot_t* slot = &slots[bench_rand(run) % n_live];
+        if ( slot->ptr != NULL ) { bench_free(run, slot); }
+        else { bench_alloc(run, slot, bench_size_uniform(run)); }
+    }
+    bench_free_all(run, slots, n_live);
+}
+
+void bench_skewed(bench_run_t* run, bench_slot_t* slots, size_t n_live, size_t n_ops) {
+    while ( run->n_ops < n_ops ) {
+        bench_slot_t* slot = &slots[bench_rand(run) % n_live];
+        if ( slot->ptr != NULL ) { bench_free(run, slot); }
+        else { bench_alloc(run, slot, bench_size_skewed(run)); }
+    }
+    bench_free_all(run, slots, n_live);
+}
+
+// one thread allocates blocks and hands them through a queue to another thread that frees them
+
+#define bench_queue_size 1024
+
+typedef struct {
+    bench_slot_t slots[bench_queue_size];
+    _Atomic size_t head;
+    _Atomic size_t tail;
+    size_t n_blocks;
+    bench_run_t* run_producer;
+    bench_run_t* run_consumer;
+} bench_queue_t;
+
+void* bench_producer(void* arg) {
+    bench_queue_t* queue = (bench_queue_t*)arg;
+    bench_run_t* run = queue->run_producer;
+    for ( size_t i = 0; i < queue->n_blocks; i++ ) {
+        size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        while ( tail - atomic_load_explicit(&queue->head, memory_order_acquire) == bench_queue_size ) { sched_yield(); }
+        bench_slot_t* slot = &queue->slots[tail % bench_queue_size];
+        bench_alloc(run, slot, bench_size_uniform(run));
+        atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+void* bench_consumer(void* arg) {
+    bench_queue_t* queue = (bench_queue_t*)arg;
+    bench_run_t* run = queue->run_consumer;
+    for ( size_t i = 0; i < queue->n_blocks; i++ ) {
+        size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        while ( atomic_load_explicit(&queue->tail, memory_order_acquire) == head ) { sched_yield(); }
+        bench_slot_t* slot = &queue->slots[head % bench_queue_size];
+        if ( slot->ptr != NULL ) { bench_free(run, slot); }
+        atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+void bench_producer_consumer(bench_run_t* run, bench_slot_t* slots, size_t n_live, size_t n_ops) {
+
+    bench_queue_t* queue = bench_map(sizeof(bench_queue_t));
+    // the consumer's live bytes only go down, the sum of both is what is really live
+    bench_run_t run_consumer = { .rng = run->rng + 1 };
+    run->peer = &run_consumer;
+    queue->n_blocks = n_ops/2;
+    queue->run_producer = run;
+    queue->run_consumer = &run_consumer;
+    run->locked = run_consumer.locked = bench_needs_lock;
+    // the consumer writes its latencies after the producer's
+    if ( run->latencies != NULL ) { run_consumer.latencies = run->latencies + queue->n_blocks; }
+
+    pthread_t producer, consumer;
+    pthread_create(&producer, NULL, bench_producer, queue);
+    pthread_create(&consumer, NULL, bench_consumer, queue);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    // the latencies of both threads have to be next to each other for the percentiles
+    if ( run->latencies != NULL ) {
+        memmove(run->latencies + run->n_latencies, run_consumer.latencies, run_consumer.n_latencies*sizeof(uint32_t));
+    }
+    run->n_latencies += run_consumer.n_latencies;
+    run->n_ops += run_consumer.n_ops;
+    run->live_bytes += run_consumer.live_bytes;
+    run->peer = NULL;
+    munmap(queue, sizeof(bench_queue_t));
+
+}
+
+typedef struct {
+    const char* name;
+    void (*run)(bench_run_t* run, bench_slot_t* slots, size_t n_live, size_t n_ops);
+} bench_workload_t;
+
+bench_workload_t bench_workloads[] = {
+    { "lifo", bench_lifo },
+    { "fifo", bench_fifo },
+    { "random", bench_random },
+    { "skewed", bench_skewed },
+    { "producer_consumer", bench_producer_consumer },
+};
+
+int bench_compare_latency(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+uint32_t bench_percentile(uint32_t* latencies, size_t n, double p) {
+    if ( !n ) { return 0; }
+    size_t idx = (size_t)(p*(n - 1));
+    return latencies[idx];
+}
+
+// runs one workload twice on a fresh heap, once for throughput and once for the latencies and
+// footprint, and prints its csv line
+void bench_workload(bench_workload_t* workload, size_t n_live, size_t n_ops) {
+
+    bench_slot_t* slots = bench_map(n_live*sizeof(bench_slot_t));
+    // lifo can overshoot n_ops by one round of allocations and frees
+    size_t n_latencies_max = n_ops + 2*n_live;
+
+    bench_setup();
+    bench_run_t run = { .rng = 0x9e3779b97f4a7c15ull };
+    uint64_t start = bench_now_ns();
+    workload->run(&run, slots, n_live, n_ops);
+    double seconds = (bench_now_ns() - start)/1e9;
+
+    bench_setup();
+    bench_run_t run_timed = { .rng = 0x9e3779b97f4a7c15ull };
+    run_timed.latencies = bench_map(n_latencies_max*sizeof(uint32_t));
+    workload->run(&run_timed, slots, n_live, n_ops);
+    qsort(run_timed.latencies, run_timed.n_latencies, sizeof(uint32_t), bench_compare_latency);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    double fragmentation = run_timed.peak_footprint ? 1.0 - (double)run_timed.peak_live_bytes/run_timed.peak_footprint : 0.0;
+
+    printf("%s,%s,%zu,%zu,%.6f,%.0f,%u,%u,%u,%ld,%zu,%.4f\n",
+        bench_allocator_name, workload->name, run.n_ops, run.n_failed, seconds, run.n_ops/seconds,
+        bench_percentile(run_timed.latencies, run_timed.n_latencies, 0.5),
+        bench_percentile(run_timed.latencies, run_timed.n_latencies, 0.99),
+        bench_percentile(run_timed.latencies, run_timed.n_latencies, 0.999),
+        usage.ru_maxrss, run_timed.peak_footprint, fragmentation);
+
+    munmap(run_timed.latencies, n_latencies_max*sizeof(uint32_t));
+    munmap(slots, n_live*sizeof(bench_slot_t));
+
+}
+
+int main(int argc, char** argv) {
+
+    size_t n_ops = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    size_t n_live = argc > 2 ? strtoull(argv[2], NULL, 10) : 64;
+    int header = argc > 3 ? atoi(argv[3]) : 1;
+
+    if ( header ) {
+        printf("allocator,workload,ops,failed,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns,peak_rss_kb,peak_footprint_bytes,fragmentation\n");
+    }
+    fflush(stdout);
+
+    // every workload runs in its own process so the peak rss belongs to it alone
+    for ( size_t i = 0; i < sizeof(bench_workloads)/sizeof(bench_workloads[0]); i++ ) {
+        pid_t pid = fork();
+        if ( pid == 0 ) {
+            bench_workload(&bench_workloads[i], n_live, n_ops);
+            fflush(stdout);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+
+    return 0;
+
+}
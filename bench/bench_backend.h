@@ -0,0 +1,102 @@
+#ifndef BENCH_BACKEND_H
+#define BENCH_BACKEND_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+// picks the allocator the benchmarks run against: bench_v1, bench_v2 (with or without
+// allocator_thread_safe) or neither for the system malloc, every allocator provides
+// memalloc, memrealloc and memfree plus
+//
+//   bench_setup()      starts from an empty heap
+//   bench_footprint()  bytes of memory the allocator is using at the moment
+//
+// a new strategy only has to add a section here to run every workload and trace
+
+#if defined(bench_v1)
+
+#define allocator_v1_implementation
+#include "allocator_v1.h"
+
+#define bench_allocator_name "v1"
+
+#define bench_heap_size (256u<<20)
+
+// every workload starts over in the same memory
+void bench_setup() {
+    static void* memory = NULL;
+    if ( memory == NULL ) { memory = malloc(bench_heap_size); }
+    memalloc_init(memory, bench_heap_size);
+}
+
+size_t bench_footprint() {
+    heap_t* heap = __heap_default;
+    return (char*)heap->top_sector + (heap->top_sector->sectors_used << __heap_sector_shift(heap)) - (char*)heap->base;
+}
+
+#elif defined(bench_v2)
+
+#define allocator_v2_implementation
+#include "allocator_v2.h"
+
+#ifdef allocator_thread_safe
+    #define bench_allocator_name "v2_thread_safe"
+#else
+    #define bench_allocator_name "v2"
+#endif
+
+#define bench_heap_size (256u<<20)
+
+// every workload starts over in the same memory
+void bench_setup() {
+    static void* memory = NULL;
+    if ( memory == NULL ) { memory = malloc(bench_heap_size); }
+    memalloc_init(memory, bench_heap_size);
+}
+
+// slab pages that were never handed out are reserved but not touched, large allocations have
+// mappings of their own
+size_t bench_footprint() {
+    heap_t* heap = __heap_default;
+    size_t slab_unused = (heap->slab_n_pages - heap->slab_page_bump)*__heap_slab_page_size;
+    return heap->used_bytes - slab_unused + heap->sector_count*sizeof(__heap_sector_data_t) + heap->large_bytes;
+}
+
+#else
+
+#include <malloc.h>
+
+// BENCH_ALLOCATOR_NAME names the malloc that was swapped in with LD_PRELOAD
+const char* bench_system_name() {
+    const char* name = getenv("BENCH_ALLOCATOR_NAME");
+    return name != NULL ? name : "system";
+}
+
+#define bench_allocator_name bench_system_name()
+
+void bench_setup() {}
+
+void* memalloc(size_t size) { return malloc(size); }
+void* memrealloc(void* ptr, size_t size) { return realloc(ptr, size); }
+void memfree(void* ptr) { free(ptr); }
+
+size_t bench_footprint() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    if ( getenv("BENCH_ALLOCATOR_NAME") != NULL ) { return 0; }
+    struct mallinfo2 info = mallinfo2();
+    return info.arena + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+#endif
+
+// memory of the benchmarks themselves comes from mmap so it doesn't show up in the footprint of
+// the system malloc
+void* bench_map(size_t size) {
+    return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+}
+
+#endif
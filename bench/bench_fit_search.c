@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// compares the free block search of allocator_v2.h with a search over a split sector table, a
+// bitmap of the free sectors next to an array of their sizes in address order, scanned with
+// sse2 or avx2 compares and ctz:
+//
+//   bench_fit_search [blocks] [searches]
+//
+// a heap is filled with blocks and every other one is freed, so there are blocks/2 free blocks
+// that can't merge, then every search asks for a random size that most of them can hold and
+// prints a csv line with the nanoseconds per search
+//
+// the heap rows are a whole heap_alloc and heap_free under each placement policy, the split
+// table rows only find the block and leave out the updates an allocation would make to the table,
+// so they are a lower bound of what the layout would cost
+
+#define allocator_v2_implementation
+#include "allocator_v2.h"
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+    #define bench_simd_name "split_avx2"
+#elif defined(__SSE2__)
+    #define bench_simd_name "split_sse2"
+#else
+    #define bench_simd_name "split_scalar"
+#endif
+
+#define bench_size_min 272
+#define bench_size_max 1024
+
+typedef struct {
+    // bit n is set if sector n is free
+    uint64_t* free;
+    uint32_t* sizes;
+    size_t n;
+} bench_table_t;
+
+uint64_t bench_rand(uint64_t* rng) {
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    return *rng;
+}
+
+uint64_t bench_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+// sizes of the requests, a little past the largest free block now and then so some searches
+// find nothing
+size_t bench_request(uint64_t* rng) {
+    return bench_size_min + bench_rand(rng) % (bench_size_max - bench_size_min + 64);
+}
+
+// the packed 4 byte entries of the compact table, one at a time
+size_t bench_first_fit_packed(const uint32_t* packed, size_t n, uint32_t size) {
+    for ( size_t i = 0; i < n; i++ ) {
+        if ( !(packed[i] & 1) && packed[i] >> 2 >= size ) { return i; }
+    }
+    return n;
+}
+
+// the bitmap skips allocated sectors 64 at a time, the sizes of the free ones are compared one
+// at a time, the search starts at sector from
+size_t bench_first_fit_scalar(const bench_table_t* table, uint32_t size, size_t from) {
+    for ( size_t w = from/64; w*64 < table->n; w++ ) {
+        uint64_t bits = table->free[w] & (w == from/64 ? ~0ull << (from % 64) : ~0ull);
+        for ( ; bits; bits &= bits - 1 ) {
+            size_t i = w*64 + __builtin_ctzll(bits);
+            if ( table->sizes[i] >= size ) { return i; }
+        }
+    }
+    return table->n;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+// a group of sizes is compared at once and the mask of the ones large enough is anded with the
+// free bits of the group, sizes stay below 2^31 so the signed compare works
+size_t bench_first_fit_simd(const bench_table_t* table, uint32_t size, size_t from) {
+#if defined(__AVX2__)
+    const size_t width = 8;
+    __m256i limit = _mm256_set1_epi32((int)size - 1);
+#else
+    const size_t width = 4;
+    __m128i limit = _mm_set1_epi32((int)size - 1);
+#endif
+    for ( size_t w = from/64; w*64 < table->n; w++ ) {
+        uint64_t bits = table->free[w] & (w == from/64 ? ~0ull << (from % 64) : ~0ull);
+        if ( !bits ) { continue; }
+        for ( size_t g = 0; g < 64 && bits; g += width, bits >>= width ) {
+            uint32_t free_group = (uint32_t)bits & ((1u << width) - 1);
+            if ( !free_group ) { continue; }
+#if defined(__AVX2__)
+            __m256i sizes = _mm256_loadu_si256((const __m256i*)&table->sizes[w*64 + g]);
+            uint32_t fits = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(sizes, limit)));
+#else
+            __m128i sizes = _mm_loadu_si128((const __m128i*)&table->sizes[w*64 + g]);
+            uint32_t fits = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(sizes, limit)));
+#endif
+            if ( fits & free_group ) { return w*64 + g + __builtin_ctz(fits & free_group); }
+        }
+    }
+    return table->n;
+}
+
+#endif
+
+// next fit goes on from the block it found last and starts over from the first sector once
+// there is none after it
+size_t bench_next_fit(const bench_table_t* table, uint32_t size, size_t* rover) {
+#if defined(__AVX2__) || defined(__SSE2__)
+    size_t i = bench_first_fit_simd(table, size, *rover);
+    if ( i == table->n ) { i = bench_first_fit_simd(table, size, 0); }
+#else
+    size_t i = bench_first_fit_scalar(table, size, *rover);
+    if ( i == table->n ) { i = bench_first_fit_scalar(table, size, 0); }
+#endif
+    if ( i != table->n ) { *rover = i; }
+    return i;
+}
+
+// best fit has to look at every free sector, the smallest size that fits is kept per lane
+size_t bench_best_fit_scalar(const bench_table_t* table, uint32_t size) {
+    size_t best = table->n;
+    uint32_t size_best = UINT32_MAX;
+    for ( size_t w = 0; w*64 < table->n; w++ ) {
+        for ( uint64_t bits = table->free[w]; bits; bits &= bits - 1 ) {
+            size_t i = w*64 + __builtin_ctzll(bits);
+            if ( table->sizes[i] >= size && table->sizes[i] < size_best ) {
+                size_best = table->sizes[i];
+                best = i;
+                if ( size_best == size ) { return best; }
+            }
+        }
+    }
+    return best;
+}
+
+// the heap the searches run in, and a copy of its free blocks in the split layout
+void* bench_memory;
+heap_t* bench_heap;
+bench_table_t bench_table;
+uint32_t* bench_packed;
+
+// the policy is set before the heap is filled, the address ordered ones only keep lists in
+// order that they built themselves
+void bench_setup(size_t n_blocks, uint32_t placement) {
+
+    uint64_t rng = 0x2545f4914f6cdd1dull;
+    size_t heap_size = n_blocks*(bench_size_max + 64) + (64u<<20);
+    bench_memory = malloc(heap_size);
+    bench_heap = heap_create(bench_memory, heap_size);
+    heap_set_placement(bench_heap, placement);
+
+    void** ptrs = (void**)malloc(n_blocks*sizeof(void*));
+    size_t n_words = (n_blocks + 63)/64 + 1;
+    bench_table.free = (uint64_t*)calloc(n_words, sizeof(uint64_t));
+    // room for a whole group to be read past the last sector
+    bench_table.sizes = (uint32_t*)calloc(n_words*64, sizeof(uint32_t));
+    bench_table.n = n_blocks;
+    bench_packed = (uint32_t*)malloc(n_blocks*sizeof(uint32_t));
+
+    // a fresh heap hands the blocks out in address order, so block i is sector i of the table
+    for ( size_t i = 0; i < n_blocks; i++ ) {
+        ptrs[i] = heap_alloc(bench_heap, bench_size_min + bench_rand(&rng) % (bench_size_max - bench_size_min + 1));
+        bench_table.sizes[i] = (uint32_t)heap_usable_size(bench_heap, ptrs[i]);
+        bench_packed[i] = bench_table.sizes[i] << 2 | 1;
+    }
+    for ( size_t i = 1; i < n_blocks; i += 2 ) {
+        heap_free(bench_heap, ptrs[i]);
+        bench_table.free[i/64] |= 1ull << (i % 64);
+        bench_packed[i] &= ~1u;
+    }
+
+    free(ptrs);
+}
+
+void bench_teardown() {
+    heap_destroy(bench_heap);
+    free(bench_memory);
+    free(bench_table.free);
+    free(bench_table.sizes);
+    free(bench_packed);
+}
+
+void bench_report(const char* layout, const char* search, size_t n_blocks, size_t n_searches, uint64_t ns, size_t found) {
+    // found keeps the searches from being optimized out
+    printf("%s,%s,%zu,%.1f,%zu\n", layout, search, n_blocks, (double)ns/n_searches, found);
+}
+
+void bench_heap_policy(const char* name, uint32_t placement, size_t n_blocks, size_t n_searches) {
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    bench_setup(n_blocks, placement);
+    size_t found = 0;
+    uint64_t start = bench_now_ns();
+    for ( size_t i = 0; i < n_searches; i++ ) {
+        void* ptr = heap_alloc(bench_heap, bench_request(&rng));
+        found += ptr != NULL;
+        heap_free(bench_heap, ptr);
+    }
+    bench_report("heap", name, n_blocks, n_searches, bench_now_ns() - start, found);
+    bench_teardown();
+}
+
+#define bench_table_search(layout, name, call) do { \
+    uint64_t rng = 0x9e3779b97f4a7c15ull; \
+    size_t found = 0; \
+    uint64_t start = bench_now_ns(); \
+    for ( size_t i = 0; i < n_searches; i++ ) { \
+        uint32_t size = (uint32_t)bench_request(&rng); \
+        found += (call) != n_blocks; \
+    } \
+    bench_report(layout, name, n_blocks, n_searches, bench_now_ns() - start, found); \
+} while ( 0 )
+
+int main(int argc, char** argv) {
+
+    size_t n_blocks_max = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000;
+    size_t n_searches = argc > 2 ? strtoull(argv[2], NULL, 10) : 200000;
+
+    printf("layout,search,blocks,ns_per_search,found\n");
+
+    for ( size_t n_blocks = 1000; n_blocks <= n_blocks_max; n_blocks *= 10 ) {
+
+        bench_heap_policy("good_fit", heap_placement_good_fit, n_blocks, n_searches);
+        bench_heap_policy("best_fit", heap_placement_best_fit, n_blocks, n_searches);
+        bench_heap_policy("first_fit", heap_placement_first_fit, n_blocks, n_searches);
+        bench_heap_policy("next_fit", heap_placement_next_fit, n_blocks, n_searches);
+
+        bench_setup(n_blocks, heap_placement_good_fit);
+
+        bench_table_search("packed", "first_fit", bench_first_fit_packed(bench_packed, n_blocks, size));
+        bench_table_search("split_scalar", "first_fit", bench_first_fit_scalar(&bench_table, size, 0));
+#if defined(__AVX2__)
+        bench_table_search("split_avx2", "first_fit", bench_first_fit_simd(&bench_table, size, 0));
+#elif defined(__SSE2__)
+        bench_table_search("split_sse2", "first_fit", bench_first_fit_simd(&bench_table, size, 0));
+#endif
+        size_t rover = 0;
+        bench_table_search(bench_simd_name, "next_fit", bench_next_fit(&bench_table, size, &rover));
+        bench_table_search("split_scalar", "best_fit", bench_best_fit_scalar(&bench_table, size));
+
+        bench_teardown();
+
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,242 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench_backend.h"
+#include "allocator_trace.h"
+
+// replays a trace written by heap_trace_record_start against one allocator, picked at build time
+// as described in bench_backend.h, and prints a csv line with the time it took and the most
+// memory the allocator used:
+//
+//   bench_replay trace_file [header]
+//
+// the calls of every thread are replayed on one thread in timestamp order and the calls of
+// every heap in the trace go to the default heap
+//
+// events are stamped when a call returns, so with several threads a block a realloc moved away
+// from can show up in another thread before the realloc did, calls on pointers that aren't
+// allocated at that point of the trace are skipped and counted
+
+#define replay_no_id UINT32_MAX
+
+// a call from the trace with its pointers replaced by the ids of the allocations they belong to
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+    uint32_t id;
+    uint32_t id_result;
+} replay_op_t;
+
+// maps the addresses in the trace to allocation ids, addresses are never removed, a freed
+// address maps to replay_no_id until it is handed out again
+typedef struct {
+    uint64_t* keys;
+    uint32_t* ids;
+    size_t mask;
+} replay_map_t;
+
+uint32_t* replay_map_slot(replay_map_t* map, uint64_t key) {
+    size_t i = (key * 0x9e3779b97f4a7c15ull >> 16) & map->mask;
+    while ( map->keys[i] != 0 && map->keys[i] != key ) { i = (i + 1) & map->mask; }
+    if ( map->keys[i] == 0 ) {
+        map->keys[i] = key;
+        map->ids[i] = replay_no_id;
+    }
+    return &map->ids[i];
+}
+
+heap_trace_event_t* replay_events;
+
+// events are sorted through their indices so calls of one thread with the same timestamp keep
+// the order they were written in
+int replay_compare_events(const void* a, const void* b) {
+    size_t i = *(const size_t*)a;
+    size_t j = *(const size_t*)b;
+    const heap_trace_event_t* x = &replay_events[i];
+    const heap_trace_event_t* y = &replay_events[j];
+    if ( x->timestamp != y->timestamp ) { return x->timestamp < y->timestamp ? -1 : 1; }
+    return (i > j) - (i < j);
+}
+
+// reads the trace and turns it into ops on allocation ids, returns the number of ops
+size_t replay_load(const char* path, replay_op_t** ops_out, size_t* n_ids_out, size_t* n_skipped_out) {
+
+    FILE* file = fopen(path, "rb");
+    if ( file == NULL ) {
+        fprintf(stderr, "could not open %s\n", path);
+        return 0;
+    }
+
+    heap_trace_file_header_t header;
+    if ( fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, heap_trace_file_magic, 4) || header.version != heap_trace_file_version || header.event_size != sizeof(heap_trace_event_t) ) {
+        fprintf(stderr, "%s is not a trace this build can read\n", path);
+        fclose(file);
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size_t n_events = (ftell(file) - sizeof(header))/sizeof(heap_trace_event_t);
+    fseek(file, sizeof(header), SEEK_SET);
+
+    heap_trace_event_t* events = bench_map(n_events*sizeof(heap_trace_event_t) + 1);
+    n_events = fread(events, sizeof(heap_trace_event_t), n_events, file);
+    fclose(file);
+
+    // the batches of different threads are written whenever they fill up
+    size_t* order = bench_map(n_events*sizeof(size_t) + 1);
+    for ( size_t i = 0; i < n_events; i++ ) { order[i] = i; }
+    replay_events = events;
+    qsort(order, n_events, sizeof(size_t), replay_compare_events);
+
+    replay_map_t map;
+    size_t capacity = 16;
+    while ( capacity < 2*n_events ) { capacity <<= 1; }
+    map.keys = bench_map(capacity*sizeof(uint64_t));
+    map.ids = bench_map(capacity*sizeof(uint32_t));
+    map.mask = capacity - 1;
+
+    replay_op_t* ops = bench_map(n_events*sizeof(replay_op_t) + 1);
+    size_t n_ops = 0;
+    size_t n_skipped = 0;
+    uint32_t n_ids = 0;
+
+    for ( size_t i = 0; i < n_events; i++ ) {
+
+        heap_trace_event_t* event = &events[order[i]];
+        replay_op_t* op = &ops[n_ops];
+        op->type = event->type;
+        op->size = event->size;
+        op->id = replay_no_id;
+        op->id_result = replay_no_id;
+
+        // calls on pointers allocated before the recording started are left out
+        if ( event->ptr != 0 ) {
+            uint32_t* id = replay_map_slot(&map, event->ptr);
+            if ( *id == replay_no_id ) {
+                n_skipped++;
+                continue;
+            }
+            op->id = *id;
+            *id = replay_no_id;
+        }
+
+        if ( event->ptr_result != 0 ) {
+            // a realloc keeps the id of its allocation
+            op->id_result = op->id != replay_no_id ? op->id : n_ids++;
+            *replay_map_slot(&map, event->ptr_result) = op->id_result;
+        } else if ( event->type == heap_trace_realloc && event->size != 0 && op->id != replay_no_id ) {
+            // a failed realloc leaves the allocation where it was
+            op->id_result = op->id;
+            *replay_map_slot(&map, event->ptr) = op->id;
+        }
+
+        n_ops++;
+
+    }
+
+    munmap(events, n_events*sizeof(heap_trace_event_t) + 1);
+    munmap(order, n_events*sizeof(size_t) + 1);
+    munmap(map.keys, capacity*sizeof(uint64_t));
+    munmap(map.ids, capacity*sizeof(uint32_t));
+
+    *ops_out = ops;
+    *n_ids_out = n_ids;
+    *n_skipped_out = n_skipped;
+    return n_ops;
+}
+
+typedef struct {
+    double seconds;
+    size_t n_failed;
+    size_t peak_footprint;
+} replay_result_t;
+
+uint64_t replay_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+// the footprint is only sampled on the second run so the first one can be timed on its own
+void replay_run(replay_op_t* ops, size_t n_ops, void** ptrs, size_t n_ids, int sample, replay_result_t* result) {
+
+    bench_setup();
+    memset(ptrs, 0, n_ids*sizeof(void*));
+    uint64_t start = replay_now_ns();
+
+    for ( size_t i = 0; i < n_ops; i++ ) {
+
+        replay_op_t* op = &ops[i];
+        void* ptr = op->id != replay_no_id ? ptrs[op->id] : NULL;
+        void* ptr_result = NULL;
+
+        switch ( op->type ) {
+            case heap_trace_alloc:
+                ptr_result = memalloc(op->size);
+                break;
+            case heap_trace_realloc:
+                ptr_result = ptr != NULL ? memrealloc(ptr, op->size) : memalloc(op->size);
+                if ( ptr_result == NULL && op->size != 0 && ptr != NULL ) {
+                    result->n_failed++;
+                    ptr_result = ptr;
+                }
+                break;
+            case heap_trace_free:
+                if ( ptr != NULL ) { memfree(ptr); }
+                break;
+        }
+
+        if ( op->id != replay_no_id ) { ptrs[op->id] = NULL; }
+        if ( op->id_result != replay_no_id ) {
+            if ( ptr_result == NULL && op->size != 0 ) { result->n_failed++; }
+            ptrs[op->id_result] = ptr_result;
+        }
+
+        if ( sample && !(i & 255) ) {
+            size_t footprint = bench_footprint();
+            if ( footprint > result->peak_footprint ) { result->peak_footprint = footprint; }
+        }
+
+    }
+
+    result->seconds = (replay_now_ns() - start)/1e9;
+
+    // allocations the trace never freed
+    for ( size_t i = 0; i < n_ids; i++ ) {
+        if ( ptrs[i] != NULL ) { memfree(ptrs[i]); }
+    }
+
+}
+
+int main(int argc, char** argv) {
+
+    if ( argc < 2 ) {
+        fprintf(stderr, "usage: %s trace_file [header]\n", argv[0]);
+        return 1;
+    }
+
+    int header = argc > 2 ? atoi(argv[2]) : 1;
+
+    replay_op_t* ops;
+    size_t n_ids;
+    size_t n_skipped;
+    size_t n_ops = replay_load(argv[1], &ops, &n_ids, &n_skipped);
+    if ( !n_ops ) { return 1; }
+
+    void** ptrs = bench_map(n_ids*sizeof(void*) + 1);
+
+    replay_result_t result_timed = {0};
+    replay_run(ops, n_ops, ptrs, n_ids, 0, &result_timed);
+    replay_result_t result_sampled = {0};
+    replay_run(ops, n_ops, ptrs, n_ids, 1, &result_sampled);
+
+    if ( header ) { printf("allocator,ops,skipped,failed,seconds,ops_per_sec,peak_footprint_bytes\n"); }
+    printf("%s,%zu,%zu,%zu,%.6f,%.0f,%zu\n", bench_allocator_name, n_ops, n_skipped, result_timed.n_failed,
+        result_timed.seconds, n_ops/result_timed.seconds, result_sampled.peak_footprint);
+
+    return 0;
+
+}
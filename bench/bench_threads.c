@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define allocator_v2_implementation
+#include "allocator_v2.h"
+
+// measures memalloc/memfree throughput of the thread safe build from 1 to n threads
+
+#define bench_heap_size (256u<<20)
+#define bench_slots 1024
+#define bench_exchange_slots 4096
+
+// pointers handed between threads so some frees happen on a different thread than the alloc
+_Atomic(void*) bench_exchange[bench_exchange_slots];
+
+size_t bench_ops_per_thread = 1000000;
+
+uint64_t bench_rand(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+void* bench_thread(void* arg) {
+
+    uint64_t rng = (uintptr_t)arg * 0x9e3779b97f4a7c15ull + 1;
+    void* slots[bench_slots] = {0};
+
+    for ( size_t i = 0; i < bench_ops_per_thread; i++ ) {
+
+        size_t slot = bench_rand(&rng) % bench_slots;
+
+        if ( slots[slot] != NULL ) {
+            memfree(slots[slot]);
+            slots[slot] = NULL;
+            continue;
+        }
+
+        // mostly small objects with the odd larger buffer
+        uint64_t r = bench_rand(&rng);
+        size_t size = (r & 63) == 0 ? 1024 + (r >> 8) % 3072 : 8 + (r >> 8) % 248;
+
+        void* ptr = memalloc(size);
+        if ( ptr == NULL ) { continue; }
+        *(char*)ptr = (char)i;
+
+        if ( (r & 7) == 0 ) {
+            void* ptr_old = atomic_exchange(&bench_exchange[(r >> 16) % bench_exchange_slots], ptr);
+            if ( ptr_old != NULL ) { memfree(ptr_old); }
+        } else {
+            slots[slot] = ptr;
+        }
+
+    }
+
+    for ( size_t i = 0; i < bench_slots; i++ ) {
+        if ( slots[i] != NULL ) { memfree(slots[i]); }
+    }
+
+    return NULL;
+}
+
+double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+int main(int argc, char** argv) {
+
+    long max_threads = argc > 1 ? atol(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    if ( argc > 2 ) { bench_ops_per_thread = atol(argv[2]); }
+    if ( max_threads < 1 ) { max_threads = 1; }
+
+    void* heap_base = malloc(bench_heap_size);
+    pthread_t* threads = malloc(max_threads*sizeof(pthread_t));
+
+    printf("threads,ops,seconds,ops_per_sec,speedup\n");
+
+    double ops_per_sec_single = 0;
+
+    for ( long n_threads = 1; n_threads <= max_threads; n_threads *= 2 ) {
+
+        memalloc_init(heap_base, bench_heap_size);
+        for ( size_t i = 0; i < bench_exchange_slots; i++ ) { bench_exchange[i] = NULL; }
+
+        double t_start = bench_now();
+        for ( long i = 0; i < n_threads; i++ ) { pthread_create(&threads[i], NULL, bench_thread, (void*)(uintptr_t)(i + 1)); }
+        for ( long i = 0; i < n_threads; i++ ) { pthread_join(threads[i], NULL); }
+        double t_elapsed = bench_now() - t_start;
+
+        double ops = (double)n_threads*bench_ops_per_thread;
+        double ops_per_sec = ops/t_elapsed;
+        if ( n_threads == 1 ) { ops_per_sec_single = ops_per_sec; }
+
+        printf("%ld,%.0f,%.4f,%.0f,%.2f\n", n_threads, ops, t_elapsed, ops_per_sec, ops_per_sec/ops_per_sec_single);
+
+        // make sure the last step is the requested thread count
+        if ( n_threads < max_threads && n_threads*2 > max_threads ) { n_threads = max_threads/2; }
+
+    }
+
+    free(threads);
+    free(heap_base);
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef ALLOC_ATOMIC_H
+#define ALLOC_ATOMIC_H
+
+// the C11 atomics of the allocator_thread_safe builds, C++ gets the same names from <atomic> so
+// the implementation can be compiled in a C++ source file too
+//
+// this header is included by the thread safe parts of the other allocator headers
+
+#ifdef __cplusplus
+
+// the allocator headers declare everything with C linkage, which templates can't have
+extern "C++" {
+#include <atomic>
+}
+
+// C++23 defines _Atomic in <stdatomic.h> as well
+#ifndef _Atomic
+    #define _Atomic(type) std::atomic<type>
+#endif
+
+#define _Thread_local thread_local
+
+using std::memory_order_relaxed;
+using std::memory_order_acquire;
+using std::memory_order_release;
+using std::memory_order_acq_rel;
+using std::memory_order_seq_cst;
+using std::atomic_load;
+using std::atomic_load_explicit;
+using std::atomic_store;
+using std::atomic_store_explicit;
+using std::atomic_exchange;
+using std::atomic_exchange_explicit;
+using std::atomic_compare_exchange_strong;
+using std::atomic_compare_exchange_strong_explicit;
+using std::atomic_compare_exchange_weak;
+using std::atomic_compare_exchange_weak_explicit;
+using std::atomic_fetch_add;
+using std::atomic_fetch_add_explicit;
+using std::atomic_fetch_sub;
+using std::atomic_fetch_sub_explicit;
+using std::atomic_thread_fence;
+
+#else
+
+#include <stdatomic.h>
+
+#endif
+
+#endif
@@ -0,0 +1,490 @@
+#ifndef ALLOC_PROFILE_H
+#define ALLOC_PROFILE_H
+
+// define allocator_profile_enable to sample about one allocation in every allocator_profile_rate
+// bytes along with the stack it was made from, and to keep the live and allocated bytes of every
+// stack in a table that heap_profile_write dumps for pprof or as folded stacks for flame graphs,
+// allocations that aren't sampled only count down a per-thread byte counter and frees only check
+// one byte of a filter of the sampled pointers, everything else is done out of line, programs
+// built with it link with -lm
+//
+// this header is included by allocator_v1.h and allocator_v2.h after allocator_trace.h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// formats of heap_profile_write:
+//   pprof:        the text heap profile of gperftools with the live and allocated bytes of every
+//                 stack, read with pprof program file
+//   folded_live:  one line of frames from the outermost in with the live bytes of the stack, the
+//                 input of flamegraph.pl
+//   folded_alloc: the same with the bytes the stack allocated per second since sampling started
+// every count is an estimate of the allocations the samples stand for
+#define heap_profile_pprof 1
+#define heap_profile_folded_live 2
+#define heap_profile_folded_alloc 3
+
+#ifdef allocator_profile_enable
+
+// average number of bytes allocated between two samples, can be changed with heap_profile_set_rate
+#ifndef allocator_profile_rate
+    #define allocator_profile_rate (2u<<20)
+#endif
+
+// frames recorded for every sample
+#ifndef allocator_profile_depth
+    #define allocator_profile_depth 32
+#endif
+
+// distinct stacks kept, samples of any further ones are counted in one stack without frames
+#ifndef allocator_profile_max_sites
+    #define allocator_profile_max_sites 1024
+#endif
+
+// sampled allocations that can be live at once, samples beyond three quarters of it only count
+// towards the allocated bytes, must be a power of two
+#ifndef allocator_profile_max_live
+    #define allocator_profile_max_live 8192
+#endif
+
+#if allocator_profile_max_live & (allocator_profile_max_live - 1)
+    #error "allocator_profile_max_live must be a power of two"
+#endif
+
+// sets the average number of bytes between samples, 0 stops sampling, allocations sampled
+// before are still followed until they are freed
+void heap_profile_set_rate(size_t rate);
+
+// writes the profile to path in one of the heap_profile_* formats, returns 0 if it can't be
+// written
+int heap_profile_write(const char* path, int format);
+
+// returns the address the heap function that made the live allocation at ptr returned to, or 0 if
+// it wasn't sampled
+uint64_t heap_profile_site(void* ptr);
+
+#define __allocprofile(type, ptr, ptr_result, size) __heap_profile_record(type, ptr, ptr_result, size, __builtin_return_address(0))
+
+#if defined(allocator_v1_implementation) || defined(allocator_v2_implementation)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <execinfo.h>
+
+typedef struct {
+    // hash of the frames, 0 for unused entries
+    uint64_t hash;
+    // address the heap function of the first sample returned to, which is in the caller of the
+    // function it was inlined into if it was
+    uint64_t caller;
+    uint32_t depth;
+    void* frames[allocator_profile_depth];
+    // estimates of the allocations the samples of the stack stand for
+    uint64_t n_alloc;
+    uint64_t alloc_bytes;
+    uint64_t n_live;
+    uint64_t live_bytes;
+} __heap_profile_site_t;
+
+// a sampled allocation that is live, and the estimates it added to its site
+typedef struct {
+    uint32_t site;
+    uint32_t weight;
+    uint64_t bytes;
+} __heap_profile_live_t;
+
+// entry 0 is the stack samples go to once the table is full
+__heap_profile_site_t __heap_profile_sites[allocator_profile_max_sites];
+
+__heap_profile_live_t __heap_profile_live[allocator_profile_max_live];
+
+// frees only look a pointer up in the live table if its counter in this filter isn't 0, which is
+// small enough to stay in the cache where the table wouldn't, counters that reach 255 stay there
+#define __heap_profile_filter_size 4096
+
+uint64_t __heap_profile_start = 0;
+uint64_t __heap_profile_n_dropped = 0;
+
+#ifdef allocator_thread_safe
+
+#include <pthread.h>
+#include "allocator_atomic.h"
+
+// live pointers are looked up by every free without the lock, changes to the table are made
+// between two increments of the sequence number so a lookup that overlaps one starts over
+_Atomic(uintptr_t) __heap_profile_live_keys[allocator_profile_max_live];
+_Atomic(uint8_t) __heap_profile_filter[__heap_profile_filter_size];
+_Atomic(size_t) __heap_profile_n_live = 0;
+_Atomic(uint32_t) __heap_profile_sequence = 0;
+_Atomic(size_t) __heap_profile_rate = allocator_profile_rate;
+
+pthread_mutex_t __heap_profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define __heap_profile_lock_acquire() pthread_mutex_lock(&__heap_profile_lock)
+#define __heap_profile_lock_release() pthread_mutex_unlock(&__heap_profile_lock)
+#define __heap_profile_load(x) atomic_load_explicit(&(x), memory_order_relaxed)
+#define __heap_profile_store(x, value) atomic_store_explicit(&(x), value, memory_order_relaxed)
+
+void __heap_profile_change_begin() {
+    atomic_fetch_add_explicit(&__heap_profile_sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+void __heap_profile_change_end() {
+    atomic_fetch_add_explicit(&__heap_profile_sequence, 1, memory_order_release);
+}
+
+// bytes the thread allocates before its next sample, and the state of its random numbers
+_Thread_local int64_t __heap_profile_countdown = 0;
+_Thread_local uint64_t __heap_profile_random = 0;
+
+// set while the profiler itself allocates, whose allocations aren't followed
+_Thread_local int __heap_profile_busy = 0;
+
+#else
+
+uintptr_t __heap_profile_live_keys[allocator_profile_max_live];
+uint8_t __heap_profile_filter[__heap_profile_filter_size];
+size_t __heap_profile_n_live = 0;
+size_t __heap_profile_rate = allocator_profile_rate;
+
+#define __heap_profile_lock_acquire()
+#define __heap_profile_lock_release()
+#define __heap_profile_load(x) (x)
+#define __heap_profile_store(x, value) ((x) = (value))
+#define __heap_profile_change_begin()
+#define __heap_profile_change_end()
+
+int64_t __heap_profile_countdown = 0;
+uint64_t __heap_profile_random = 0;
+int __heap_profile_busy = 0;
+
+#endif
+
+uint64_t __heap_profile_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+size_t __heap_profile_slot(uintptr_t key) {
+    return (size_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & (allocator_profile_max_live - 1);
+}
+
+// the filter is indexed by the address bits above the 16 byte alignment of the blocks, which
+// every free can afford, pointers 64 KiB apart share a counter and only cost a lookup
+size_t __heap_profile_filter_slot(uintptr_t key) {
+    return (size_t)(key >> 4) & (__heap_profile_filter_size - 1);
+}
+
+// the caller holds the lock
+void __heap_profile_filter_add(uintptr_t key, int delta) {
+    size_t i = __heap_profile_filter_slot(key);
+    uint8_t count = __heap_profile_load(__heap_profile_filter[i]);
+    if ( count != UINT8_MAX ) { __heap_profile_store(__heap_profile_filter[i], count + delta); }
+}
+
+// returns the slot of a live pointer, or allocator_profile_max_live if it wasn't sampled
+size_t __heap_profile_find(uintptr_t key) {
+    for ( size_t i = __heap_profile_slot(key); ; i = (i + 1) & (allocator_profile_max_live - 1) ) {
+        uintptr_t key_slot = __heap_profile_load(__heap_profile_live_keys[i]);
+        if ( key_slot == key ) { return i; }
+        if ( key_slot == 0 ) { return allocator_profile_max_live; }
+    }
+}
+
+// looks a live pointer up without the lock
+size_t __heap_profile_find_unlocked(uintptr_t key) {
+#ifdef allocator_thread_safe
+    while ( 1 ) {
+        uint32_t sequence = atomic_load_explicit(&__heap_profile_sequence, memory_order_acquire);
+        size_t i = __heap_profile_find(key);
+        atomic_thread_fence(memory_order_acquire);
+        if ( !(sequence & 1) && atomic_load_explicit(&__heap_profile_sequence, memory_order_relaxed) == sequence ) { return i; }
+    }
+#else
+    return __heap_profile_find(key);
+#endif
+}
+
+// random numbers for the sample intervals, seeded from the address of the thread's state
+uint64_t __heap_profile_next_random() {
+    uint64_t x = __heap_profile_random;
+    if ( !x ) { x = ((uintptr_t)&__heap_profile_random ^ __heap_profile_now()) | 1; }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    __heap_profile_random = x;
+    return x;
+}
+
+// intervals are exponentially distributed around the rate, so every byte is equally likely to be
+// sampled no matter where it falls in the allocations and samples don't line up with a pattern
+// in them
+int64_t __heap_profile_interval(size_t rate) {
+    if ( !rate ) { return INT64_MAX; }
+    double uniform = (double)((__heap_profile_next_random() >> 11) + 1)*0x1p-53;
+    double interval = -log(uniform)*rate;
+    return interval < 1.0 ? 1 : interval < 0x1p62 ? (int64_t)interval : INT64_MAX;
+}
+
+// returns the site of a stack, adding it if it is new, the caller holds the lock
+uint32_t __heap_profile_site_of(uint64_t hash, void** frames, uint32_t depth, void* caller) {
+    for ( uint32_t i = 1 + hash % (allocator_profile_max_sites - 1), n = 1; n < allocator_profile_max_sites; i = 1 + i % (allocator_profile_max_sites - 1), n++ ) {
+        __heap_profile_site_t* site = &__heap_profile_sites[i];
+        if ( site->hash == hash ) { return i; }
+        if ( site->hash == 0 ) {
+            site->hash = hash;
+            site->caller = (uintptr_t)caller;
+            site->depth = depth;
+            memcpy(site->frames, frames, depth*sizeof(void*));
+            return i;
+        }
+    }
+    return 0;
+}
+
+// records the allocation at ptr, which used up the countdown of the thread
+__attribute__((noinline, cold)) void __heap_profile_sample(void* ptr, size_t size, void* caller) {
+
+    // the countdown stays used up until the profiler's own allocations are done
+    if ( __heap_profile_busy ) { return; }
+
+    // a thread's first countdown is drawn on its first allocation, which isn't sampled
+    int first = __heap_profile_random == 0;
+    size_t rate = __heap_profile_load(__heap_profile_rate);
+    __heap_profile_countdown = __heap_profile_interval(rate);
+    if ( first || !rate ) { return; }
+
+    // backtrace loads its unwinder on the first call, which allocates
+    void* frames[allocator_profile_depth + 1];
+    __heap_profile_busy = 1;
+    int n_frames = backtrace(frames, allocator_profile_depth + 1);
+    __heap_profile_busy = 0;
+
+    // the first frame is this function
+    uint32_t depth = n_frames > 1 ? n_frames - 1 : 0;
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for ( uint32_t i = 0; i < depth; i++ ) { hash = (hash ^ (uintptr_t)frames[i + 1]) * 0x100000001b3ull; }
+    hash |= 1;
+
+    // an allocation of size bytes is sampled with a chance of 1 - exp(-size/rate), so it
+    // stands for the inverse of that many allocations of its size
+    double scale = size ? -1.0/expm1(-(double)size/rate) : 1.0;
+    uint32_t weight = scale < UINT32_MAX ? (uint32_t)(scale + 0.5) : UINT32_MAX;
+    uint64_t bytes = (uint64_t)(scale*size + 0.5);
+    uintptr_t key = (uintptr_t)ptr;
+
+    __heap_profile_lock_acquire();
+
+    if ( !__heap_profile_start ) { __heap_profile_start = __heap_profile_now(); }
+
+    uint32_t site_idx = __heap_profile_site_of(hash, frames + 1, depth, caller);
+    __heap_profile_site_t* site = &__heap_profile_sites[site_idx];
+    site->n_alloc += weight;
+    site->alloc_bytes += bytes;
+
+    size_t n_live = __heap_profile_load(__heap_profile_n_live);
+    if ( n_live < allocator_profile_max_live/4*3 && __heap_profile_find(key) == allocator_profile_max_live ) {
+        size_t i = __heap_profile_slot(key);
+        while ( __heap_profile_load(__heap_profile_live_keys[i]) != 0 ) { i = (i + 1) & (allocator_profile_max_live - 1); }
+        __heap_profile_live[i].site = site_idx;
+        __heap_profile_live[i].weight = weight;
+        __heap_profile_live[i].bytes = bytes;
+        __heap_profile_change_begin();
+        __heap_profile_store(__heap_profile_live_keys[i], key);
+        __heap_profile_change_end();
+        __heap_profile_store(__heap_profile_n_live, n_live + 1);
+        __heap_profile_filter_add(key, 1);
+        site->n_live += weight;
+        site->live_bytes += bytes;
+    } else {
+        __heap_profile_n_dropped++;
+    }
+
+    __heap_profile_lock_release();
+
+}
+
+// stops following a sampled allocation that was freed
+__attribute__((noinline, cold)) void __heap_profile_forget(void* ptr) {
+
+    uintptr_t key = (uintptr_t)ptr;
+    if ( __heap_profile_find_unlocked(key) == allocator_profile_max_live ) { return; }
+
+    __heap_profile_lock_acquire();
+
+    size_t i = __heap_profile_find(key);
+    if ( i != allocator_profile_max_live ) {
+
+        __heap_profile_site_t* site = &__heap_profile_sites[__heap_profile_live[i].site];
+        site->n_live -= __heap_profile_live[i].weight;
+        site->live_bytes -= __heap_profile_live[i].bytes;
+
+        // the entries after the slot that belong in front of it move up so no lookup stops early
+        __heap_profile_change_begin();
+        size_t j = i;
+        while ( 1 ) {
+            j = (j + 1) & (allocator_profile_max_live - 1);
+            uintptr_t key_j = __heap_profile_load(__heap_profile_live_keys[j]);
+            if ( key_j == 0 ) { break; }
+            size_t home = __heap_profile_slot(key_j);
+            if ( ((j - home) & (allocator_profile_max_live - 1)) < ((j - i) & (allocator_profile_max_live - 1)) ) { continue; }
+            __heap_profile_store(__heap_profile_live_keys[i], key_j);
+            __heap_profile_live[i] = __heap_profile_live[j];
+            i = j;
+        }
+        __heap_profile_store(__heap_profile_live_keys[i], 0);
+        __heap_profile_change_end();
+
+        __heap_profile_store(__heap_profile_n_live, __heap_profile_load(__heap_profile_n_live) - 1);
+        __heap_profile_filter_add(key, -1);
+
+    }
+
+    __heap_profile_lock_release();
+
+}
+
+// the checks heap_alloc and heap_free make before anything else, so they can still end in a
+// tail call when the allocation isn't sampled or the pointer wasn't
+#define __allocprofile_due(size) __builtin_expect((__heap_profile_countdown -= (int64_t)(size)) <= 0, 0)
+#define __allocprofile_followed(ptr) __builtin_expect(__heap_profile_load(__heap_profile_filter[__heap_profile_filter_slot((uintptr_t)(ptr))]) != 0, 0)
+
+void __heap_profile_record(uint32_t type, void* ptr, void* ptr_result, size_t size, void* caller) {
+
+    // a realloc that fails leaves the allocation where it was
+    int freed = type == heap_trace_free || ptr_result != NULL || size == 0;
+    if ( ptr != NULL && freed && __allocprofile_followed(ptr) ) { __heap_profile_forget(ptr); }
+
+    if ( ptr_result == NULL ) { return; }
+    if ( __allocprofile_due(size) ) { __heap_profile_sample(ptr_result, size, caller); }
+
+}
+
+void heap_profile_set_rate(size_t rate) {
+    __heap_profile_store(__heap_profile_rate, rate);
+    // threads pick the new rate up with their next sample
+    __heap_profile_countdown = __heap_profile_interval(rate);
+}
+
+uint64_t heap_profile_site(void* ptr) {
+    __heap_profile_lock_acquire();
+    size_t i = __heap_profile_find((uintptr_t)ptr);
+    uint64_t caller = i != allocator_profile_max_live ? __heap_profile_sites[__heap_profile_live[i].site].caller : 0;
+    __heap_profile_lock_release();
+    return caller;
+}
+
+// writes the name of a frame, taken from a line of backtrace_symbols like
+// "program(function+0x1f) [0x4005d2]", or its address if it has none
+void __heap_profile_write_frame(FILE* file, void* frame, const char* symbol) {
+    const char* name = symbol != NULL ? strchr(symbol, '(') : NULL;
+    if ( name != NULL && name[1] != '+' && name[1] != ')' ) {
+        name++;
+        size_t length = strcspn(name, "+)");
+        fwrite(name, 1, length, file);
+    } else {
+        fprintf(file, "%p", frame);
+    }
+}
+
+int heap_profile_write(const char* path, int format) {
+
+    FILE* file = fopen(path, "w");
+    if ( file == NULL ) { return 0; }
+
+    // the sites are copied out so the lock isn't held while the frames are looked up, which
+    // allocates
+    __heap_profile_busy = 1;
+    __heap_profile_site_t* sites = (__heap_profile_site_t*)malloc(sizeof(__heap_profile_sites));
+    if ( sites == NULL ) {
+        __heap_profile_busy = 0;
+        fclose(file);
+        return 0;
+    }
+
+    __heap_profile_lock_acquire();
+    memcpy(sites, __heap_profile_sites, sizeof(__heap_profile_sites));
+    double seconds = __heap_profile_start ? (__heap_profile_now() - __heap_profile_start)/1e9 : 0.0;
+    __heap_profile_lock_release();
+
+    if ( format == heap_profile_pprof ) {
+
+        uint64_t n_live = 0, live_bytes = 0, n_alloc = 0, alloc_bytes = 0;
+        for ( size_t i = 0; i < allocator_profile_max_sites; i++ ) {
+            n_live += sites[i].n_live;
+            live_bytes += sites[i].live_bytes;
+            n_alloc += sites[i].n_alloc;
+            alloc_bytes += sites[i].alloc_bytes;
+        }
+
+        // the counts are estimates already, so the profile names no sampling rate for pprof to
+        // scale them by
+        fprintf(file, "heap profile: %llu: %llu [%llu: %llu] @ heap\n", (unsigned long long)n_live, (unsigned long long)live_bytes, (unsigned long long)n_alloc, (unsigned long long)alloc_bytes);
+        for ( size_t i = 0; i < allocator_profile_max_sites; i++ ) {
+            __heap_profile_site_t* site = &sites[i];
+            if ( !site->n_alloc ) { continue; }
+            fprintf(file, "%llu: %llu [%llu: %llu] @", (unsigned long long)site->n_live, (unsigned long long)site->live_bytes, (unsigned long long)site->n_alloc, (unsigned long long)site->alloc_bytes);
+            for ( uint32_t j = 0; j < site->depth; j++ ) { fprintf(file, " %p", site->frames[j]); }
+            fprintf(file, "\n");
+        }
+
+        // pprof finds the binaries to look the addresses up in through the mappings
+        fprintf(file, "\nMAPPED_LIBRARIES:\n");
+        FILE* maps = fopen("/proc/self/maps", "r");
+        if ( maps != NULL ) {
+            char buffer[4096];
+            size_t n;
+            while ( (n = fread(buffer, 1, sizeof(buffer), maps)) > 0 ) { fwrite(buffer, 1, n, file); }
+            fclose(maps);
+        }
+
+    } else {
+
+        for ( size_t i = 0; i < allocator_profile_max_sites; i++ ) {
+
+            __heap_profile_site_t* site = &sites[i];
+            uint64_t value = format == heap_profile_folded_live ? site->live_bytes : (seconds > 0.0 ? (uint64_t)(site->alloc_bytes/seconds) : site->alloc_bytes);
+            if ( !value ) { continue; }
+
+            char** symbols = site->depth ? backtrace_symbols(site->frames, site->depth) : NULL;
+            if ( !site->depth ) { fprintf(file, "[other]"); }
+            for ( uint32_t j = site->depth; j-- > 0; ) {
+                __heap_profile_write_frame(file, site->frames[j], symbols != NULL ? symbols[j] : NULL);
+                if ( j ) { fputc(';', file); }
+            }
+            fprintf(file, " %llu\n", (unsigned long long)value);
+            free(symbols);
+
+        }
+
+    }
+
+    free(sites);
+    __heap_profile_busy = 0;
+
+    int ok = !ferror(file);
+    return !fclose(file) && ok;
+}
+
+#endif
+
+#else
+
+#define __allocprofile(type, ptr, ptr_result, size)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
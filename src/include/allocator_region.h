@@ -0,0 +1,189 @@
+#ifndef ALLOC_REGION_H
+#define ALLOC_REGION_H
+
+// regions hand out memory by bumping a pointer through chunks they take from a heap and free
+// all of it at once, for allocations that share one lifetime
+//
+// this header is included by allocator_v1.h and allocator_v2.h and works on the heap_t of
+// whichever of them included it
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// bytes taken from the heap for the first chunk of a region, every chunk after it is twice the
+// size of the one before up to allocator_region_chunk_max
+#ifndef allocator_region_chunk_size
+    #define allocator_region_chunk_size 4096
+#endif
+
+#ifndef allocator_region_chunk_max
+    #define allocator_region_chunk_max (1u << 20)
+#endif
+
+#define __region_alignment __alignof__(max_align_t)
+
+typedef struct __region_chunk_t {
+    // chunk that was being bumped through before this one
+    struct __region_chunk_t* prev;
+    char* end;
+} __region_chunk_t;
+
+#define __region_chunk_header_size ((sizeof(__region_chunk_t) + __region_alignment - 1) & ~(__region_alignment - 1))
+
+typedef struct region_t {
+    heap_t* heap;
+    // enclosing region, NULL for regions started on a heap
+    struct region_t* parent;
+    // chunk being bumped through and the free space left in it
+    __region_chunk_t* chunk;
+    char* cursor;
+    char* end;
+    // where the region began, everything after it is freed by region_reset
+    __region_chunk_t* chunk_begin;
+    char* cursor_begin;
+    char* end_begin;
+    // bytes taken from the heap for the next chunk
+    size_t chunk_size;
+} region_t;
+
+// starts a region inside parent, which takes up where parent is and must not be used until the
+// nested region ends, or on the default heap if parent is NULL
+void region_begin(region_t* region, region_t* parent);
+
+// starts a region on heap
+void heap_region_begin(heap_t* heap, region_t* region);
+
+// allocates size bytes aligned to __region_alignment, taking a new chunk from the heap when the
+// current one is full, returns NULL if the heap is full
+void* region_alloc(region_t* region, size_t size);
+
+// frees everything allocated in the region since it began, a region started on a heap keeps its
+// first chunk for the allocations after the reset
+void region_reset(region_t* region);
+
+// frees everything allocated in the region, which can't be used afterwards
+void region_end(region_t* region);
+
+#if defined(allocator_v1_implementation) || defined(allocator_v2_implementation)
+
+void heap_region_begin(heap_t* heap, region_t* region) {
+    region->heap = heap;
+    region->parent = NULL;
+    region->chunk = NULL;
+    region->cursor = NULL;
+    region->end = NULL;
+    region->chunk_begin = NULL;
+    region->cursor_begin = NULL;
+    region->end_begin = NULL;
+    region->chunk_size = allocator_region_chunk_size;
+}
+
+void region_begin(region_t* region, region_t* parent) {
+
+    if ( parent == NULL ) {
+        heap_region_begin(__heap_default, region);
+        return;
+    }
+
+    // the nested region bumps through the space parent has left, so parent's own cursor is
+    // where the nested region began once it ends
+    *region = *parent;
+    region->parent = parent;
+    region->chunk_begin = parent->chunk;
+    region->cursor_begin = parent->cursor;
+    region->end_begin = parent->end;
+
+}
+
+// takes a new chunk from the heap for an allocation of size bytes that doesn't fit the current one
+void* __region_alloc_chunk(region_t* region, size_t size) {
+
+    if ( size > SIZE_MAX - __region_chunk_header_size ) { return NULL; }
+    size_t size_chunk = size + __region_chunk_header_size;
+
+    __region_chunk_t* chunk = NULL;
+    if ( size_chunk < region->chunk_size ) { chunk = (__region_chunk_t*)heap_alloc(region->heap, region->chunk_size); }
+    if ( chunk != NULL ) {
+        size_chunk = region->chunk_size;
+        if ( region->chunk_size < allocator_region_chunk_max ) { region->chunk_size *= 2; }
+    } else {
+        // a heap that can't fit a full chunk may still fit the allocation
+        chunk = (__region_chunk_t*)heap_alloc(region->heap, size_chunk);
+        if ( chunk == NULL ) { return NULL; }
+    }
+
+    __allocdebugprintf("region %p: new chunk of %zu bytes\n", (void*)region, size_chunk);
+
+    chunk->prev = region->chunk;
+    chunk->end = (char*)chunk + size_chunk;
+
+    // a region started on a heap holds on to its first chunk until it ends
+    if ( region->parent == NULL && region->chunk == NULL ) {
+        region->chunk_begin = chunk;
+        region->cursor_begin = (char*)chunk + __region_chunk_header_size;
+        region->end_begin = chunk->end;
+    }
+
+    region->chunk = chunk;
+    region->cursor = (char*)chunk + __region_chunk_header_size + size;
+    region->end = chunk->end;
+
+    return (char*)chunk + __region_chunk_header_size;
+}
+
+void* region_alloc(region_t* region, size_t size) {
+
+    // every allocation gets its own address, even the empty ones
+    if ( size > SIZE_MAX - __region_alignment ) { return NULL; }
+    size = size ? (size + __region_alignment - 1) & ~(size_t)(__region_alignment - 1) : __region_alignment;
+
+    if ( (size_t)(region->end - region->cursor) >= size ) {
+        void* ptr = region->cursor;
+        region->cursor += size;
+        return ptr;
+    }
+
+    return __region_alloc_chunk(region, size);
+}
+
+// frees every chunk taken since the region began
+void __region_free_chunks(region_t* region) {
+    while ( region->chunk != region->chunk_begin ) {
+        __region_chunk_t* prev = region->chunk->prev;
+        heap_free(region->heap, region->chunk);
+        region->chunk = prev;
+    }
+}
+
+void region_reset(region_t* region) {
+    __region_free_chunks(region);
+    region->cursor = region->cursor_begin;
+    region->end = region->end_begin;
+}
+
+void region_end(region_t* region) {
+
+    __region_free_chunks(region);
+
+    if ( region->parent == NULL && region->chunk != NULL ) {
+        heap_free(region->heap, region->chunk);
+        region->chunk = NULL;
+    }
+
+    region->cursor = region->cursor_begin = NULL;
+    region->end = region->end_begin = NULL;
+    region->chunk_begin = NULL;
+
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
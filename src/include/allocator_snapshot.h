@@ -0,0 +1,50 @@
+#ifndef ALLOC_SNAPSHOT_H
+#define ALLOC_SNAPSHOT_H
+
+// heap_snapshot_write writes the layout of a heap to a binary file, which tools/snapshot_view
+// turns into a fragmentation map and a table of free block sizes without the process that wrote
+// it, both v1 and v2 write this format
+
+#include <stdint.h>
+
+#define heap_snapshot_allocated 1
+#define heap_snapshot_free 2
+// a page of the v2 slab tier, with the object size and the objects in use
+#define heap_snapshot_slab 3
+// an allocation with a mapping of its own, outside of the heap region
+#define heap_snapshot_large 4
+
+typedef struct {
+    // bytes from the heap base, the address for large allocations
+    uint64_t offset;
+    uint64_t size;
+    // call site of the allocation, 0 if it wasn't recorded
+    uint64_t site;
+    uint16_t state;
+    // slab pages only, 0 for pages that were never handed out
+    uint16_t object_size;
+    uint16_t n_objects;
+    uint16_t n_used;
+} heap_snapshot_block_t;
+
+// snapshot files start with this header, followed by the blocks in address order and the large
+// allocations after them
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t block_size;
+    // 1 for v1 and 2 for v2
+    uint32_t allocator;
+    // bytes of the region the heap manages
+    uint64_t heap_size;
+    // bytes from the base to the end of the last block
+    uint64_t data_bytes;
+    // bytes of the v2 sector table at the end of the region, or of the v1 sector headers
+    uint64_t metadata_bytes;
+    uint64_t n_blocks;
+} heap_snapshot_header_t;
+
+#define heap_snapshot_file_magic "ALSN"
+#define heap_snapshot_file_version 1
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef ALLOC_TRACE_H
+#define ALLOC_TRACE_H
+
+// define allocator_trace_enable to record every heap_alloc, heap_realloc and heap_free into a
+// ring buffer of fixed size binary events, without any formatting on the allocation path, and
+// to be able to stream every event to a trace file with heap_trace_record_start
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the event and file formats are always defined so tools can read traces without recording
+
+#define heap_trace_alloc 1
+#define heap_trace_realloc 2
+#define heap_trace_free 3
+
+typedef struct {
+    // nanoseconds on the monotonic clock
+    uint64_t timestamp;
+    // heap the call was made on
+    uint64_t heap;
+    // pointer passed in, 0 for heap_alloc
+    uint64_t ptr;
+    // pointer returned, 0 for heap_free
+    uint64_t ptr_result;
+    // bytes requested, 0 for heap_free
+    uint32_t size;
+    uint16_t type;
+    // numbered in the order threads made their first traced call
+    uint16_t thread;
+} heap_trace_event_t;
+
+// trace files start with this header, followed by the events of every thread in batches, so
+// they are only in timestamp order within a thread
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t event_size;
+    uint32_t reserved;
+} heap_trace_file_header_t;
+
+#define heap_trace_file_magic "ALTR"
+#define heap_trace_file_version 1
+
+#ifdef allocator_trace_enable
+
+#include <stdio.h>
+#include <time.h>
+
+// number of events kept, must be a power of two
+#ifndef allocator_trace_size
+    #define allocator_trace_size 4096
+#endif
+
+#if allocator_trace_size & (allocator_trace_size - 1)
+    #error "allocator_trace_size must be a power of two"
+#endif
+
+// number of events every thread collects before writing them to the trace file
+#ifndef allocator_trace_record_batch
+    #define allocator_trace_record_batch 256
+#endif
+
+// number of events recorded so far, including the ones the ring buffer has overwritten
+size_t heap_trace_count();
+
+// copies up to max of the most recent events into events, oldest first, returns how many
+size_t heap_trace_read(heap_trace_event_t* events, size_t max);
+
+// forgets every recorded event
+void heap_trace_clear();
+
+// starts writing every event to the trace file at path, returns 0 if it can't be opened
+int heap_trace_record_start(const char* path);
+
+// writes out the events every thread still holds and closes the trace file, the other threads
+// must not allocate while it runs
+void heap_trace_record_stop();
+
+#define __alloctrace(type, heap, ptr, ptr_result, size) __heap_trace_record(type, heap, ptr, ptr_result, size)
+
+#if defined(allocator_v1_implementation) || defined(allocator_v2_implementation)
+
+heap_trace_event_t __heap_trace_events[allocator_trace_size];
+
+// every thread collects the events it records before writing them out in one go
+typedef struct __heap_trace_batch_t {
+    heap_trace_event_t events[allocator_trace_record_batch];
+    size_t n_events;
+    struct __heap_trace_batch_t* next;
+} __heap_trace_batch_t;
+
+FILE* __heap_trace_file = NULL;
+
+#ifdef allocator_thread_safe
+
+#include <pthread.h>
+#include "allocator_atomic.h"
+#include <stdlib.h>
+
+// threads claim slots with one atomic add, a slot being overwritten while it is read can give a
+// torn event in heap_trace_read
+_Atomic(size_t) __heap_trace_n = 0;
+#define __heap_trace_claim() atomic_fetch_add_explicit(&__heap_trace_n, 1, memory_order_relaxed)
+#define __heap_trace_total() atomic_load_explicit(&__heap_trace_n, memory_order_relaxed)
+
+_Atomic(uint16_t) __heap_trace_n_threads = 0;
+_Thread_local int __heap_trace_thread = -1;
+
+// guards the trace file and the list of batches
+pthread_mutex_t __heap_trace_file_lock = PTHREAD_MUTEX_INITIALIZER;
+_Thread_local __heap_trace_batch_t* __heap_trace_thread_batch = NULL;
+__heap_trace_batch_t* __heap_trace_batches = NULL;
+
+#define __heap_trace_file_lock_acquire() pthread_mutex_lock(&__heap_trace_file_lock)
+#define __heap_trace_file_lock_release() pthread_mutex_unlock(&__heap_trace_file_lock)
+
+uint16_t __heap_trace_thread_id() {
+    if ( __heap_trace_thread < 0 ) { __heap_trace_thread = atomic_fetch_add_explicit(&__heap_trace_n_threads, 1, memory_order_relaxed); }
+    return __heap_trace_thread;
+}
+
+#else
+
+size_t __heap_trace_n = 0;
+#define __heap_trace_claim() __heap_trace_n++
+#define __heap_trace_total() __heap_trace_n
+
+__heap_trace_batch_t __heap_trace_batch_storage;
+__heap_trace_batch_t* __heap_trace_thread_batch = NULL;
+__heap_trace_batch_t* __heap_trace_batches = NULL;
+
+#define __heap_trace_file_lock_acquire()
+#define __heap_trace_file_lock_release()
+
+#define __heap_trace_thread_id() 0
+
+#endif
+
+// the caller holds the trace file lock
+void __heap_trace_batch_write(__heap_trace_batch_t* batch) {
+    if ( __heap_trace_file != NULL ) { fwrite(batch->events, sizeof(heap_trace_event_t), batch->n_events, __heap_trace_file); }
+    batch->n_events = 0;
+}
+
+// batches are kept for the lifetime of the program so exited threads can't leave dangling ones
+__heap_trace_batch_t* __heap_trace_batch_new() {
+#ifdef allocator_thread_safe
+    __heap_trace_batch_t* batch = (__heap_trace_batch_t*)calloc(1, sizeof(__heap_trace_batch_t));
+    if ( batch == NULL ) { return NULL; }
+#else
+    __heap_trace_batch_t* batch = &__heap_trace_batch_storage;
+#endif
+    __heap_trace_file_lock_acquire();
+    batch->next = __heap_trace_batches;
+    __heap_trace_batches = batch;
+    __heap_trace_file_lock_release();
+    return batch;
+}
+
+void __heap_trace_record(uint32_t type, void* heap, void* ptr, void* ptr_result, size_t size) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    heap_trace_event_t event;
+    event.timestamp = (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+    event.heap = (uintptr_t)heap;
+    event.ptr = (uintptr_t)ptr;
+    event.ptr_result = (uintptr_t)ptr_result;
+    event.size = size > UINT32_MAX ? UINT32_MAX : size;
+    event.type = type;
+    event.thread = __heap_trace_thread_id();
+
+    __heap_trace_events[__heap_trace_claim() & (allocator_trace_size - 1)] = event;
+
+    if ( __heap_trace_file == NULL ) { return; }
+
+    if ( __heap_trace_thread_batch == NULL ) {
+        __heap_trace_thread_batch = __heap_trace_batch_new();
+        if ( __heap_trace_thread_batch == NULL ) { return; }
+    }
+
+    __heap_trace_batch_t* batch = __heap_trace_thread_batch;
+    batch->events[batch->n_events++] = event;
+    if ( batch->n_events == allocator_trace_record_batch ) {
+        __heap_trace_file_lock_acquire();
+        __heap_trace_batch_write(batch);
+        __heap_trace_file_lock_release();
+    }
+
+}
+
+size_t heap_trace_count() {
+    return __heap_trace_total();
+}
+
+size_t heap_trace_read(heap_trace_event_t* events, size_t max) {
+    size_t n_total = __heap_trace_total();
+    size_t n = n_total < allocator_trace_size ? n_total : allocator_trace_size;
+    n = n < max ? n : max;
+    for ( size_t i = 0; i < n; i++ ) {
+        events[i] = __heap_trace_events[(n_total - n + i) & (allocator_trace_size - 1)];
+    }
+    return n;
+}
+
+void heap_trace_clear() {
+#ifdef allocator_thread_safe
+    atomic_store_explicit(&__heap_trace_n, 0, memory_order_relaxed);
+#else
+    __heap_trace_n = 0;
+#endif
+}
+
+int heap_trace_record_start(const char* path) {
+
+    FILE* file = fopen(path, "wb");
+    if ( file == NULL ) { return 0; }
+
+    heap_trace_file_header_t header = { { 'A', 'L', 'T', 'R' }, heap_trace_file_version, sizeof(heap_trace_event_t), 0 };
+    fwrite(&header, sizeof(header), 1, file);
+
+    __heap_trace_file_lock_acquire();
+    for ( __heap_trace_batch_t* batch = __heap_trace_batches; batch != NULL; batch = batch->next ) { batch->n_events = 0; }
+    __heap_trace_file = file;
+    __heap_trace_file_lock_release();
+
+    return 1;
+}
+
+void heap_trace_record_stop() {
+
+    __heap_trace_file_lock_acquire();
+    for ( __heap_trace_batch_t* batch = __heap_trace_batches; batch != NULL; batch = batch->next ) { __heap_trace_batch_write(batch); }
+    if ( __heap_trace_file != NULL ) { fclose(__heap_trace_file); }
+    __heap_trace_file = NULL;
+    __heap_trace_file_lock_release();
+
+}
+
+#endif
+
+#else
+
+#define __alloctrace(type, heap, ptr, ptr_result, size)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
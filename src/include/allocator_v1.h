@@ -1,10 +1,22 @@
 #ifndef ALLOC_V1_H
 #define ALLOC_V1_H
 
-#define allocator_debug_enable
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
+#include "allocator_trace.h"
+#include "allocator_profile.h"
+#include "allocator_snapshot.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// define allocator_debug_enable to print every step the allocator takes, release builds leave
+// it out
 #ifdef allocator_debug_enable
-    #include <stdio.h>
     #define __allocdebugprintf(...) printf(__VA_ARGS__)
 #else
     #define __allocdebugprintf(...)
@@ -12,16 +24,32 @@
 
 #define __ULL_SIZE_MAX 0xffffffffffffffff
 
-// pointer to the heap base
-void* __heap_base;
-
-// number of allocation sectors in the heap
-#define __heap_n_sectors 128
+// sectors have to hold their header and the free list links
+#define __heap_min_sector_size 64
+
+// heaps are split into sectors of a power of two bytes, every heap picks its own sector size
+// with heap_init_sectors unless allocator_v1_sector_size fixes it at compile time, which turns
+// the sector math into shifts by a constant
+#ifdef allocator_v1_sector_size
+    #if allocator_v1_sector_size & (allocator_v1_sector_size - 1) || allocator_v1_sector_size < __heap_min_sector_size
+        #error "allocator_v1_sector_size must be a power of two of at least __heap_min_sector_size"
+    #endif
+    #define __heap_sector_shift(heap) ((size_t)__builtin_ctzll(allocator_v1_sector_size))
+#else
+    #define __heap_sector_shift(heap) ((heap)->sector_shift)
+#endif
 
-// size of allocation sectors
-#define __heap_sector_alignment 256
+// size of allocation sectors in bytes
+#define __heap_sector_alignment(heap) ((size_t)1 << __heap_sector_shift(heap))
 
-#define __heap_size __heap_n_sectors*__heap_sector_alignment
+// sector size of heaps set up without one
+#ifndef allocator_v1_default_sector_size
+    #ifdef allocator_v1_sector_size
+        #define allocator_v1_default_sector_size allocator_v1_sector_size
+    #else
+        #define allocator_v1_default_sector_size 256
+    #endif
+#endif
 
 typedef struct __heap_sector_t {
 
@@ -31,128 +59,320 @@ typedef struct __heap_sector_t {
 
 } __heap_sector_t;
 
+// every allocation is aligned to this many bytes
+#define __heap_alignment __alignof__(max_align_t)
+
+// largest alignment heap_alloc_aligned accepts
+#define __heap_max_alignment 4096
+
+// the user data of a sector starts this far into it, the word right before every user pointer
+// holds its distance from the start of its sector so aligned allocations can start further in
+#define __heap_sector_header_size ((sizeof(__heap_sector_t) + sizeof(size_t) + __heap_alignment - 1) & ~(__heap_alignment - 1))
+
+// free sectors are kept in bins by size, bin n holds sectors that are 2^n to 2^(n+1)-1 sectors long
+#define __heap_n_bins 64
+
+// stored in the data section of free sectors
+typedef struct {
+    __heap_sector_t* prev_free;
+    __heap_sector_t* next_free;
+} __heap_free_links_t;
+
+typedef struct heap_t {
+
+    // pointer to the heap base
+    void* base;
+
+    // pointer to the end of the last whole sector in the region
+    void* end;
+
+    // log2 of the sector size
+    size_t sector_shift;
+
+    // first free sector in every bin
+    __heap_sector_t* bins[__heap_n_bins];
+
+    // bit n is set if bin n is non-empty
+    uint64_t bin_bitmap;
+
+    // the last sector in the heap
+    __heap_sector_t* top_sector;
+
+} heap_t;
+
+// creates a heap in the region at base, the heap_t itself is stored at the start of the region
+heap_t* heap_create(void* base, size_t size);
+
+// sets up a heap whose heap_t is stored outside of the region at base
+void heap_init(heap_t* heap, void* base, size_t size);
+
+// like heap_init with sectors of sector_size bytes, which is rounded up to a power of two of at
+// least __heap_min_sector_size and ignored if allocator_v1_sector_size is defined
+void heap_init_sectors(heap_t* heap, void* base, size_t size, size_t sector_size);
+
+// frees every allocation in the heap at once
+void heap_reset(heap_t* heap);
+
+// must be called before the region of a heap is used for anything else
+void heap_destroy(heap_t* heap);
+
+void* heap_alloc(heap_t* heap, size_t size);
+void* heap_realloc(heap_t* heap, void* ptr, size_t size_new);
+void heap_free(heap_t* heap, void* ptr);
+void heap_print(heap_t* heap);
+
+// writes the layout of the heap to a snapshot file at path, described in allocator_snapshot.h,
+// returns 0 if the file can't be written
+int heap_snapshot_write(heap_t* heap, const char* path);
+
+// allocates size bytes at a multiple of align, which has to be a power of two of at most
+// __heap_max_alignment, returns NULL otherwise or if the heap is full, heap_realloc only keeps the
+// alignment while the allocation doesn't move
+void* heap_alloc_aligned(heap_t* heap, size_t size, size_t align);
+
+// the mem* functions work on the default heap set up by memalloc_init
+void memalloc_init(void* heap_base, size_t heap_size);
+void* memalloc(size_t size);
+void* memalloc_aligned(size_t size, size_t align);
+void* memrealloc(void* ptr, size_t size_new);
+void memfree(void* ptr);
+void memprint();
+int memsnapshot(const char* path);
+
+// define allocator_v1_implementation in one source file before including this header
+#ifdef allocator_v1_implementation
+
+// the heap used by the mem* functions
+heap_t __heap_default_storage;
+heap_t* __heap_default = NULL;
+
 // returns pointer to the end of the heap
-void* __alloc_heap_end() {
-    return (void*)((char*)__heap_base + (__heap_n_sectors*__heap_sector_alignment));
+void* __alloc_heap_end(heap_t* heap) {
+    return heap->end;
 }
 
 // finds the top pointer in the heap
-void* __alloc_heap_top_ptr() {
-    __heap_sector_t* heap_sector = (__heap_sector_t*)__heap_base;
-
-    // find the end of the heap
-    while ( heap_sector->next != NULL ) {
-        heap_sector = heap_sector->next;
-    }
-
-    return (void*)heap_sector;
+void* __alloc_heap_top_ptr(heap_t* heap) {
+    return (void*)heap->top_sector;
 }
 
-size_t __find_sector_size(__heap_sector_t* sector) {
+// sectors are linked to their neighbours in memory, so the size of a sector is the distance to
+// the next one, the top sector has no next sector and is exactly as large as it needs to be
+size_t __find_sector_size(heap_t* heap, __heap_sector_t* sector) {
     
     if (sector->next != NULL) {
-        return (((char*)sector->next) - ((char*)sector))/__heap_sector_alignment;
+        return (size_t)(((char*)sector->next) - ((char*)sector)) >> __heap_sector_shift(heap);
     }
 
+    return sector->sectors_used;
+
 }
 
-// returns a pointer to the data section of the heap from a sector
+// returns the user pointer of a sector that is being allocated and stores its distance in front
 void* __alloc_user_ptr_from_sector(__heap_sector_t* sector) {
-    // does this even work?
-    return (void*)(sector+1);
+    char* ptr = (char*)sector + __heap_sector_header_size;
+    ((size_t*)ptr)[-1] = __heap_sector_header_size;
+    return (void*)ptr;
+}
+
+// returns the sector a user pointer claims to belong to, which still has to be checked with
+// __alloc_find_sector before it is used, or NULL if the pointer can't be in the heap
+__heap_sector_t* __alloc_sector_from_user_ptr(heap_t* heap, void* ptr) {
+    if ( (char*)ptr < (char*)heap->base + __heap_sector_header_size || (char*)ptr >= (char*)heap->end ) { return NULL; }
+    size_t offset = ((size_t*)ptr)[-1];
+    if ( offset < __heap_sector_header_size || offset > (size_t)((char*)ptr - (char*)heap->base) ) { return NULL; }
+    return (__heap_sector_t*)((char*)ptr - offset);
+}
+
+// returns whether a pointer is the start of a sector up to the top sector, only looking at where
+// it points
+int __alloc_sector_in_heap(heap_t* heap, __heap_sector_t* sector) {
+    size_t offset = (size_t)((char*)sector - (char*)heap->base);
+    return (char*)sector >= (char*)heap->base && sector <= heap->top_sector && !(offset & (__heap_sector_alignment(heap) - 1));
+}
+
+// returns the sector of a user pointer, or NULL if it isn't in the sector list, the neighbours of
+// a sector link back to it, which a header left behind in a sector that was merged away doesn't
+// have
+__heap_sector_t* __alloc_find_sector(heap_t* heap, void* ptr) {
+
+    __heap_sector_t* sector = __alloc_sector_from_user_ptr(heap, ptr);
+    if ( sector == NULL || !__alloc_sector_in_heap(heap, sector) ) { return NULL; }
+
+    if ( sector->prev == NULL ? (void*)sector != heap->base : !__alloc_sector_in_heap(heap, sector->prev) || sector->prev->next != sector ) { return NULL; }
+    if ( sector->next == NULL ? sector != heap->top_sector : !__alloc_sector_in_heap(heap, sector->next) || sector->next->prev != sector ) { return NULL; }
+
+    return sector;
+}
+
+__heap_free_links_t* __alloc_free_links(__heap_sector_t* sector) {
+    return (__heap_free_links_t*)(sector+1);
+}
+
+size_t __alloc_bin_index(size_t n_sectors) {
+    return 63 - __builtin_clzll(n_sectors);
+}
+
+// adds a free sector to its bin, the sector must not be the top sector
+void __alloc_bin_insert(heap_t* heap, __heap_sector_t* sector) {
+
+    size_t bin = __alloc_bin_index(__find_sector_size(heap, sector));
+    __heap_free_links_t* links = __alloc_free_links(sector);
+
+    links->prev_free = NULL;
+    links->next_free = heap->bins[bin];
+    if ( links->next_free != NULL ) { __alloc_free_links(links->next_free)->prev_free = sector; }
+
+    heap->bins[bin] = sector;
+    heap->bin_bitmap |= 1ULL << bin;
+
+}
+
+// removes a free sector from its bin, must be called before the size of the sector changes
+void __alloc_bin_remove(heap_t* heap, __heap_sector_t* sector) {
+
+    size_t bin = __alloc_bin_index(__find_sector_size(heap, sector));
+    __heap_free_links_t* links = __alloc_free_links(sector);
+
+    if ( links->next_free != NULL ) { __alloc_free_links(links->next_free)->prev_free = links->prev_free; }
+
+    if ( links->prev_free != NULL ) {
+        __alloc_free_links(links->prev_free)->next_free = links->next_free;
+    } else {
+        heap->bins[bin] = links->next_free;
+        if ( heap->bins[bin] == NULL ) { heap->bin_bitmap &= ~(1ULL << bin); }
+    }
+
+}
+
+// takes a free sector out of its bin for an allocation of sectors_needed sectors, the sectors it
+// doesn't need are split off into a free sector of their own
+void* __alloc_use_free_sector(heap_t* heap, __heap_sector_t* sector, size_t sectors_needed) {
+
+    __alloc_bin_remove(heap, sector);
+
+    if ( __find_sector_size(heap, sector) > sectors_needed ) {
+        __allocdebugprintf("\tsplitting sector\n");
+        __heap_sector_t* split = (__heap_sector_t*)((char*)sector + (sectors_needed << __heap_sector_shift(heap)));
+        split->sectors_used = 0;
+        split->prev = sector;
+        split->next = sector->next;
+        split->next->prev = split;
+        sector->next = split;
+        __alloc_bin_insert(heap, split);
+    }
+
+    sector->sectors_used = sectors_needed;
+    return __alloc_user_ptr_from_sector(sector);
 }
 
 // returns the number of free bytes in the heap
-size_t __alloc_get_free_space(__heap_sector_t *top_ptr) {
-    return (((char*)__alloc_heap_end()) - ((char*)top_ptr));
+size_t __alloc_get_free_space(heap_t* heap, __heap_sector_t *top_ptr) {
+    return (((char*)__alloc_heap_end(heap)) - ((char*)top_ptr));
 } 
 
 // returns the number of free sectors in the heap
-size_t __alloc_get_free_sectors(__heap_sector_t *top_ptr) {
-    return __alloc_get_free_space(top_ptr)/__heap_sector_alignment;
+size_t __alloc_get_free_sectors(heap_t* heap, __heap_sector_t *top_ptr) {
+    return __alloc_get_free_space(heap, top_ptr) >> __heap_sector_shift(heap);
 }
 
-void memalloc_init(void* heap_base) {
+// the heap spans the whole sectors that fit in the region, which must hold at least one
+void heap_init_sectors(heap_t* heap, void* base, size_t size, size_t sector_size) {
+
+#ifdef allocator_v1_sector_size
+    sector_size = allocator_v1_sector_size;
+#endif
+
+    size_t sector_shift = 0;
+    while ( ((size_t)1 << sector_shift) < sector_size || ((size_t)1 << sector_shift) < __heap_min_sector_size ) { sector_shift++; }
+
+    // sectors start on aligned addresses so the user data after their header does too
+    char* base_aligned = (char*)(((uintptr_t)base + __heap_alignment - 1) & ~(uintptr_t)(__heap_alignment - 1));
+    size = size > (size_t)(base_aligned - (char*)base) ? size - (base_aligned - (char*)base) : 0;
+    base = base_aligned;
 
-    __heap_base = heap_base;
+    heap->base = base;
+    heap->sector_shift = sector_shift;
+    heap->end = (char*)base + ((size >> __heap_sector_shift(heap)) << __heap_sector_shift(heap));
 
-    __allocdebugprintf("heap size is %llu bytes (%llu sectors)\n", __heap_n_sectors*__heap_sector_alignment, __heap_n_sectors);
-    __allocdebugprintf("heap sector size is %llu bytes\n", __heap_sector_alignment);
-    __allocdebugprintf("heap start pointer is %p\n", __heap_base);
+    __allocdebugprintf("heap size is %zu bytes (%zu sectors)\n", (size_t)((char*)heap->end - (char*)heap->base), (size_t)((char*)heap->end - (char*)heap->base) >> __heap_sector_shift(heap));
+    __allocdebugprintf("heap sector size is %zu bytes\n", __heap_sector_alignment(heap));
+    __allocdebugprintf("heap start pointer is %p\n", heap->base);
 
     // this might not work
-    __heap_sector_t* heap_sector_start = (__heap_sector_t*)__heap_base;
+    __heap_sector_t* heap_sector_start = (__heap_sector_t*)heap->base;
 
     // initialize the first heap sector
     heap_sector_start->sectors_used = 0;
     heap_sector_start->prev = NULL;
     heap_sector_start->next = NULL;
 
+    heap->top_sector = heap_sector_start;
+    heap->bin_bitmap = 0;
+    for ( size_t i = 0; i < __heap_n_bins; i++ ) { heap->bins[i] = NULL; }
+
     __allocdebugprintf("init done!\n");
 
 }
 
+void heap_init(heap_t* heap, void* base, size_t size) {
+    heap_init_sectors(heap, base, size, allocator_v1_default_sector_size);
+}
+
 
-void *memalloc(size_t size) {
+void* __heap_alloc_sectors(heap_t* heap, size_t size) {
 
     __allocdebugprintf("starting alloc\n");
 
-    size_t size_real = size + sizeof(__heap_sector_t);
+    if ( size > (size_t)((char*)heap->end - (char*)heap->base) ) {
+        __allocdebugprintf("\tERROR: allocation is larger than the heap!\n");
+        return NULL;
+    }
+
+    size_t size_real = size + __heap_sector_header_size;
 
     // number of sectors needed to store size bytes
-    size_t sectors_needed = (size_real/__heap_sector_alignment) + ((size_real%__heap_sector_alignment) != 0);
+    size_t sectors_needed = (size_real + __heap_sector_alignment(heap) - 1) >> __heap_sector_shift(heap);
 
     __allocdebugprintf("\tattempting to find unused sectors\n");
 
-    __heap_sector_t* sector_cur = (__heap_sector_t*)__heap_base;
+    // every sector in the bin for the next power of two up is large enough
+    size_t bin = __alloc_bin_index(sectors_needed) + ((sectors_needed & (sectors_needed-1)) != 0);
+    uint64_t bin_map = bin < __heap_n_bins ? heap->bin_bitmap & (~0ULL << bin) : 0;
 
-    __heap_sector_t* smallest_valid_sector = NULL;
-    size_t smallest_valid_sector_n = __ULL_SIZE_MAX;
+    if ( bin_map ) {
 
-    while (sector_cur->next != NULL) {
-
-        if ( sector_cur->sectors_used == 0 ) {
-            if ( __find_sector_size(sector_cur) >= sectors_needed ) {
-                if ( __find_sector_size(sector_cur) < smallest_valid_sector_n ) {
-                    smallest_valid_sector_n = __find_sector_size(sector_cur);
-                    smallest_valid_sector = sector_cur;
-                }
-            }
-        }
-     
-        sector_cur = sector_cur->next;
-    }
-
-    if ( smallest_valid_sector != NULL ) {
+        __heap_sector_t* free_sector = heap->bins[__builtin_ctzll(bin_map)];
 
         __allocdebugprintf("\tlocated a valid pre-existing sector\n");
-        smallest_valid_sector->sectors_used = sectors_needed;
+        void* ptr = __alloc_use_free_sector(heap, free_sector, sectors_needed);
 
         __allocdebugprintf("\tallocation success\n");
-        return __alloc_user_ptr_from_sector(smallest_valid_sector);
+        return ptr;
 
     }
 
     __allocdebugprintf("\tfinding top sector\n");
 
     // get the top pointer
-    __heap_sector_t* top_sector = (__heap_sector_t*)__alloc_heap_top_ptr();
+    __heap_sector_t* top_sector = (__heap_sector_t*)__alloc_heap_top_ptr(heap);
 
     __allocdebugprintf("\tchecking to see if there is enough space for allocation\n");
 
+    // get the next pointer (but don't initialize it yet)
+    __heap_sector_t* next = (__heap_sector_t*)(((char*)(top_sector))+(top_sector->sectors_used << __heap_sector_shift(heap)));
+
     // if there is space for the allocation
-    if ( __alloc_get_free_sectors(top_sector) >= sectors_needed ) {
+    if ( __alloc_get_free_sectors(heap, next) >= sectors_needed ) {
         
         __allocdebugprintf("\tfinding address of the next pointer\n");
 
-        // get the next pointer (but don't initialize it yet)
-        __heap_sector_t* next = (__heap_sector_t*)(((char*)(top_sector))+(top_sector->sectors_used*__heap_sector_alignment));
-        __allocdebugprintf("\tnext heap sector is at 0x%p (%llu bytes from top sector)\n", next, ((char*)next)-((char*)__heap_base));
+        __allocdebugprintf("\tnext heap sector is at 0x%p (%llu bytes from top sector)\n", next, ((char*)next)-((char*)heap->base));
 
         __allocdebugprintf("\tallocating %llu sectors (%llu bytes)\n", sectors_needed, size_real);        
         __allocdebugprintf("\tinitializing next pointer\n");        
  
-        if ( next == __heap_base ) {
+        if ( next == heap->base ) {
             __allocdebugprintf("\tallocating at heap base\n");
 
             next->prev = NULL;
@@ -169,60 +389,88 @@ void *memalloc(size_t size) {
 
         }       
 
+        heap->top_sector = next;
+
         __allocdebugprintf("\tallocation success\n");
 
         return __alloc_user_ptr_from_sector(next);
 
-    } else {        
-        __allocdebugprintf("\tERROR: not enough memory for allocation!\nbytes available: %llu\nbytes needed: %llu\n", __alloc_get_free_space(top_sector), size_real);
-        return NULL;
     }
+
+    // sectors in the bin below might still be large enough
+    if ( bin > 0 && bin - 1 < __heap_n_bins ) {
+        for ( __heap_sector_t* free_sector = heap->bins[bin-1]; free_sector != NULL; free_sector = __alloc_free_links(free_sector)->next_free ) {
+            if ( __find_sector_size(heap, free_sector) >= sectors_needed ) {
+                __allocdebugprintf("\tlocated a valid pre-existing sector\n");
+                void* ptr = __alloc_use_free_sector(heap, free_sector, sectors_needed);
+                __allocdebugprintf("\tallocation success\n");
+                return ptr;
+            }
+        }
+    }
+
+    __allocdebugprintf("\tERROR: not enough memory for allocation!\nbytes available: %llu\nbytes needed: %llu\n", __alloc_get_free_space(heap, top_sector), size_real);
+    return NULL;
 }
 
-void memfree(void* ptr) {
+void __heap_free_sectors(heap_t* heap, void* ptr) {
 
     __allocdebugprintf("initializing memory free\n");
 
-    __heap_sector_t* sector = (__heap_sector_t*)__heap_base;
-
-    __heap_sector_t* dealloc_sector = (__heap_sector_t*)(((char*)ptr)-sizeof(__heap_sector_t));
-    
     // make sure this pointer is a heap sector
-    while ( sector != dealloc_sector ) {
-        
-        // __allocdebugprintf("comparing %p with %p (%i bytes apart)\n", dealloc_sector, sector, (signed long long)((ptrdiff_t)((char*)dealloc_sector)-(ptrdiff_t)((char*)sector)));
-
-        // this code should only run if the pointer isnt a heap sector
-        if ( sector->next == NULL ) {
-            __allocdebugprintf("\theap sector doesnt exist!\n");
-            return;
-        }
-
-        sector = sector->next;
+    __heap_sector_t* sector = __alloc_find_sector(heap, ptr);
+    if ( sector == NULL ) {
+        __allocdebugprintf("\theap sector doesnt exist!\n");
+        return;
     }
 
     __allocdebugprintf("\tpointer found and validated\n");
 
-    // if this is the base pointer and the only allocation
-    if ( sector->next == NULL && sector->prev == NULL ) {
-        __allocdebugprintf("\tfreeing base pointer\n");
-        sector->sectors_used = 0;
+    if ( sector->sectors_used == 0 ) {
+        __allocdebugprintf("\tsector is already free\n");
         return;
     }
 
-    // if this is the top pointer
+    sector->sectors_used = 0;
+
+    // if this is the top pointer, give it and the free sector below it back to the free space
     if ( sector->next == NULL ) {
         __allocdebugprintf("\tfreeing top pointer\n");
-        sector->prev->next = NULL;
-        sector->sectors_used = 0;
+        while ( sector->prev != NULL ) {
+            __heap_sector_t* prev = sector->prev;
+            if ( prev->sectors_used == 0 ) { __alloc_bin_remove(heap, prev); }
+            prev->next = NULL;
+            heap->top_sector = prev;
+            if ( prev->sectors_used != 0 ) { return; }
+            sector = prev;
+        }
+        __allocdebugprintf("\tfreeing base pointer\n");
         return;
     }
 
+    // free sectors are merged with their neighbours right away, so there is never more than one
+    // free sector on either side
+
+    // merge with next pointer, free sectors are never the top sector
+    if ( sector->next->sectors_used == 0 ) {
+        __allocdebugprintf("\tmerging with next sector\n");
+        __heap_sector_t* next = sector->next;
+        __alloc_bin_remove(heap, next);
+        sector->next = next->next;
+        sector->next->prev = sector;
+    }
+
     // merge with previous pointer
+    if ( sector->prev != NULL && sector->prev->sectors_used == 0 ) { 
+        __allocdebugprintf("\tmerging with previous sector\n");
+        __heap_sector_t* prev = sector->prev;
+        __alloc_bin_remove(heap, prev);
+        prev->next = sector->next;
+        sector->next->prev = prev;
+        sector = prev;
+    }
 
-    if ( sector->prev->sectors_used != 0 ) { sector->prev->sectors_used += sector->sectors_used; }
-    sector->prev->next = sector->next;
-    sector->next->prev = sector->prev;
+    __alloc_bin_insert(heap, sector);
 
     __allocdebugprintf("\tmemory freed\n");
 
@@ -230,35 +478,29 @@ void memfree(void* ptr) {
 
 }
 
-void *memrealloc(void* ptr, size_t size_new) {
+void* __heap_realloc_sectors(heap_t* heap, void* ptr, size_t size_new) {
 
     __allocdebugprintf("initializing memory reallocation\n");
 
-    __heap_sector_t* sector = (__heap_sector_t*)__heap_base;
-
-    __heap_sector_t* realloc_sector = (__heap_sector_t*)(((char*)ptr)-sizeof(__heap_sector_t));
-    
-    // make sure this pointer is a heap sector
-    while ( sector != realloc_sector ) {
-        
-        // this code should only run if the pointer isnt a heap sector
-        if ( sector->next == NULL ) {
-            __allocdebugprintf("\theap sector doesnt exist!\n");
-            return NULL;
-        }
-
-        sector = sector->next;
+    // make sure this pointer is a heap sector that is in use
+    __heap_sector_t* realloc_sector = __alloc_find_sector(heap, ptr);
+    if ( realloc_sector == NULL || realloc_sector->sectors_used == 0 ) {
+        __allocdebugprintf("\theap sector doesnt exist!\n");
+        return NULL;
     }
 
     __allocdebugprintf("\tpointer found and validated\n");
 
-    if ( size_new <= (realloc_sector->sectors_used*__heap_sector_alignment) - sizeof(__heap_sector_t) ) {
+    // aligned allocations start further into their sector
+    size_t size_old = (realloc_sector->sectors_used << __heap_sector_shift(heap)) - ((char*)ptr - (char*)realloc_sector);
+
+    if ( size_new <= size_old ) {
         __allocdebugprintf("\tcurrent sector is large enough to store the data needed\n");
         __allocdebugprintf("\trealloc success\n");
         return ptr;
     }
 
-    void* userdata_ptr_new = memalloc(size_new);
+    void* userdata_ptr_new = __heap_alloc_sectors(heap, size_new);
 
     if ( userdata_ptr_new == NULL ) { 
         __allocdebugprintf("\trealloc failed!\n");
@@ -266,21 +508,79 @@ void *memrealloc(void* ptr, size_t size_new) {
     }
 
     __allocdebugprintf("\tcopying data to new sector\n");
-    // copy data to new sector
-    for ( size_t i = 0; i < realloc_sector->sectors_used * __heap_sector_alignment; i++ ) {
-        ((char*)userdata_ptr_new)[i] = ((char*)__alloc_user_ptr_from_sector(realloc_sector))[i];
-    }    
+    // the old payload is smaller than size_new here, the sector header isn't part of it
+    memcpy(userdata_ptr_new, ptr, size_old);
 
     __allocdebugprintf("\tfreeing old memory");
-    memfree(ptr);
+    __heap_free_sectors(heap, ptr);
     __allocdebugprintf("\trealloc success\n");
 
     return userdata_ptr_new;
 }
 
-void memprint() {
+void* __heap_alloc_unsampled(heap_t* heap, size_t size) {
+    void* ptr = __heap_alloc_sectors(heap, size);
+    __alloctrace(heap_trace_alloc, heap, NULL, ptr, size);
+    return ptr;
+}
+
+#ifdef allocator_profile_enable
+// allocations that use up the countdown are made and sampled out of line
+__attribute__((noinline, cold)) void* __heap_alloc_sampled(heap_t* heap, size_t size, void* caller) {
+    void* ptr = __heap_alloc_unsampled(heap, size);
+    if ( ptr != NULL ) { __heap_profile_sample(ptr, size, caller); }
+    return ptr;
+}
+#endif
+
+void* heap_alloc(heap_t* heap, size_t size) {
+#ifdef allocator_profile_enable
+    if ( __allocprofile_due(size) ) { return __heap_alloc_sampled(heap, size, __builtin_return_address(0)); }
+#endif
+    return __heap_alloc_unsampled(heap, size);
+}
+
+void* heap_realloc(heap_t* heap, void* ptr, size_t size_new) {
+    void* ptr_new = __heap_realloc_sectors(heap, ptr, size_new);
+    __alloctrace(heap_trace_realloc, heap, ptr, ptr_new, size_new);
+    __allocprofile(heap_trace_realloc, ptr, ptr_new, size_new);
+    return ptr_new;
+}
+
+void* heap_alloc_aligned(heap_t* heap, size_t size, size_t align) {
+
+    if ( align & (align - 1) || align > __heap_max_alignment ) { return NULL; }
+    if ( align <= __heap_alignment ) { return heap_alloc(heap, size); }
+
+    // sectors only start at multiples of the sector size, so the user data moves forward in an
+    // allocation with room for it at any alignment
+    if ( size > SIZE_MAX - align ) { return NULL; }
+    char* ptr = (char*)__heap_alloc_sectors(heap, size + align - __heap_alignment);
+    if ( ptr != NULL ) {
+        __heap_sector_t* sector = (__heap_sector_t*)(ptr - __heap_sector_header_size);
+        ptr = (char*)(((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1));
+        ((size_t*)ptr)[-1] = ptr - (char*)sector;
+    }
+
+    __alloctrace(heap_trace_alloc, heap, NULL, ptr, size);
+    __allocprofile(heap_trace_alloc, NULL, ptr, size);
+    return ptr;
+}
+
+// frees are traced before the block can be handed out again, so an allocation that reuses it
+// always comes after the free in the trace
+void heap_free(heap_t* heap, void* ptr) {
+    __alloctrace(heap_trace_free, heap, ptr, NULL, 0);
+#ifdef allocator_profile_enable
+    // the pointers the filter of the profiler knows about are looked up out of line
+    if ( ptr != NULL && __allocprofile_followed(ptr) ) { __heap_profile_forget(ptr); }
+#endif
+    __heap_free_sectors(heap, ptr);
+}
+
+void heap_print(heap_t* heap) {
     
-    __heap_sector_t* sector = (__heap_sector_t*)__heap_base;
+    __heap_sector_t* sector = (__heap_sector_t*)heap->base;
     int sector_n = 0;
 
     while(sector != NULL) {
@@ -288,11 +588,11 @@ void memprint() {
         printf("sector %i:\n", sector_n);
         if ( sector->sectors_used ) {
             printf("\tsector is in use\n");
-            printf("\tsize: %llu bytes (%llu sectors)\n", sector->sectors_used*__heap_sector_alignment, sector->sectors_used);           
+            printf("\tsize: %zu bytes (%zu sectors)\n", sector->sectors_used << __heap_sector_shift(heap), sector->sectors_used);
         } else {
-            ptrdiff_t sector_size = ((char*)sector->next) - ((char*)sector);
+            size_t sector_size = __find_sector_size(heap, sector);
             printf("\tsector is not in use\n");
-            printf("\tsize: %lls bytes (%lls sectors)\n", sector_size, sector_size/__heap_sector_alignment);
+            printf("\tsize: %zu bytes (%zu sectors)\n", sector_size << __heap_sector_shift(heap), sector_size);
         }
 
         printf("\n");
@@ -303,4 +603,99 @@ void memprint() {
 
 }
 
+int heap_snapshot_write(heap_t* heap, const char* path) {
+
+    FILE* file = fopen(path, "wb");
+    if ( file == NULL ) { return 0; }
+
+    heap_snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, heap_snapshot_file_magic, 4);
+    header.version = heap_snapshot_file_version;
+    header.block_size = sizeof(heap_snapshot_block_t);
+    header.allocator = 1;
+    header.heap_size = (char*)heap->end - (char*)heap->base;
+
+    // the header is written again once the blocks are counted
+    fwrite(&header, sizeof(header), 1, file);
+
+    for ( __heap_sector_t* sector = (__heap_sector_t*)heap->base; sector != NULL; sector = sector->next ) {
+        heap_snapshot_block_t block;
+        memset(&block, 0, sizeof(block));
+        block.offset = (char*)sector - (char*)heap->base;
+        block.size = __find_sector_size(heap, sector) << __heap_sector_shift(heap);
+        block.state = sector->sectors_used ? heap_snapshot_allocated : heap_snapshot_free;
+#ifdef allocator_profile_enable
+        if ( sector->sectors_used ) { block.site = heap_profile_site((char*)sector + __heap_sector_header_size); }
+#endif
+        fwrite(&block, sizeof(block), 1, file);
+        header.n_blocks++;
+        header.data_bytes = block.offset + block.size;
+    }
+
+    header.metadata_bytes = header.n_blocks*__heap_sector_header_size;
+
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    int ok = !ferror(file);
+    return !fclose(file) && ok;
+}
+
+heap_t* heap_create(void* base, size_t size) {
+
+    // keep the first sector as aligned as the region
+    size_t heap_t_size = (sizeof(heap_t) + 15) & ~(size_t)15;
+    if ( size < heap_t_size + allocator_v1_default_sector_size ) { return NULL; }
+
+    heap_t* heap = (heap_t*)base;
+    heap_init(heap, (char*)base + heap_t_size, size - heap_t_size);
+    return heap;
+}
+
+void heap_reset(heap_t* heap) {
+    heap_init_sectors(heap, heap->base, (char*)heap->end - (char*)heap->base, __heap_sector_alignment(heap));
+}
+
+// heaps don't own any resources besides their region
+void heap_destroy(heap_t* heap) {
+    (void)heap;
+}
+
+void memalloc_init(void* heap_base, size_t heap_size) {
+    __heap_default = &__heap_default_storage;
+    heap_init(__heap_default, heap_base, heap_size);
+}
+
+void* memalloc(size_t size) {
+    return heap_alloc(__heap_default, size);
+}
+
+void* memalloc_aligned(size_t size, size_t align) {
+    return heap_alloc_aligned(__heap_default, size, align);
+}
+
+void memfree(void* ptr) {
+    heap_free(__heap_default, ptr);
+}
+
+void* memrealloc(void* ptr, size_t size_new) {
+    return heap_realloc(__heap_default, ptr, size_new);
+}
+
+void memprint() {
+    heap_print(__heap_default);
+}
+
+int memsnapshot(const char* path) {
+    return heap_snapshot_write(__heap_default, path);
+}
+
+#endif // allocator_v1_implementation
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "allocator_region.h"
+
 #endif // ALLOC_H
\ No newline at end of file
@@ -1,27 +1,33 @@
 #ifndef ALLOC_V2_H
 #define ALLOC_V2_H
 
+#include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
-#define allocator_debug_enable
+#include "allocator_trace.h"
+#include "allocator_profile.h"
+#include "allocator_snapshot.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// define allocator_debug_enable to print every step the allocator takes, release builds leave
+// it out
 #ifdef allocator_debug_enable
-    #include <stdio.h>
     #define __allocdebugprintf(...) printf(__VA_ARGS__)
 #else
     #define __allocdebugprintf(...)
 #endif
 
-// pointer to the base of the heap, where allocations will start at
-void* __heap_base;
-
-// pointer to the top of the heap, where the sector data will start at
-void* __heap_top;
-
-size_t __heap_used_bytes = 0;
-size_t __heap_max_size = 0;
+// define allocator_v2_compact_metadata to use the packed 4 byte sector table, which has no
+// per-block header but needs a linear scan of the table to map between sectors and user pointers
+#ifdef allocator_v2_compact_metadata
 
+// sectors are stored in the same order as their blocks
 typedef union {
     uint32_t raw;
     struct {
@@ -33,317 +39,3546 @@ typedef union {
     } fields;
 } __heap_sector_data_t;
 
-#define __heap_minimum_allocation_size sizeof(__heap_sector_data_t)<<2
+#define __heap_block_header_size 0
 
-#define __heap_maximum_allocation_size (1<<30)-1
+// number of sector table entries every allocation and free looks at to remove the empty sectors
+// that merges leave behind
+#ifndef allocator_v2_compact_slice
+    #define allocator_v2_compact_slice 8
+#endif
 
-void memalloc_init(void* heap_base, size_t heap_size) {
-    
-    // initialize heap variables
-    __heap_base = heap_base;
-    __heap_max_size = heap_size;
-    __heap_top = (void*)((char*)__heap_base + __heap_max_size - sizeof(__heap_sector_data_t));
-    
-    // initialize top pointer
-    __heap_sector_data_t* heap_top_ptr = (__heap_sector_data_t*)__heap_top;
-    heap_top_ptr->fields.allocated = 0;
-    heap_top_ptr->fields.allocation_size = 0;
-    heap_top_ptr->fields.next_sector_exists = 0;
+// the sizes of the table are summed a group of sectors at a time with avx2 or sse2, whichever
+// the build targets, when mapping between sectors and user pointers, define
+// allocator_v2_no_simd to go one sector at a time instead
+#if !defined(allocator_v2_no_simd) && defined(__AVX2__)
+    #include <immintrin.h>
+    #define __heap_simd_width 8
+#elif !defined(allocator_v2_no_simd) && defined(__SSE2__)
+    #include <emmintrin.h>
+    #define __heap_simd_width 4
+#endif
 
-}
+#else
 
-void* __user_ptr_from_sector(__heap_sector_data_t* sector) {
-    __heap_sector_data_t* sector_cur = (__heap_sector_data_t*)__heap_top;
-    char* data_ptr = (char*)__heap_base;
-    while ( sector != sector_cur ) {
-        data_ptr += sector_cur->fields.allocation_size;
-        if ( !sector_cur->fields.next_sector_exists ) { return NULL; }
-        sector_cur -= 1;
-    }
-    return (void*)data_ptr;
-}
+// sectors are found through the header of their block, so the table can be in any order and
+// unused entries are kept in a list to be handed out again
+typedef union {
+    uint64_t raw;
+    struct {
+        uint32_t allocated: 1;
+        // true if the block before this one in memory is free
+        uint32_t prev_free: 1;
+        // number of bytes allocated, including the block header, 0 if the sector is unused
+        uint32_t allocation_size: 30;
+        // offset of the sector's data from the heap base, or the next unused sector if unused
+        uint32_t offset;
+    } fields;
+} __heap_sector_data_t;
 
-__heap_sector_data_t* __heap_sector_from_user_pointer(void* usr_ptr) {
+// header placed in front of every user pointer so the sector can be found without a scan
+typedef struct {
+    // index of the sector in the sector table (0 is the heap top)
+    uint32_t sector_idx;
+#ifdef allocator_thread_safe
+    // thread cache the block belongs to, 0 if it belongs to the shared heap
+    uint16_t owner;
+    // size class of the block while it belongs to a thread cache
+    uint16_t size_class;
+#endif
+} __heap_block_header_t;
 
-    __heap_sector_data_t* sector_cur = (__heap_sector_data_t*)__heap_top;
-    size_t user_byte_idx = (char*)usr_ptr - (char*)__heap_base;
-    size_t byte_idx = 0;
-    do {
-        byte_idx += sector_cur->fields.allocation_size;
-        sector_cur -= 1;
-        if ( byte_idx == user_byte_idx ) { return sector_cur; }
-    } while ( sector_cur->fields.next_sector_exists );
+#define __heap_block_header_size sizeof(__heap_block_header_t)
 
-    return NULL;
+#endif
+
+#define __heap_minimum_allocation_size (sizeof(uint32_t)<<2)
+
+#define __heap_maximum_allocation_size ((1<<30)-1)
+
+// every allocation is aligned to this many bytes, blocks are sized in steps of it and every heap
+// shifts its base so the user data after the header of its first block is aligned
+#define __heap_alignment __alignof__(max_align_t)
+
+// largest alignment heap_alloc_aligned accepts
+#define __heap_max_alignment 4096
+
+// free sectors are kept in two level segregated free lists: the first level splits sizes by
+// powers of two and the second level splits each power of two into __heap_sl_count classes
+#define __heap_sl_log2 3
+#define __heap_sl_count (1<<__heap_sl_log2)
+#define __heap_fl_count 30
+
+// marks the end of a free list or of the unused sector list
+#define __heap_free_list_end UINT32_MAX
+
+// marks the end of the list of unused handles, whose entries need a bit for the list
+#define __heap_handles_end (UINT32_MAX >> 1)
+
+// stored at the start of every free block, overlapping the block header in the indexed layout
+typedef struct {
+    // index of the sector in the sector table
+    uint32_t sector_idx;
+    // offsets of the neighbouring free blocks in the same list
+    uint32_t prev_free;
+    uint32_t next_free;
+} __heap_free_block_t;
+
+// requests up to this size are served from slab pages, which hold objects of one size class
+// packed next to each other without any per-object metadata
+#define __heap_small_max_size 256
+#define __heap_small_n_classes 16
+
+#define __heap_slab_page_size 4096
+
+// bytes of every heap reserved for slab pages when it is set up, at most a quarter of the heap
+// is used and 0 turns the slab tier off
+#ifndef allocator_slab_arena_size
+    #define allocator_slab_arena_size (1<<20)
+#endif
+
+// stored at the start of every slab page
+typedef struct {
+    // size class of the objects in the page
+    uint16_t size_class;
+    // offset of the first object from the page start
+    uint16_t objects_offset;
+    uint16_t n_objects;
+    uint16_t n_free;
+    // offset of the first free object, free objects are linked through their first two bytes
+    // and the list ends with 0
+    uint16_t free_head;
+    // objects from this offset on have never been handed out
+    uint16_t bump;
+    // neighbouring pages in the list of the size class, or in the list of empty pages
+    uint32_t prev_page;
+    uint32_t next_page;
+    // objects that are handed out, one bit for every 16 bytes of the page at the one the object
+    // starts at, so frees of objects that are already free are caught
+    uint32_t allocated[__heap_slab_page_size/16/32];
+} __heap_slab_page_t;
+
+// heaps made by heap_create_reserved commit the pages of their region in steps of this many
+// bytes as the data segment and the sector table grow towards each other, must be a power of two
+// and a multiple of the page size
+#ifndef allocator_v2_commit_size
+    #define allocator_v2_commit_size (64<<10)
+#endif
+
+#if allocator_v2_commit_size & (allocator_v2_commit_size - 1)
+    #error "allocator_v2_commit_size must be a power of two"
+#endif
+
+// reserved heaps give committed pages back to the os once this many bytes at the end of the
+// data segment or the sector table are unused, and the pages inside free blocks of this size
+#ifndef allocator_v2_release_size
+    #define allocator_v2_release_size (256<<10)
+#endif
+
+// policies for picking the free block an allocation is placed in, set with heap_set_placement:
+//   good fit:   the first block of the smallest size class whose blocks are all large enough
+//   best fit:   the smallest block that is large enough
+//   first fit:  the large enough block at the lowest address
+//   next fit:   the large enough block at the lowest address after the previous allocation,
+//               starting over from the base once there is none
+//   segregated: first fit below allocator_v2_segregation_size, larger allocations take the
+//               large enough block at the highest address and are placed at its end, so small
+//               and large blocks collect at opposite ends of the heap
+// first fit, next fit and segregated keep the free lists in address order, which makes every
+// free walk the list of its size class, from its head or from the block last inserted into it
+#define heap_placement_good_fit 0
+#define heap_placement_best_fit 1
+#define heap_placement_first_fit 2
+#define heap_placement_next_fit 3
+#define heap_placement_segregated 4
+
+// define allocator_v2_placement to one of the policies to build every heap with it, which
+// leaves the search code of the other policies out and ignores heap_set_placement
+#ifdef allocator_v2_placement
+    #define __heap_placement(heap) (allocator_v2_placement)
+#else
+    #define __heap_placement(heap) ((heap)->placement)
+#endif
+
+#ifndef allocator_v2_segregation_size
+    #define allocator_v2_segregation_size 4096
+#endif
+
+// allocations of at least this many bytes get a mapping of their own instead of a block of the
+// heap, so they are allocated and freed in constant time, can be larger than
+// __heap_maximum_allocation_size and give their pages back to the os as soon as they are freed,
+// 0 keeps every allocation inside the heap
+#ifndef allocator_v2_large_size
+    #define allocator_v2_large_size (1u<<20)
+#endif
+
+// large allocations start this far into the first page of their mapping, right behind their
+// header, or at their alignment if it is larger, alignments of a page stay inside the heap
+#define __heap_large_page_size 4096
+#define __heap_large_header_size 64
+
+typedef struct __heap_large_t {
+    // hash of the header and its heap, which a pointer has to match to be taken for a large
+    // allocation of the heap
+    uintptr_t check;
+    // bytes that can be used at the user pointer
+    size_t size;
+    // bytes of the mapping and bytes from its start to the user pointer
+    size_t mapping_size;
+    size_t offset;
+    // neighbours in the list of large allocations of the heap
+    struct __heap_large_t* prev;
+    struct __heap_large_t* next;
+} __heap_large_t;
+
+// define allocator_hardened to check every pointer passed to heap_free and heap_realloc: blocks
+// get a guard in front of the user data and a redzone behind it, freed blocks are poisoned and
+// held back in a quarantine before they can be reused, and misuse is reported on stderr
+#ifdef allocator_hardened
+
+// number of freed blocks held back from reuse, per thread with allocator_thread_safe
+#ifndef allocator_hardened_quarantine
+    #define allocator_hardened_quarantine 64
+#endif
+
+// bytes at the start of a freed block that are poisoned and checked when it leaves the quarantine
+#ifndef allocator_hardened_poison_max
+    #define allocator_hardened_poison_max 256
+#endif
+
+// called after misuse was reported, the call that was misused does nothing if it returns
+#ifndef allocator_hardened_fail
+    #define allocator_hardened_fail() abort()
+#endif
+
+// stored in front of the user data of every block
+typedef struct {
+    // hash of the size, the offset and the user pointer
+    uint32_t check;
+    // bytes requested
+    uint32_t size;
+    // bytes from the start of the block's allocation to the user data
+    uint32_t offset;
+    // __heap_guard_live or __heap_guard_freed, last so the links the allocator writes into free
+    // blocks and cached blocks don't reach it
+    uint32_t state;
+} __heap_guard_t;
+
+#define __heap_guard_size sizeof(__heap_guard_t)
+#define __heap_guard_live 0x4c495645u
+#define __heap_guard_freed 0x46524545u
+
+// bytes behind the user data that must still hold __heap_redzone_byte when the block is freed
+#define __heap_redzone_size 16
+#define __heap_redzone_byte 0xab
+#define __heap_poison_byte 0xdf
+
+typedef struct {
+    // user pointers of freed blocks, the oldest one at next once the ring is full
+    void* ptrs[allocator_hardened_quarantine];
+    size_t next;
+} __heap_quarantine_t;
+
+#endif
+
+// define allocator_thread_safe to guard every heap with a lock and serve small requests from
+// per-thread caches that are refilled and flushed in batches
+#ifdef allocator_thread_safe
+
+#ifdef allocator_v2_compact_metadata
+    #error "allocator_thread_safe needs the block header of the indexed sector layout"
+#endif
+
+#include <pthread.h>
+#include "allocator_atomic.h"
+
+#ifndef allocator_max_threads
+    #define allocator_max_threads 64
+#endif
+
+// slab objects record their owner in a byte of their page
+#if allocator_max_threads > 255
+    #error "allocator_max_threads must fit in the owner bytes of slab pages"
+#endif
+
+// the thread caches hold blocks of the small size classes
+// number of blocks moved between a thread cache and the shared heap at once
+#define __heap_cache_batch 16
+
+// a size class holding more blocks than this flushes a batch back to the shared heap
+#define __heap_cache_limit 64
+
+// remote free list of a thread that has exited, blocks it still owns are freed straight to the
+// shared heap instead of waiting for a drain that never comes
+#define __heap_remote_orphaned ((void*)1)
+
+typedef struct {
+    // cached blocks of every size class, linked through their first word
+    void* bins[__heap_small_n_classes];
+    uint32_t counts[__heap_small_n_classes];
+    // blocks of this cache freed by other threads, pushed without taking the heap lock, holds
+    // __heap_remote_orphaned once the thread has exited
+    _Atomic(void*) remote_free;
+#ifdef allocator_hardened
+    __heap_quarantine_t quarantine;
+#endif
+} __heap_thread_cache_t;
+
+#endif
+
+typedef struct heap_t {
+
+    // pointer to the base of the heap, where allocations will start at
+    void* base;
+
+    // pointer to the top of the heap, where the sector data will start at
+    void* top;
+
+    // number of bytes between the heap base and the end of the data segment
+    size_t used_bytes;
+    size_t max_size;
+
+    // number of entries in the sector table
+    size_t sector_count;
+
+    // mapping made by heap_create_reserved, NULL if the caller passed the region in
+    void* mapping;
+    size_t mapping_size;
+
+    // bytes at the start and at the end of the region of a reserved heap that are committed
+    size_t committed_low;
+    size_t committed_high;
+
+#ifdef allocator_v2_compact_metadata
+    // position of the pass that removes empty sectors: the sectors from compact_cursor up to
+    // compact_hole_end are empty, and compact_offset is the offset of the block of the first used
+    // sector after compact_cursor
+    size_t compact_cursor;
+    size_t compact_hole_end;
+    size_t compact_offset;
+#else
+    // first unused entry in the sector table
+    uint32_t unused_sector;
+#endif
+
+    // bit n is set if any second level list of first level n is non-empty
+    uint32_t fl_bitmap;
+
+    // bit n is set if the list for that second level class is non-empty
+    uint32_t sl_bitmap[__heap_fl_count];
+
+    // offsets of the first and the last free block in every size class
+    uint32_t free_lists[__heap_fl_count][__heap_sl_count];
+    uint32_t free_list_tails[__heap_fl_count][__heap_sl_count];
+
+    // a block of every size class the walks of the address ordered lists can start from instead
+    // of the head, the last one inserted or the one the last next fit search stopped at, or
+    // __heap_free_list_end
+    uint32_t free_list_fingers[__heap_fl_count][__heap_sl_count];
+
+    // one of the heap_placement_* policies, and the offset next fit searches from
+    uint32_t placement;
+    size_t placement_rover;
+
+    // allocations of at least allocator_v2_large_size bytes, and the bytes of their mappings
+    __heap_large_t* large;
+    size_t large_bytes;
+    size_t n_large;
+
+    // arena of slab pages, reserved from the heap when it is set up
+    char* slab_base;
+    size_t slab_n_pages;
+
+    // pages from this index on have never been used
+    uint32_t slab_page_bump;
+
+    // pages that were given back by their size class, and the pages of every size class that
+    // have free objects
+    uint32_t slab_free_pages;
+    uint32_t slab_partial[__heap_small_n_classes];
+
+    // table of handle allocations, entry n holds the offset of the block of handle n+1, unused
+    // entries hold the next unused entry shifted left by one with the lowest bit set, the list of
+    // unused entries ends with __heap_handles_end
+    uint32_t* handles;
+    size_t handles_capacity;
+    uint32_t handles_unused;
+
+    // counters for heap_stats, kept up to date by every allocation and free of the shared heap
+    size_t live_bytes;
+    size_t free_list_bytes;
+    size_t slab_header_bytes;
+    size_t n_live_small[__heap_small_n_classes];
+    size_t n_live_sectors[__heap_fl_count];
+
+#if defined(allocator_hardened) && !defined(allocator_thread_safe)
+    __heap_quarantine_t quarantine;
+#endif
+
+#ifdef allocator_thread_safe
+    pthread_mutex_t lock;
+
+    // caches are owned by one thread at a time, cache n has owner id n+1
+    __heap_thread_cache_t thread_caches[allocator_max_threads];
+
+    // heaps are kept in a list so exiting threads can flush their caches in every heap
+    struct heap_t* prev_heap;
+    struct heap_t* next_heap;
+#endif
+
+} heap_t;
+
+typedef struct {
+    // bytes of the live allocations, rounded up to the size of their block or size class, the
+    // handle table counts as one
+    size_t live_bytes;
+    size_t live_blocks;
+    // bytes of the free blocks and of the unused space between the data segment and the sector
+    // table, the unused slab pages aren't counted
+    size_t free_bytes;
+    size_t largest_free_block;
+    // bytes of the sector table, the block headers and the slab page headers
+    size_t metadata_bytes;
+    // 1 - largest_free_block/free_bytes, 0 when all of the free space is in one piece
+    double external_fragmentation;
+    // live slab objects of every small size class
+    size_t small_class_blocks[__heap_small_n_classes];
+    // live blocks of the sector table, counted in the power of two their size (with the header)
+    // falls into
+    size_t sector_class_blocks[__heap_fl_count];
+    // live allocations with a mapping of their own and the bytes of their mappings, which are
+    // counted in live_blocks and live_bytes as well
+    size_t large_blocks;
+    size_t large_bytes;
+} heap_stats_t;
+
+// creates a heap in the region at base, the heap_t itself is stored at the start of the region
+heap_t* heap_create(void* base, size_t size);
+
+// sets up a heap whose heap_t is stored outside of the region at base
+void heap_init(heap_t* heap, void* base, size_t size);
+
+// creates a heap in size bytes of reserved address space, which only takes up memory for the
+// pages the heap has committed and gives long free runs back to the os, returns NULL if the
+// address space can't be reserved
+heap_t* heap_create_reserved(size_t size);
+
+// frees every allocation in the heap at once
+void heap_reset(heap_t* heap);
+
+// sets the heap_placement_* policy of the heap, heaps start out with good fit, should be called
+// before the heap is used since blocks freed under another policy aren't reordered
+void heap_set_placement(heap_t* heap, uint32_t placement);
+
+// must be called before the region of a heap is used for anything else, unmaps reserved heaps
+void heap_destroy(heap_t* heap);
+
+void* heap_alloc(heap_t* heap, size_t size);
+void* heap_realloc(heap_t* heap, void* ptr, size_t size);
+void heap_free(heap_t* heap, void* user_ptr);
+void heap_print(heap_t* heap);
+
+// writes the layout of the heap to a snapshot file at path, described in allocator_snapshot.h,
+// returns 0 if the file can't be written, blocks held in thread caches count as allocated
+int heap_snapshot_write(heap_t* heap, const char* path);
+
+// returns the number of bytes that can be used at user_ptr, at least the size it was allocated
+// with, or 0 if it isn't an allocation of the heap, the hardened heap still aborts if the
+// redzone of the allocation was overwritten
+size_t heap_usable_size(heap_t* heap, void* user_ptr);
+
+// allocates size bytes at a multiple of align, which has to be a power of two of at most
+// __heap_max_alignment, returns NULL otherwise or if the heap is full, heap_realloc only keeps the
+// alignment while the allocation doesn't move
+void* heap_alloc_aligned(heap_t* heap, size_t size, size_t align);
+
+// allocates count blocks of size bytes under one lock, carving runs of them out of single free
+// blocks, stores them in ptrs and returns how many it got, which is less than count only if the
+// heap is full
+size_t heap_alloc_batch(heap_t* heap, size_t size, size_t count, void** ptrs);
+
+// frees count pointers under one lock, blocks that are next to each other in memory are merged
+// before they are given back, ptrs is reordered
+void heap_free_batch(heap_t* heap, void** ptrs, size_t count);
+
+// handle allocations are reached through a handle instead of a pointer, so heap_compact can
+// move them to put the free space between them together, 0 is never a valid handle
+typedef uint32_t heap_handle_t;
+
+// allocates size bytes that heap_compact may move, returns 0 if the heap is full
+heap_handle_t heap_alloc_handle(heap_t* heap, size_t size);
+
+// returns the address of a handle allocation, which stays valid until the next heap_compact
+void* heap_handle_deref(heap_t* heap, heap_handle_t handle);
+void heap_free_handle(heap_t* heap, heap_handle_t handle);
+
+// moves every handle allocation that follows free space down into it and, with
+// allocator_v2_compact_metadata, removes every empty sector from the table, returns the number
+// of allocations moved
+size_t heap_compact(heap_t* heap);
+
+// fills stats with a snapshot of the heap without walking it, blocks held in the thread caches
+// of allocator_thread_safe count as live
+void heap_stats(heap_t* heap, heap_stats_t* stats);
+
+// the mem* functions work on the default heap set up by memalloc_init, by
+// memalloc_init_placement which also sets its placement policy, or by memalloc_init_reserved
+// which returns 0 if the address space can't be reserved
+void memalloc_init(void* heap_base, size_t heap_size);
+void memalloc_init_placement(void* heap_base, size_t heap_size, uint32_t placement);
+int memalloc_init_reserved(size_t size);
+// returns the default heap, or NULL before it is set up
+heap_t* memalloc_heap();
+void* memalloc(size_t size);
+void* memalloc_aligned(size_t size, size_t align);
+size_t memalloc_batch(size_t size, size_t count, void** ptrs);
+void memfree_batch(void** ptrs, size_t count);
+void* memrealloc(void* ptr, size_t size);
+void memfree(void* user_ptr);
+size_t memusable_size(void* user_ptr);
+void memprint();
+int memsnapshot(const char* path);
+
+heap_handle_t memalloc_handle(size_t size);
+void* handle_deref(heap_handle_t handle);
+void memfree_handle(heap_handle_t handle);
+size_t memcompact();
+
+// live bytes and live allocations of the default heap, see heap_stats
+size_t heap_used_bytes();
+size_t heap_n_allocs();
+size_t heap_size();
+
+// define allocator_v2_implementation in one source file before including this header
+#ifdef allocator_v2_implementation
+
+#include <sys/mman.h>
+
+// the heap used by the mem* functions
+heap_t __heap_default_storage;
+heap_t* __heap_default = NULL;
+
+#ifdef allocator_thread_safe
+
+// guards the heap list and the thread ids
+pthread_mutex_t __heap_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+heap_t* __heap_registry = NULL;
+
+// ids of exited threads that can be handed out again
+uint16_t __heap_free_thread_ids[allocator_max_threads];
+size_t __heap_n_free_thread_ids = 0;
+size_t __heap_n_thread_ids = 0;
+
+// owner id of the calling thread, 0 until its first small allocation and -1 if none are left
+_Thread_local int __heap_thread_id = 0;
+
+pthread_key_t __heap_thread_key;
+pthread_once_t __heap_thread_key_once = PTHREAD_ONCE_INIT;
+
+#define __heap_lock_acquire(heap) pthread_mutex_lock(&(heap)->lock)
+#define __heap_lock_release(heap) pthread_mutex_unlock(&(heap)->lock)
+
+#else
+
+#define __heap_lock_acquire(heap)
+#define __heap_lock_release(heap)
+
+#endif
+
+void __heap_slab_reserve(heap_t* heap);
+
+// rounds up to the commit size
+size_t __heap_commit_round(size_t size) {
+    return (size + allocator_v2_commit_size - 1) & ~(size_t)(allocator_v2_commit_size - 1);
 }
 
-size_t heap_used_bytes() {
-    __heap_sector_data_t*  sector_cur = (__heap_sector_data_t*)__heap_top;
-    size_t ret = 0;
+// returns the offset of the first commit boundary at or after offset, the base of the heap is
+// only as aligned as its first block needs while the end of the region is on a boundary
+size_t __heap_commit_boundary(heap_t* heap, size_t offset) {
+    return __heap_commit_round((uintptr_t)heap->base + offset) - (uintptr_t)heap->base;
+}
 
-    while ( 1 ) {
-        ret += sector_cur->fields.allocation_size + sizeof(__heap_sector_data_t);
-        if ( !sector_cur->fields.next_sector_exists ) { break; }
-        sector_cur -= 1;
+// commits the first low and the last high bytes of the region of a reserved heap, returns 0 if
+// the os refuses, the two committed parts never overlap
+int __heap_commit(heap_t* heap, size_t low, size_t high) {
+
+    if ( low > heap->committed_low ) {
+        size_t low_new = __heap_commit_boundary(heap, low);
+        if ( low_new > heap->max_size - heap->committed_high ) { low_new = heap->max_size - heap->committed_high; }
+        // the first commit starts at the boundary right before the base
+        char* start = (char*)((uintptr_t)((char*)heap->base + heap->committed_low) & ~(uintptr_t)(allocator_v2_commit_size - 1));
+        __allocdebugprintf("commit:\n\tcommitting %zu bytes at the start of the region\n", low_new - heap->committed_low);
+        if ( mprotect(start, (char*)heap->base + low_new - start, PROT_READ | PROT_WRITE) ) { return 0; }
+        heap->committed_low = low_new;
+    }
+
+    if ( high > heap->committed_high ) {
+        size_t high_new = __heap_commit_round(high);
+        if ( high_new > heap->max_size - heap->committed_low ) { high_new = heap->max_size - heap->committed_low; }
+        __allocdebugprintf("commit:\n\tcommitting %zu bytes at the end of the region\n", high_new - heap->committed_high);
+        if ( mprotect((char*)heap->base + heap->max_size - high_new, high_new - heap->committed_high, PROT_READ | PROT_WRITE) ) { return 0; }
+        heap->committed_high = high_new;
     }
 
-    return ret;
+    return 1;
 }
 
-size_t heap_n_allocs() {
-    size_t n_allocations = 0;
-    __heap_sector_data_t* sector_cur = (__heap_sector_data_t*)__heap_top;
-    
-    if ( !sector_cur->fields.next_sector_exists && sector_cur->fields.allocated ) {
-        n_allocations = 1;
+// gives the pages of a reserved heap past the first low and the last high bytes of the region back
+// to the os and takes them out of the committed parts
+void __heap_decommit(heap_t* heap, size_t low, size_t high) {
+
+    low = __heap_commit_boundary(heap, low);
+    if ( heap->committed_low > low ) {
+        __allocdebugprintf("commit:\n\treleasing %zu bytes at the start of the region\n", heap->committed_low - low);
+        madvise((char*)heap->base + low, heap->committed_low - low, MADV_DONTNEED);
+        mprotect((char*)heap->base + low, heap->committed_low - low, PROT_NONE);
+        heap->committed_low = low;
     }
 
-    while( sector_cur->fields.next_sector_exists ) {
-        n_allocations += 1;
-        sector_cur -= 1;
+    high = __heap_commit_round(high);
+    if ( heap->committed_high > high ) {
+        __allocdebugprintf("commit:\n\treleasing %zu bytes at the end of the region\n", heap->committed_high - high);
+        madvise((char*)heap->base + heap->max_size - heap->committed_high, heap->committed_high - high, MADV_DONTNEED);
+        mprotect((char*)heap->base + heap->max_size - heap->committed_high, heap->committed_high - high, PROT_NONE);
+        heap->committed_high = high;
     }
 
-    return n_allocations;
 }
 
-size_t heap_size() {
-    return ((char*)__heap_top) - ((char*)__heap_base);
+// true if the data segment can end at data_end while the sector table holds n_sectors entries,
+// the pages that takes are committed first in a reserved heap
+int __heap_fits(heap_t* heap, size_t data_end, size_t n_sectors) {
+    size_t table_bytes = n_sectors*sizeof(__heap_sector_data_t);
+    if ( data_end + table_bytes > heap->max_size ) { return 0; }
+    return heap->mapping == NULL || __heap_commit(heap, data_end, table_bytes);
 }
 
-void __remove_empty_chunks() {
+// gives the committed pages a reserved heap no longer uses back once there are enough of them,
+// so a heap that shrinks and grows around one size doesn't commit the same pages over and over
+void __heap_release_unused(heap_t* heap) {
 
-    // number of sectors to move by
-    int n_sector_shift = 0;
-    __heap_sector_data_t* sector_cur;
-    __heap_sector_data_t* sector_move_start;
+    if ( heap->mapping == NULL ) { return; }
 
-    while (sector_cur->fields.next_sector_exists) {
+    size_t table_bytes = heap->sector_count*sizeof(__heap_sector_data_t);
+    size_t low = heap->committed_low >= heap->used_bytes + allocator_v2_release_size ? heap->used_bytes : heap->committed_low;
+    size_t high = heap->committed_high >= table_bytes + allocator_v2_release_size ? table_bytes : heap->committed_high;
+    __heap_decommit(heap, low, high);
 
-        // increment the shift ammount while there are empty sectors
-        if ( !sector_cur->fields.allocation_size ) {
-            n_sector_shift++;
-        }
+}
 
-        // once we find a sector that is used, set the sector shift start to here
-        if ( n_sector_shift > 0 && sector_cur->fields.allocation_size > 0 ) {
-            sector_move_start = sector_cur;
-            while ( sector_cur->fields.next_sector_exists && sector_cur->fields.allocation_size > 0 ) {
-                sector_cur -= 1;
-            }
-            int sector_dist = sector_move_start - sector_cur;
-            for ( int i = sector_dist; i > 0; i-- ) {
-                sector_cur[i + n_sector_shift] = sector_cur[i];
-            }
-            
-        }
+// gives the pages inside a large free block of a reserved heap back to the os, its free list links
+// at the start and the sector index at the end stay
+void __heap_release_free_block(heap_t* heap, size_t offset, size_t size) {
+
+    if ( heap->mapping == NULL || size < allocator_v2_release_size ) { return; }
+
+    uintptr_t start = __heap_commit_round((uintptr_t)heap->base + offset + sizeof(__heap_free_block_t));
+    uintptr_t end = ((uintptr_t)heap->base + offset + size - sizeof(uint32_t)) & ~(uintptr_t)(allocator_v2_commit_size - 1);
+    if ( end > start ) { madvise((void*)start, end - start, MADV_DONTNEED); }
+
+}
 
+// unmaps every large allocation of the heap
+void __heap_large_unmap_all(heap_t* heap) {
+    while ( heap->large != NULL ) {
+        __heap_large_t* large = heap->large;
+        heap->large = large->next;
+        munmap((char*)large + __heap_large_header_size - large->offset, large->mapping_size);
     }
+    heap->large_bytes = 0;
+    heap->n_large = 0;
+}
+
+// empties the heap
+void __heap_reset_state(heap_t* heap) {
+
+    heap->used_bytes = 0;
+    heap->fl_bitmap = 0;
+    memset(heap->sl_bitmap, 0, sizeof(heap->sl_bitmap));
+    heap->free_list_bytes = 0;
+    heap->placement_rover = 0;
+    memset(heap->free_list_fingers, 0xff, sizeof(heap->free_list_fingers));
+    __heap_large_unmap_all(heap);
+
+#ifdef allocator_thread_safe
+    // cached blocks belonged to the old heap
+    memset((void*)heap->thread_caches, 0, sizeof(heap->thread_caches));
+#elif defined(allocator_hardened)
+    memset(&heap->quarantine, 0, sizeof(heap->quarantine));
+#endif
+
+    // a reserved heap starts over with none of its pages committed
+    if ( heap->mapping != NULL ) { __heap_decommit(heap, 0, 0); }
+
+#ifdef allocator_v2_compact_metadata
+    // initialize top pointer
+    __heap_fits(heap, 0, 1);
+    __heap_sector_data_t* heap_top_ptr = (__heap_sector_data_t*)heap->top;
+    heap_top_ptr->raw = 0;
+    heap->sector_count = 1;
+    heap->compact_cursor = 0;
+    heap->compact_hole_end = 0;
+    heap->compact_offset = 0;
+#else
+    heap->sector_count = 0;
+    heap->unused_sector = __heap_free_list_end;
+#endif
+
+    heap->handles = NULL;
+    heap->handles_capacity = 0;
+    heap->handles_unused = __heap_handles_end;
+
+    __heap_slab_reserve(heap);
+
+    // the block of the slab arena isn't an allocation
+    heap->live_bytes = 0;
+    heap->slab_header_bytes = 0;
+    memset(heap->n_live_small, 0, sizeof(heap->n_live_small));
+    memset(heap->n_live_sectors, 0, sizeof(heap->n_live_sectors));
 
 }
 
-void* memalloc(size_t size) {
+// sets up a heap in the region at base, mapping is the reservation of heap_create_reserved
+void __heap_init(heap_t* heap, void* base, size_t size, void* mapping, size_t mapping_size) {
 
-    __allocdebugprintf("memalloc init:\n");
+#ifndef allocator_v2_compact_metadata
+    // sector offsets are 32 bits wide
+    if ( size > UINT32_MAX ) { size = UINT32_MAX; }
+#endif
 
-    if ( size > __heap_maximum_allocation_size ) {
-        __allocdebugprintf("\tallocation size is greater than the maximum, exiting\n");
-        return NULL;
-    }
+    // blocks are sized in steps of the alignment, so the user data of every block is aligned once
+    // the first one is, and the sector table ends on an aligned address
+    char* end = (char*)((uintptr_t)((char*)base + size) & ~(uintptr_t)(__heap_alignment - 1));
+    base = (char*)(((uintptr_t)base + __heap_block_header_size + __heap_alignment - 1) & ~(uintptr_t)(__heap_alignment - 1)) - __heap_block_header_size;
+    size = end > (char*)base ? (size_t)(end - (char*)base) : 0;
+
+    // initialize heap variables
+    heap->base = base;
+    heap->max_size = size;
+    heap->top = (void*)((char*)heap->base + heap->max_size - sizeof(__heap_sector_data_t));
 
-    size_t size_alloc = size > __heap_minimum_allocation_size ? size : __heap_minimum_allocation_size;
+    heap->mapping = mapping;
+    heap->mapping_size = mapping_size;
+    heap->committed_low = 0;
+    heap->committed_high = 0;
 
-    // search for existing sector that could work
-    __heap_sector_data_t* sector_cur = (__heap_sector_data_t*)__heap_top;
-    
-    __heap_sector_data_t* smallest_viable_sector = NULL;
-    uint32_t smallest_viable_sector_size = INT32_MAX;
+#ifdef allocator_v2_placement
+    heap->placement = allocator_v2_placement;
+#else
+    heap->placement = heap_placement_good_fit;
+#endif
 
-    __allocdebugprintf("\tsearching for first available sector\n");
+    heap->large = NULL;
 
-    while( sector_cur->fields.next_sector_exists ) {
-        if ( !sector_cur->fields.allocated && sector_cur->fields.allocation_size < smallest_viable_sector_size && sector_cur->fields.allocation_size >= size_alloc ) {
-            smallest_viable_sector_size = sector_cur->fields.allocation_size;
-            smallest_viable_sector = sector_cur;
-        }
-        sector_cur -= 1;
-    }
+    __heap_reset_state(heap);
 
-    if ( smallest_viable_sector != NULL ) {
+#ifdef allocator_thread_safe
+    pthread_mutex_init(&heap->lock, NULL);
+    pthread_mutex_lock(&__heap_registry_lock);
+    heap->prev_heap = NULL;
+    heap->next_heap = __heap_registry;
+    if ( __heap_registry != NULL ) { __heap_registry->prev_heap = heap; }
+    __heap_registry = heap;
+    pthread_mutex_unlock(&__heap_registry_lock);
+#endif
 
-        __allocdebugprintf("\tfound pre-existing sector that works\n\tdone\n");
-        smallest_viable_sector->fields.allocated = 1;
-        return __user_ptr_from_sector(smallest_viable_sector);
+}
 
-    }
+void heap_init(heap_t* heap, void* base, size_t size) {
+    __heap_init(heap, base, size, NULL, 0);
+}
 
-    __allocdebugprintf("\tfinding the top of the heap\n");
+heap_t* heap_create(void* base, size_t size) {
 
-    // find the end of the data segment of the heap
-    void* heap_data_end = (void*)((char*)__heap_base + __heap_used_bytes + size);
-    if ( heap_data_end > (void*)((char*)sector_cur-sizeof(__heap_sector_data_t)) ) {     
-        __allocdebugprintf("\tERROR: not enough space in the heap!\n");
-        return NULL; 
-    }
+    // keep the data segment as aligned as the region
+    size_t heap_t_size = (sizeof(heap_t) + 15) & ~(size_t)15;
+    if ( size < heap_t_size + 2*__heap_alignment + __heap_minimum_allocation_size + sizeof(__heap_sector_data_t) ) { return NULL; }
 
-    if ( (void*)sector_cur == __heap_top && !sector_cur->fields.allocated && !sector_cur->fields.next_sector_exists ) {
-        __allocdebugprintf("\tallocating heap base\n");
-        sector_cur->fields.allocated = 1;
-        sector_cur->fields.allocation_size = size_alloc;
-        sector_cur->fields.next_sector_exists = 0;
-        __allocdebugprintf("\tdone\n");
-        return __user_ptr_from_sector(sector_cur);
+    heap_t* heap = (heap_t*)base;
+    heap_init(heap, (char*)base + heap_t_size, size - heap_t_size);
+    return heap;
+}
+
+heap_t* heap_create_reserved(size_t size) {
+
+    // the heap_t gets a commit step of its own so the region starts on a commit boundary
+    size_t heap_t_size = __heap_commit_round(sizeof(heap_t));
+    size = __heap_commit_round(size);
+#ifndef allocator_v2_compact_metadata
+    if ( size > UINT32_MAX ) { size = (size_t)UINT32_MAX & ~(size_t)(allocator_v2_commit_size - 1); }
+#endif
+    if ( size < allocator_v2_commit_size ) { return NULL; }
+
+    // the pages are only reserved, the heap commits them as it needs them
+    void* mapping = mmap(NULL, heap_t_size + size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if ( mapping == MAP_FAILED ) { return NULL; }
+    if ( mprotect(mapping, heap_t_size, PROT_READ | PROT_WRITE) ) {
+        munmap(mapping, heap_t_size + size);
+        return NULL;
     }
 
-    sector_cur->fields.next_sector_exists = 1;
+    heap_t* heap = (heap_t*)mapping;
+    __heap_init(heap, (char*)mapping + heap_t_size, size, mapping, heap_t_size + size);
+    return heap;
+}
 
-    __allocdebugprintf("\tinitializing next sector\n");
+void heap_reset(heap_t* heap) {
+    __heap_lock_acquire(heap);
+    __heap_reset_state(heap);
+    __heap_lock_release(heap);
+}
 
-    // iterate to the next sector
-    sector_cur -= 1;
+void heap_set_placement(heap_t* heap, uint32_t placement) {
+    __heap_lock_acquire(heap);
+    heap->placement = placement <= heap_placement_segregated ? placement : heap_placement_good_fit;
+    __heap_lock_release(heap);
+}
 
-    sector_cur->fields.allocation_size = size;
-    sector_cur->fields.allocated = 1;
-    sector_cur->fields.next_sector_exists = 0;
+void heap_destroy(heap_t* heap) {
+#ifdef allocator_thread_safe
+    pthread_mutex_lock(&__heap_registry_lock);
+    if ( heap->prev_heap != NULL ) { heap->prev_heap->next_heap = heap->next_heap; }
+    else { __heap_registry = heap->next_heap; }
+    if ( heap->next_heap != NULL ) { heap->next_heap->prev_heap = heap->prev_heap; }
+    pthread_mutex_unlock(&__heap_registry_lock);
+    pthread_mutex_destroy(&heap->lock);
+#endif
+    __heap_large_unmap_all(heap);
+    // the heap_t of a reserved heap is part of its mapping
+    if ( heap->mapping != NULL ) { munmap(heap->mapping, heap->mapping_size); }
+}
 
-    __allocdebugprintf("\tdone\n");
+// returns the sector at idx in the sector table
+__heap_sector_data_t* __heap_sector_at(heap_t* heap, size_t idx) {
+    return (__heap_sector_data_t*)heap->top - idx;
+}
 
-    return __user_ptr_from_sector(sector_cur);
+// returns the index of a sector in the sector table
+size_t __heap_sector_index(heap_t* heap, __heap_sector_data_t* sector) {
+    return (__heap_sector_data_t*)heap->top - sector;
+}
 
+__heap_free_block_t* __heap_free_block_at(heap_t* heap, size_t offset) {
+    return (__heap_free_block_t*)((char*)heap->base + offset);
 }
 
-void* memrealloc(void* ptr, size_t size) {
+#ifdef allocator_v2_compact_metadata
 
-    __allocdebugprintf("realloc init:\n");
+#ifdef __heap_simd_width
 
-    __heap_sector_data_t* sector_realloc = __heap_sector_from_user_pointer(ptr);
+// returns the sum of the sizes of the __heap_simd_width sectors from idx on, the bitfields are
+// laid out from the lowest bit, so the size is the raw value shifted down by two
+size_t __heap_sector_sizes_sum(heap_t* heap, size_t idx) {
 
-    
+    // the table grows down, so the group starts at the address of its last sector
+    const void* group = __heap_sector_at(heap, idx + __heap_simd_width - 1);
+
+#if __heap_simd_width == 8
+    __m256i sizes = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i*)group), 2);
+    __m128i sums = _mm_add_epi32(_mm256_castsi256_si128(sizes), _mm256_extracti128_si256(sizes, 1));
+    // sums of two sizes fit in 32 bits, sums of four don't
+    __m128i sums_wide = _mm_add_epi64(_mm_cvtepu32_epi64(sums), _mm_cvtepu32_epi64(_mm_srli_si128(sums, 8)));
+    return (size_t)_mm_cvtsi128_si64(sums_wide) + (size_t)_mm_extract_epi64(sums_wide, 1);
+#else
+    // sizes are below 2^30, so the sum of four still fits in 32 bits
+    __m128i sizes = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)group), 2);
+    sizes = _mm_add_epi32(sizes, _mm_srli_si128(sizes, 8));
+    sizes = _mm_add_epi32(sizes, _mm_srli_si128(sizes, 4));
+    return (uint32_t)_mm_cvtsi128_si32(sizes);
+#endif
 
 }
 
-void memfree(void* user_ptr) {
+// true if any of the __heap_simd_width sectors from idx on has a free block
+int __heap_sector_group_has_free(heap_t* heap, size_t idx) {
+
+    const void* group = __heap_sector_at(heap, idx + __heap_simd_width - 1);
+
+#if __heap_simd_width == 8
+    __m256i raw = _mm256_loadu_si256((const __m256i*)group);
+    __m256i empty = _mm256_cmpeq_epi32(_mm256_srli_epi32(raw, 2), _mm256_setzero_si256());
+    __m256i unallocated = _mm256_cmpeq_epi32(_mm256_and_si256(raw, _mm256_set1_epi32(1)), _mm256_setzero_si256());
+    return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(empty, unallocated))) != 0;
+#else
+    __m128i raw = _mm_loadu_si128((const __m128i*)group);
+    __m128i empty = _mm_cmpeq_epi32(_mm_srli_epi32(raw, 2), _mm_setzero_si128());
+    __m128i unallocated = _mm_cmpeq_epi32(_mm_and_si128(raw, _mm_set1_epi32(1)), _mm_setzero_si128());
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_andnot_si128(empty, unallocated))) != 0;
+#endif
+
+}
+
+#endif
+
+// points the free blocks of the sectors from idx on, whose blocks start at offset, at their
+// sectors after the table has moved
+void __heap_free_blocks_renumber(heap_t* heap, size_t idx, size_t offset) {
+
+    while ( idx < heap->sector_count ) {
+
+#ifdef __heap_simd_width
+        // most groups only hold allocated blocks and are skipped as a whole
+        if ( idx + __heap_simd_width <= heap->sector_count && !__heap_sector_group_has_free(heap, idx) ) {
+            offset += __heap_sector_sizes_sum(heap, idx);
+            idx += __heap_simd_width;
+            continue;
+        }
+#endif
+
+        __heap_sector_data_t* sector_cur = __heap_sector_at(heap, idx);
+        if ( sector_cur->fields.allocation_size && !sector_cur->fields.allocated ) {
+            __heap_free_block_at(heap, offset)->sector_idx = idx;
+        }
+        offset += sector_cur->fields.allocation_size;
+        idx++;
 
-    __allocdebugprintf("memfree init:\n");
-    
-    __heap_sector_data_t* dealloc_sector = __heap_sector_from_user_pointer(user_ptr);
-    if ( dealloc_sector == NULL ) { 
-        __allocdebugprintf("\tcould not find heap sector cooresponding to user pointer\n");
-        return; 
     }
 
-    dealloc_sector->fields.allocated = 0;
+}
 
-    // if there is no sector following this one, delete it
-    if ( !dealloc_sector->fields.next_sector_exists ) {
-        __allocdebugprintf("\tdeleting top sector\n");
-        dealloc_sector += 1; 
-        dealloc_sector->fields.next_sector_exists = 0;
-        __allocdebugprintf("\tdone\n");
-        return;
+void* __user_ptr_from_sector(heap_t* heap, __heap_sector_data_t* sector) {
+
+    size_t idx = 0;
+    char* data_ptr = (char*)heap->base;
+#ifdef __heap_simd_width
+    size_t idx_sector = __heap_sector_index(heap, sector);
+    while ( idx + __heap_simd_width <= idx_sector ) {
+        data_ptr += __heap_sector_sizes_sum(heap, idx);
+        idx += __heap_simd_width;
     }
+#endif
 
-    if ( (void*)dealloc_sector == __heap_top ) {
-        __allocdebugprintf("\theap top, done\n");
-        return; 
-    }    
+    __heap_sector_data_t* sector_cur = __heap_sector_at(heap, idx);
+    while ( sector != sector_cur ) {
+        data_ptr += sector_cur->fields.allocation_size;
+        if ( !sector_cur->fields.next_sector_exists ) { return NULL; }
+        sector_cur -= 1;
+    }
+    return (void*)data_ptr;
+}
 
-    __heap_sector_data_t* sector_prev = dealloc_sector + 1;
-    __heap_sector_data_t* sector_next = dealloc_sector - 1;
+__heap_sector_data_t* __heap_sector_from_user_pointer(heap_t* heap, void* usr_ptr) {
 
-    if ( sector_next->fields.allocated && sector_prev->fields.allocated ) {
-        __allocdebugprintf("\tdone\n");
-        return;
+    size_t user_byte_idx = (char*)usr_ptr - (char*)heap->base;
+    size_t byte_idx = 0;
+    size_t idx = 0;
+#ifdef __heap_simd_width
+    // a group of sectors whose blocks end at or before the pointer can't hold it
+    while ( idx + __heap_simd_width <= heap->sector_count ) {
+        size_t size_group = __heap_sector_sizes_sum(heap, idx);
+        if ( byte_idx + size_group > user_byte_idx ) { break; }
+        byte_idx += size_group;
+        idx += __heap_simd_width;
     }
+    if ( idx == heap->sector_count ) { return NULL; }
+#endif
 
-    // if 2 adjacent sectors are free (merges 3 sectors)
-    if ( !sector_next->fields.allocated && !sector_prev->fields.allocated ) {
+    __heap_sector_data_t* sector_cur = __heap_sector_at(heap, idx);
+    while ( 1 ) {
+        // empty sectors share their offset with the next sector, so skip them
+        if ( byte_idx == user_byte_idx && sector_cur->fields.allocation_size ) { return sector_cur; }
+        if ( byte_idx > user_byte_idx || !sector_cur->fields.next_sector_exists ) { break; }
+        byte_idx += sector_cur->fields.allocation_size;
+        sector_cur -= 1;
+    }
 
-        __allocdebugprintf("\tmerging three sectors\n");
-        
-        uint32_t total_free_bytes = dealloc_sector->fields.allocation_size + \
-                                    sector_prev->fields.allocation_size + \
-                                    sector_next->fields.allocation_size;
-        
-        if ( total_free_bytes > __heap_maximum_allocation_size ) {
-            uint32_t split_bytes = total_free_bytes - __heap_maximum_allocation_size;
+    return NULL;
+}
 
-            sector_next->fields.allocation_size = split_bytes/2;
-            dealloc_sector->fields.allocation_size = split_bytes/2 + split_bytes&1;
-            sector_prev->fields.allocation_size = __heap_maximum_allocation_size;
-            
-            __allocdebugprintf("\tdone\n");
-            return;
-        }
+// returns the sector of the first block in the heap, or NULL if there are none
+__heap_sector_data_t* __heap_sector_first(heap_t* heap) {
+    for ( size_t i = 0; i < heap->sector_count; i++ ) {
+        if ( __heap_sector_at(heap, i)->fields.allocation_size ) { return __heap_sector_at(heap, i); }
+    }
+    return NULL;
+}
 
-        sector_next->fields.allocation_size = 0;
-        sector_prev->fields.allocation_size = total_free_bytes;
-        dealloc_sector->fields.allocation_size = 0;
+// returns the sector of the block after the one at offset, or NULL if it is the last block
+__heap_sector_data_t* __heap_sector_next(heap_t* heap, __heap_sector_data_t* sector, size_t offset) {
+    (void)offset;
+    for ( size_t i = __heap_sector_index(heap, sector) + 1; i < heap->sector_count; i++ ) {
+        if ( __heap_sector_at(heap, i)->fields.allocation_size ) { return __heap_sector_at(heap, i); }
+    }
+    return NULL;
+}
 
-        __allocdebugprintf("\tdone\n");
-        
-        return;
+// returns the sector of the block before the one at offset if that block is free
+__heap_sector_data_t* __heap_sector_prev_free(heap_t* heap, __heap_sector_data_t* sector, size_t offset) {
+    (void)offset;
+    for ( size_t i = __heap_sector_index(heap, sector); i > 0; i-- ) {
+        __heap_sector_data_t* sector_prev = __heap_sector_at(heap, i - 1);
+        if ( sector_prev->fields.allocation_size ) { return sector_prev->fields.allocated ? NULL : sector_prev; }
     }
+    return NULL;
+}
 
-    // if the previous sector is free
-    if ( !sector_prev->fields.allocated ) {
+// creates a sector for a block of size bytes at offset, directly after the block of sector (or
+// at the end of the data segment if sector is NULL), returns NULL if the table can't grow
+__heap_sector_data_t* __heap_sector_new(heap_t* heap, __heap_sector_data_t* sector, size_t offset, size_t size) {
 
-        __allocdebugprintf("\tmerging current sector and previous\n");
+    size_t idx = sector != NULL ? __heap_sector_index(heap, sector) + 1 : heap->sector_count;
+    if ( idx == heap->sector_count && !__heap_sector_at(heap, idx - 1)->fields.allocation_size ) { idx--; }
+
+    __heap_sector_data_t* sector_new = __heap_sector_at(heap, idx);
 
-        uint32_t total_free_bytes = dealloc_sector->fields.allocation_size;
-        total_free_bytes += sector_prev->fields.allocation_size;
+    // reuse an empty sector left behind by a merge
+    if ( idx >= heap->sector_count || sector_new->fields.allocation_size ) {
 
-        if ( total_free_bytes > __heap_maximum_allocation_size ) {
-            
-            sector_prev->fields.allocation_size = __heap_maximum_allocation_size;
-            dealloc_sector->fields.allocation_size = total_free_bytes - __heap_maximum_allocation_size;
+        // the sectors after idx move down by one to keep the table in order
+        __heap_sector_data_t* sector_bottom = __heap_sector_at(heap, heap->sector_count);
+        size_t data_end = offset + size > heap->used_bytes ? offset + size : heap->used_bytes;
+        if ( !__heap_fits(heap, data_end, heap->sector_count + 1) ) { return NULL; }
 
-            __allocdebugprintf("\tdone\n");
-            return;
+        if ( idx == heap->sector_count ) {
+            __heap_sector_at(heap, heap->sector_count - 1)->fields.next_sector_exists = 1;
+            sector_new->raw = 0;
+        } else {
+            memmove(sector_bottom, sector_bottom + 1, (heap->sector_count - idx) * sizeof(__heap_sector_data_t));
+            sector_new->raw = 0;
+            sector_new->fields.next_sector_exists = 1;
         }
 
-        dealloc_sector->fields.allocation_size = 0;
-        sector_prev->fields.allocation_size = total_free_bytes;
+        heap->sector_count++;
 
+        // the empty sector pass moves along with the sectors it was looking at
+        if ( idx <= heap->compact_cursor ) {
+            heap->compact_hole_end++;
+            if ( idx == heap->compact_cursor++ ) { heap->compact_offset = offset + size; }
+        }
+
+        // the free blocks of sectors that moved have to point at their new index
+        __heap_free_blocks_renumber(heap, idx + 1, offset + size);
+
+    } else if ( !__heap_fits(heap, offset + size, idx + 1) ) {
+        return NULL;
+    } else if ( idx == heap->compact_cursor ) {
+        // the empty sector is used again, so the pass continues after it
+        heap->compact_cursor++;
+        heap->compact_offset = offset + size;
+        if ( heap->compact_hole_end < heap->compact_cursor ) { heap->compact_hole_end = heap->compact_cursor; }
+    } else if ( idx > heap->compact_cursor && idx < heap->compact_hole_end ) {
+        heap->compact_hole_end = idx;
     }
 
-    // if the next sector is free
-    if ( !sector_next->fields.allocated ) {
+    sector_new->fields.allocation_size = size;
+    sector_new->fields.allocated = 0;
 
-        __allocdebugprintf("\tmerging current sector and next\n");
+    return sector_new;
+}
+
+// drops the empty sectors at the end of the table, the first one always stays
+void __heap_sector_trim(heap_t* heap) {
+
+    while ( heap->sector_count > 1 && !__heap_sector_at(heap, heap->sector_count - 1)->fields.allocation_size ) {
+        heap->sector_count--;
+    }
+    __heap_sector_at(heap, heap->sector_count - 1)->fields.next_sector_exists = 0;
 
-        uint32_t total_free_bytes = dealloc_sector->fields.allocation_size;
-        total_free_bytes += sector_next->fields.allocation_size;
+    if ( heap->compact_hole_end > heap->sector_count ) { heap->compact_hole_end = heap->sector_count; }
+    if ( heap->compact_cursor > heap->sector_count ) { heap->compact_cursor = heap->sector_count; }
 
-        if ( total_free_bytes > __heap_maximum_allocation_size ) {
-            
-            sector_next->fields.allocation_size = __heap_maximum_allocation_size;
-            dealloc_sector->fields.allocation_size = total_free_bytes - __heap_maximum_allocation_size;
+}
 
-            __allocdebugprintf("\tdone\n");
-            return;
-        } 
+// removes a sector whose block was merged into a neighbour or given back to the unused space
+void __heap_sector_delete(heap_t* heap, __heap_sector_data_t* sector) {
 
-        dealloc_sector->fields.allocation_size = 0;
-        sector_next->fields.allocation_size = total_free_bytes;
+    sector->fields.allocation_size = 0;
+    sector->fields.allocated = 0;
 
-    }
+    __heap_sector_trim(heap);
 
 }
 
-void memprint() {
+void __heap_mark_allocated(heap_t* heap, __heap_sector_data_t* sector, size_t offset) {
+    (void)heap;
+    (void)offset;
+    sector->fields.allocated = 1;
+}
 
-    __heap_sector_data_t* sector_cur = (__heap_sector_data_t*)__heap_top;
-    int sector_idx = 0;
-    int next_sector_exists = 0;
-    do {
-        next_sector_exists = sector_cur->fields.next_sector_exists;
-        __allocdebugprintf("sector %i:\n", sector_idx);
-        __allocdebugprintf("\tsize: %i\n", sector_cur->fields.allocation_size);
-        __allocdebugprintf("\tallocated: %i\n", sector_cur->fields.allocated);
-        sector_cur -= 1;
-        sector_idx++;
-    } while (next_sector_exists);
+void __heap_mark_free(heap_t* heap, __heap_sector_data_t* sector, size_t offset) {
+    sector->fields.allocated = 0;
+    __heap_free_block_at(heap, offset)->sector_idx = __heap_sector_index(heap, sector);
+}
+
+// moves the block of sector at offset down to the start of the free block of sector_free right
+// before it, returns the sector of the space left behind the moved block, which is still marked
+// as allocated
+__heap_sector_data_t* __heap_sector_swap(heap_t* heap, __heap_sector_data_t* sector_free, size_t offset_free, __heap_sector_data_t* sector, size_t offset) {
+
+    size_t size_free = sector_free->fields.allocation_size;
+    size_t size = sector->fields.allocation_size;
+    memmove((char*)heap->base + offset_free, (char*)heap->base + offset, size);
+
+    // the table is in block order, so the sectors swap sizes instead
+    sector_free->fields.allocation_size = size;
+    sector_free->fields.allocated = 1;
+    sector->fields.allocation_size = size_free;
+
+    return sector;
+}
+
+// splits the allocated block of sector at offset into n allocated blocks of size bytes, the last
+// one keeping whatever is left, the sectors of the new blocks are put into the table with one
+// move of the sectors after them, returns the number of blocks, which is 1 if the table is full
+size_t __heap_sector_split_run(heap_t* heap, __heap_sector_data_t* sector, size_t offset, size_t size, size_t n) {
+
+    size_t n_new = n - 1;
+    size_t idx = __heap_sector_index(heap, sector) + 1;
+    if ( !n_new || !__heap_fits(heap, heap->used_bytes, heap->sector_count + n_new) ) { return 1; }
+
+    size_t size_total = sector->fields.allocation_size;
+    __heap_sector_data_t* sector_bottom = __heap_sector_at(heap, heap->sector_count + n_new - 1);
+    memmove(sector_bottom, sector_bottom + n_new, (heap->sector_count - idx) * sizeof(__heap_sector_data_t));
+
+    uint32_t next_sector_exists = sector->fields.next_sector_exists;
+    sector->fields.next_sector_exists = 1;
+    sector->fields.allocation_size = size;
+    for ( size_t i = 0; i < n_new; i++ ) {
+        __heap_sector_data_t* sector_new = __heap_sector_at(heap, idx + i);
+        sector_new->raw = 0;
+        sector_new->fields.allocated = 1;
+        sector_new->fields.next_sector_exists = i + 1 < n_new || next_sector_exists;
+        sector_new->fields.allocation_size = i + 1 < n_new ? size : size_total - n_new*size;
+    }
+
+    heap->sector_count += n_new;
+
+    // the empty sector pass moves along with the sectors it was looking at
+    if ( idx <= heap->compact_cursor ) {
+        heap->compact_hole_end += n_new;
+        if ( idx == heap->compact_cursor ) { heap->compact_offset = offset + size_total; }
+        heap->compact_cursor += n_new;
+    }
 
+    // the free blocks of sectors that moved have to point at their new index
+    __heap_free_blocks_renumber(heap, idx + n_new, offset + size_total);
+
+    return n;
 }
 
-#endif
\ No newline at end of file
+#else
+
+void* __user_ptr_from_sector(heap_t* heap, __heap_sector_data_t* sector) {
+    return (void*)((char*)heap->base + sector->fields.offset + __heap_block_header_size);
+}
+
+__heap_sector_data_t* __heap_sector_from_user_pointer(heap_t* heap, void* usr_ptr) {
+
+    // reject pointers that can't have come from the data segment before touching the header
+    if ( (char*)usr_ptr < (char*)heap->base + __heap_block_header_size ) { return NULL; }
+    if ( (char*)usr_ptr >= (char*)heap->base + heap->used_bytes ) { return NULL; }
+
+    __heap_block_header_t* header = (__heap_block_header_t*)((char*)usr_ptr - __heap_block_header_size);
+    if ( header->sector_idx >= heap->sector_count ) { return NULL; }
+
+    __heap_sector_data_t* sector = __heap_sector_at(heap, header->sector_idx);
+    if ( !sector->fields.allocation_size ) { return NULL; }
+    if ( (char*)__user_ptr_from_sector(heap, sector) != (char*)usr_ptr ) { return NULL; }
+
+    return sector;
+}
+
+// both allocated and free blocks start with the index of their sector
+__heap_sector_data_t* __heap_sector_of_block(heap_t* heap, size_t offset) {
+    return __heap_sector_at(heap, ((__heap_block_header_t*)((char*)heap->base + offset))->sector_idx);
+}
+
+// returns the sector of the first block in the heap, or NULL if there are none
+__heap_sector_data_t* __heap_sector_first(heap_t* heap) {
+    return heap->used_bytes ? __heap_sector_of_block(heap, 0) : NULL;
+}
+
+// returns the sector of the block after the one at offset, or NULL if it is the last block
+__heap_sector_data_t* __heap_sector_next(heap_t* heap, __heap_sector_data_t* sector, size_t offset) {
+    offset += sector->fields.allocation_size;
+    return offset < heap->used_bytes ? __heap_sector_of_block(heap, offset) : NULL;
+}
+
+// returns the sector of the block before the one at offset if that block is free
+__heap_sector_data_t* __heap_sector_prev_free(heap_t* heap, __heap_sector_data_t* sector, size_t offset) {
+    if ( !sector->fields.prev_free ) { return NULL; }
+    // free blocks end with the index of their sector
+    return __heap_sector_at(heap, *(uint32_t*)((char*)heap->base + offset - sizeof(uint32_t)));
+}
+
+// creates a sector for a block of size bytes at offset, returns NULL if the table can't grow,
+// the neighbouring sector only places the new one in the compact layout
+__heap_sector_data_t* __heap_sector_new(heap_t* heap, __heap_sector_data_t* sector, size_t offset, size_t size) {
+
+    (void)sector;
+
+    __heap_sector_data_t* sector_new;
+    size_t data_end = offset + size > heap->used_bytes ? offset + size : heap->used_bytes;
+
+    if ( heap->unused_sector != __heap_free_list_end ) {
+        sector_new = __heap_sector_at(heap, heap->unused_sector);
+        if ( !__heap_fits(heap, data_end, heap->sector_count) ) { return NULL; }
+        heap->unused_sector = sector_new->fields.offset;
+    } else {
+        sector_new = __heap_sector_at(heap, heap->sector_count);
+        if ( !__heap_fits(heap, data_end, heap->sector_count + 1) ) { return NULL; }
+        heap->sector_count++;
+    }
+
+    sector_new->raw = 0;
+    sector_new->fields.allocation_size = size;
+    sector_new->fields.offset = offset;
+
+    return sector_new;
+}
+
+// removes a sector whose block was merged into a neighbour or given back to the unused space
+void __heap_sector_delete(heap_t* heap, __heap_sector_data_t* sector) {
+    sector->raw = 0;
+    sector->fields.offset = heap->unused_sector;
+    heap->unused_sector = __heap_sector_index(heap, sector);
+}
+
+void __heap_mark_allocated(heap_t* heap, __heap_sector_data_t* sector, size_t offset) {
+
+    sector->fields.allocated = 1;
+    ((__heap_block_header_t*)((char*)heap->base + offset))->sector_idx = __heap_sector_index(heap, sector);
+
+    __heap_sector_data_t* sector_next = __heap_sector_next(heap, sector, offset);
+    if ( sector_next != NULL ) { sector_next->fields.prev_free = 0; }
+
+}
+
+void __heap_mark_free(heap_t* heap, __heap_sector_data_t* sector, size_t offset) {
+
+    sector->fields.allocated = 0;
+    __heap_free_block_at(heap, offset)->sector_idx = __heap_sector_index(heap, sector);
+    *(uint32_t*)((char*)heap->base + offset + sector->fields.allocation_size - sizeof(uint32_t)) = __heap_sector_index(heap, sector);
+
+    __heap_sector_data_t* sector_next = __heap_sector_next(heap, sector, offset);
+    if ( sector_next != NULL ) { sector_next->fields.prev_free = 1; }
+
+}
+
+// moves the block of sector at offset down to the start of the free block of sector_free right
+// before it, returns the sector of the space left behind the moved block, which is still marked
+// as allocated
+__heap_sector_data_t* __heap_sector_swap(heap_t* heap, __heap_sector_data_t* sector_free, size_t offset_free, __heap_sector_data_t* sector, size_t offset) {
+
+    size_t size = sector->fields.allocation_size;
+    memmove((char*)heap->base + offset_free, (char*)heap->base + offset, size);
+
+    // the block header moves along with the block
+    sector->fields.offset = offset_free;
+    sector->fields.prev_free = sector_free->fields.prev_free;
+
+    sector_free->fields.offset = offset_free + size;
+    sector_free->fields.allocated = 1;
+    sector_free->fields.prev_free = 0;
+    ((__heap_block_header_t*)((char*)heap->base + offset_free + size))->sector_idx = __heap_sector_index(heap, sector_free);
+
+    return sector_free;
+}
+
+// splits the allocated block of sector at offset into up to n allocated blocks of size bytes, the
+// last one keeping whatever is left, returns the number of blocks, which is less than n only if
+// the table is full
+size_t __heap_sector_split_run(heap_t* heap, __heap_sector_data_t* sector, size_t offset, size_t size, size_t n) {
+
+    size_t size_total = sector->fields.allocation_size;
+    __heap_sector_data_t* sector_last = sector;
+
+    // every block of the run and the one after it are allocated, so the prev_free bits stay clear
+    size_t k = 1;
+    for ( ; k < n; k++ ) {
+        __heap_sector_data_t* sector_new = __heap_sector_new(heap, sector, offset + k*size, size);
+        if ( sector_new == NULL ) { break; }
+        sector_new->fields.allocated = 1;
+        ((__heap_block_header_t*)((char*)heap->base + offset + k*size))->sector_idx = __heap_sector_index(heap, sector_new);
+        sector_last = sector_new;
+    }
+
+    sector->fields.allocation_size = size;
+    sector_last->fields.allocation_size = size_total - (k - 1)*size;
+
+    return k;
+}
+
+#endif
+
+// true if the policy of the heap keeps the free lists in address order
+#define __heap_placement_ordered(heap) (__heap_placement(heap) == heap_placement_first_fit || __heap_placement(heap) == heap_placement_next_fit || __heap_placement(heap) == heap_placement_segregated)
+
+// finds the size class of a free block
+void __heap_free_list_mapping(size_t size, uint32_t* fl, uint32_t* sl) {
+    uint32_t fl_idx = 31 - __builtin_clz((uint32_t)size);
+    *fl = fl_idx;
+    *sl = (size >> (fl_idx - __heap_sl_log2)) & (__heap_sl_count - 1);
+}
+
+void __heap_free_list_insert(heap_t* heap, __heap_sector_data_t* sector, size_t offset) {
+
+    uint32_t fl, sl;
+    __heap_free_list_mapping(sector->fields.allocation_size, &fl, &sl);
+
+    heap->free_list_bytes += sector->fields.allocation_size;
+
+    __heap_free_block_t* block = __heap_free_block_at(heap, offset);
+    block->prev_free = __heap_free_list_end;
+    block->next_free = heap->sl_bitmap[fl] & (1u << sl) ? heap->free_lists[fl][sl] : __heap_free_list_end;
+
+    // the address ordered policies insert the block in front of the first one after it, the walk
+    // starts at the finger when it is closer to the block than the head
+    if ( __heap_placement_ordered(heap) ) {
+        uint32_t offset_finger = heap->free_list_fingers[fl][sl];
+        if ( offset_finger != __heap_free_list_end && block->next_free < offset && (offset_finger < offset || offset_finger - offset < offset - block->next_free) ) {
+            // the head is in front of the block, so stepping back stops at a block before it
+            while ( offset_finger > offset ) { offset_finger = __heap_free_block_at(heap, offset_finger)->prev_free; }
+            block->prev_free = offset_finger;
+            block->next_free = __heap_free_block_at(heap, offset_finger)->next_free;
+        }
+        while ( block->next_free != __heap_free_list_end && block->next_free < offset ) {
+            block->prev_free = block->next_free;
+            block->next_free = __heap_free_block_at(heap, block->next_free)->next_free;
+        }
+        heap->free_list_fingers[fl][sl] = (uint32_t)offset;
+    }
+
+    if ( block->next_free != __heap_free_list_end ) { __heap_free_block_at(heap, block->next_free)->prev_free = offset; }
+    else { heap->free_list_tails[fl][sl] = (uint32_t)offset; }
+
+    heap->sl_bitmap[fl] |= 1u << sl;
+    heap->fl_bitmap |= 1u << fl;
+
+    if ( block->prev_free != __heap_free_list_end ) {
+        __heap_free_block_at(heap, block->prev_free)->next_free = offset;
+        return;
+    }
+
+    heap->free_lists[fl][sl] = offset;
+
+}
+
+void __heap_free_list_remove(heap_t* heap, __heap_sector_data_t* sector, size_t offset) {
+
+    uint32_t fl, sl;
+    __heap_free_list_mapping(sector->fields.allocation_size, &fl, &sl);
+
+    heap->free_list_bytes -= sector->fields.allocation_size;
+
+    __heap_free_block_t* block = __heap_free_block_at(heap, offset);
+
+    // a finger on the block moves to the one before it, or back to the head of the list
+    if ( heap->free_list_fingers[fl][sl] == offset ) { heap->free_list_fingers[fl][sl] = block->prev_free; }
+
+    if ( block->next_free != __heap_free_list_end ) { __heap_free_block_at(heap, block->next_free)->prev_free = block->prev_free; }
+    else { heap->free_list_tails[fl][sl] = block->prev_free; }
+
+    if ( block->prev_free != __heap_free_list_end ) {
+        __heap_free_block_at(heap, block->prev_free)->next_free = block->next_free;
+        return;
+    }
+
+    heap->free_lists[fl][sl] = block->next_free;
+
+    if ( block->next_free == __heap_free_list_end ) {
+        heap->sl_bitmap[fl] &= ~(1u << sl);
+        if ( !heap->sl_bitmap[fl] ) { heap->fl_bitmap &= ~(1u << fl); }
+    }
+
+}
+
+// finds the first non-empty size class after fl, sl and stores it, returns 0 if there isn't one
+int __heap_free_list_next_class(heap_t* heap, uint32_t* fl, uint32_t* sl) {
+
+    uint32_t sl_map = *sl + 1 < __heap_sl_count ? heap->sl_bitmap[*fl] & (~0u << (*sl + 1)) : 0;
+    if ( !sl_map ) {
+        uint32_t fl_map = *fl + 1 < 32 ? heap->fl_bitmap & (~0u << (*fl + 1)) : 0;
+        if ( !fl_map ) { return 0; }
+        *fl = __builtin_ctz(fl_map);
+        sl_map = heap->sl_bitmap[*fl];
+    }
+
+    *sl = __builtin_ctz(sl_map);
+    return 1;
+}
+
+// returns the size of the free block at offset
+size_t __heap_free_block_size(heap_t* heap, size_t offset) {
+    return __heap_sector_at(heap, __heap_free_block_at(heap, offset)->sector_idx)->fields.allocation_size;
+}
+
+// good fit: rounds up to the next size class so any block in the class found is large enough
+int __heap_free_list_find_good_fit(heap_t* heap, size_t size, size_t* offset) {
+
+    uint32_t fl, sl;
+
+    size += (1u << ((31 - __builtin_clz((uint32_t)size)) - __heap_sl_log2)) - 1;
+    __heap_free_list_mapping(size, &fl, &sl);
+    if ( fl >= __heap_fl_count ) { return 0; }
+
+    uint32_t sl_map = heap->sl_bitmap[fl] & (~0u << sl);
+    if ( !sl_map ) {
+        uint32_t fl_map = heap->fl_bitmap & (~0u << (fl + 1));
+        if ( !fl_map ) { return 0; }
+        fl = __builtin_ctz(fl_map);
+        sl_map = heap->sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+
+    *offset = heap->free_lists[fl][sl];
+    return 1;
+}
+
+// best fit: the class of size holds blocks that are smaller and larger than size, every class
+// after it only larger ones, so the smallest block that fits is in the class of size or in the
+// first non-empty class after it
+int __heap_free_list_find_best_fit(heap_t* heap, size_t size, size_t* offset) {
+
+    uint32_t fl, sl;
+    __heap_free_list_mapping(size, &fl, &sl);
+    if ( fl >= __heap_fl_count ) { return 0; }
+
+    int in_class = (heap->sl_bitmap[fl] >> sl) & 1;
+    if ( !in_class && !__heap_free_list_next_class(heap, &fl, &sl) ) { return 0; }
+
+    while ( 1 ) {
+
+        size_t size_best = SIZE_MAX;
+        for ( uint32_t offset_block = heap->free_lists[fl][sl]; offset_block != __heap_free_list_end; offset_block = __heap_free_block_at(heap, offset_block)->next_free ) {
+            size_t size_block = __heap_free_block_size(heap, offset_block);
+            if ( size_block < size || size_block >= size_best ) { continue; }
+            size_best = size_block;
+            *offset = offset_block;
+            if ( size_block == size ) { break; }
+        }
+
+        if ( size_best != SIZE_MAX ) { return 1; }
+        if ( !in_class || !__heap_free_list_next_class(heap, &fl, &sl) ) { return 0; }
+        in_class = 0;
+
+    }
+}
+
+// first fit, next fit and segregated: the lists are in address order, so the first block of a
+// list that fits is its lowest one that does, stores the large enough block with the lowest
+// offset at or after from, or with the lowest offset of all if there is none after from, or with
+// the highest offset if highest is set
+//
+// segregated walks the lists backwards from their last block, next fit skips the lists whose
+// last block is before from and can start the walk of the others
+// at their finger instead of their head, stepping back while the block before is still at or
+// after from, so a rover that moves forward doesn't walk the blocks behind it again on every
+// search
+int __heap_free_list_find_ordered(heap_t* heap, size_t size, size_t from, int highest, size_t* offset) {
+
+    uint32_t fl, sl;
+    __heap_free_list_mapping(size, &fl, &sl);
+    if ( fl >= __heap_fl_count ) { return 0; }
+
+    size_t offset_from = SIZE_MAX;
+    size_t offset_last = 0;
+    int found = 0;
+
+    // only the blocks in the class of size can be too small
+    int in_class = (heap->sl_bitmap[fl] >> sl) & 1;
+    if ( !in_class && !__heap_free_list_next_class(heap, &fl, &sl) ) { return 0; }
+
+    do {
+        // the last block of a list is its highest, so a list can be skipped or walked backwards
+        if ( highest ) {
+            for ( uint32_t offset_block = heap->free_list_tails[fl][sl]; offset_block != __heap_free_list_end; offset_block = __heap_free_block_at(heap, offset_block)->prev_free ) {
+                if ( in_class && __heap_free_block_size(heap, offset_block) < size ) { continue; }
+                if ( offset_block > offset_last ) { offset_last = offset_block; }
+                found = 1;
+                break;
+            }
+            in_class = 0;
+            continue;
+        }
+        if ( from && heap->free_list_tails[fl][sl] < from ) {
+            in_class = 0;
+            continue;
+        }
+        // the walk starts at the head or at the finger, whichever is closer to from
+        uint32_t offset_block = heap->free_lists[fl][sl];
+        uint32_t offset_finger = heap->free_list_fingers[fl][sl];
+        if ( from && offset_finger != __heap_free_list_end && offset_block < from && (offset_finger < from || offset_finger - from < from - offset_block) ) {
+            offset_block = offset_finger;
+            for ( uint32_t prev = __heap_free_block_at(heap, offset_block)->prev_free; prev != __heap_free_list_end && prev >= from; prev = __heap_free_block_at(heap, prev)->prev_free ) {
+                offset_block = prev;
+            }
+        }
+        uint32_t offset_stop = offset_block;
+        for ( ; offset_block != __heap_free_list_end; offset_block = __heap_free_block_at(heap, offset_block)->next_free ) {
+            offset_stop = offset_block;
+            if ( in_class && __heap_free_block_size(heap, offset_block) < size ) { continue; }
+            if ( offset_block >= from ) {
+                if ( offset_block < offset_from ) { offset_from = offset_block; }
+                break;
+            }
+        }
+        if ( from ) { heap->free_list_fingers[fl][sl] = offset_stop; }
+        in_class = 0;
+    } while ( __heap_free_list_next_class(heap, &fl, &sl) );
+
+    if ( highest ) {
+        if ( !found ) { return 0; }
+        *offset = offset_last;
+        return 1;
+    }
+
+    // there is none after from, next fit starts over from the base
+    if ( offset_from == SIZE_MAX ) { return from && __heap_free_list_find_ordered(heap, size, 0, 0, offset); }
+    *offset = offset_from;
+    return 1;
+}
+
+// returns a free sector of at least size bytes and stores its offset, or NULL if there isn't one,
+// the switch is left with a single case when allocator_v2_placement fixes the policy
+__heap_sector_data_t* __heap_free_list_find(heap_t* heap, size_t size, size_t* offset) {
+
+    int found;
+    switch ( __heap_placement(heap) ) {
+        case heap_placement_best_fit:
+            found = __heap_free_list_find_best_fit(heap, size, offset);
+            break;
+        case heap_placement_first_fit:
+            found = __heap_free_list_find_ordered(heap, size, 0, 0, offset);
+            break;
+        case heap_placement_next_fit:
+            found = __heap_free_list_find_ordered(heap, size, heap->placement_rover, 0, offset);
+            break;
+        case heap_placement_segregated:
+            found = __heap_free_list_find_ordered(heap, size, 0, size >= allocator_v2_segregation_size, offset);
+            break;
+        default:
+            found = __heap_free_list_find_good_fit(heap, size, offset);
+            break;
+    }
+
+    if ( !found ) { return NULL; }
+    return __heap_sector_at(heap, __heap_free_block_at(heap, *offset)->sector_idx);
+}
+
+void heap_stats(heap_t* heap, heap_stats_t* stats) {
+
+    __heap_lock_acquire(heap);
+
+    stats->live_bytes = heap->live_bytes;
+    stats->live_blocks = 0;
+    size_t n_sector_blocks = 0;
+    for ( size_t i = 0; i < __heap_small_n_classes; i++ ) {
+        stats->small_class_blocks[i] = heap->n_live_small[i];
+        stats->live_blocks += heap->n_live_small[i];
+    }
+    for ( size_t i = 0; i < __heap_fl_count; i++ ) {
+        stats->sector_class_blocks[i] = heap->n_live_sectors[i];
+        n_sector_blocks += heap->n_live_sectors[i];
+    }
+    stats->live_blocks += n_sector_blocks;
+
+    // the slab arena is a block of its own
+    size_t sector_table_bytes = heap->sector_count*sizeof(__heap_sector_data_t);
+    size_t n_headers = n_sector_blocks + (heap->slab_base != NULL);
+    stats->metadata_bytes = sector_table_bytes + n_headers*__heap_block_header_size + heap->slab_header_bytes;
+
+    size_t unused = heap->max_size - sector_table_bytes - heap->used_bytes;
+    stats->free_bytes = heap->free_list_bytes + unused;
+
+    // the largest free block is in the highest non-empty size class, which is the only list
+    // that has to be looked through
+    stats->largest_free_block = unused;
+    if ( heap->fl_bitmap ) {
+        uint32_t fl = 31 - __builtin_clz(heap->fl_bitmap);
+        uint32_t sl = 31 - __builtin_clz(heap->sl_bitmap[fl]);
+        for ( uint32_t offset = heap->free_lists[fl][sl]; offset != __heap_free_list_end; offset = __heap_free_block_at(heap, offset)->next_free ) {
+            size_t size = __heap_sector_at(heap, __heap_free_block_at(heap, offset)->sector_idx)->fields.allocation_size;
+            if ( size > stats->largest_free_block ) { stats->largest_free_block = size; }
+        }
+    }
+
+    stats->external_fragmentation = stats->free_bytes ? 1.0 - (double)stats->largest_free_block/stats->free_bytes : 0.0;
+
+    stats->large_blocks = heap->n_large;
+    stats->large_bytes = heap->large_bytes;
+    stats->live_blocks += heap->n_large;
+
+    __heap_lock_release(heap);
+
+}
+
+size_t heap_used_bytes() {
+    heap_stats_t stats;
+    heap_stats(__heap_default, &stats);
+    return stats.live_bytes;
+}
+
+size_t heap_n_allocs() {
+    heap_stats_t stats;
+    heap_stats(__heap_default, &stats);
+    return stats.live_blocks;
+}
+
+size_t heap_size() {
+    heap_t* heap = __heap_default;
+    return ((char*)heap->top) - ((char*)heap->base);
+}
+
+#ifdef allocator_v2_compact_metadata
+
+// true if the free block of sector starts at offset, which is checked through the free list links
+// since only real free blocks are pointed at by them
+int __heap_free_block_is_at(heap_t* heap, __heap_sector_data_t* sector, size_t offset) {
+
+    if ( offset + sizeof(__heap_free_block_t) > heap->used_bytes ) { return 0; }
+
+    __heap_free_block_t* block = __heap_free_block_at(heap, offset);
+    if ( block->sector_idx != __heap_sector_index(heap, sector) ) { return 0; }
+
+    if ( block->prev_free != __heap_free_list_end ) {
+        return block->prev_free < heap->used_bytes && __heap_free_block_at(heap, block->prev_free)->next_free == offset;
+    }
+
+    uint32_t fl, sl;
+    __heap_free_list_mapping(sector->fields.allocation_size, &fl, &sl);
+    return (heap->sl_bitmap[fl] & (1u << sl)) && heap->free_lists[fl][sl] == offset;
+}
+
+// moves the empty sectors left behind by merges towards the end of the table, where they are
+// dropped, looking at up to n entries from where the last call stopped, returns 1 once the pass
+// has reached the end of the table and starts over
+int __remove_empty_chunks(heap_t* heap, size_t n) {
+
+    while ( n-- ) {
+
+        if ( heap->compact_hole_end >= heap->sector_count ) {
+            __heap_sector_trim(heap);
+            heap->compact_cursor = 0;
+            heap->compact_hole_end = 0;
+            heap->compact_offset = 0;
+            return 1;
+        }
+
+        __heap_sector_data_t* sector = __heap_sector_at(heap, heap->compact_hole_end);
+        size_t size = sector->fields.allocation_size;
+        if ( !size ) {
+            heap->compact_hole_end++;
+            continue;
+        }
+
+        if ( heap->compact_cursor != heap->compact_hole_end ) {
+
+            // free blocks point back at their sector, their offset is only known from the sizes of
+            // the sectors before them, which merges across the cursor can change, so the pass
+            // starts over when the offset doesn't lead to the block
+            if ( !sector->fields.allocated ) {
+                if ( !__heap_free_block_is_at(heap, sector, heap->compact_offset) ) {
+                    __allocdebugprintf("compact:\n\tlost track of the sector offsets, starting over\n");
+                    heap->compact_cursor = 0;
+                    heap->compact_hole_end = 0;
+                    heap->compact_offset = 0;
+                    return 1;
+                }
+                __heap_free_block_at(heap, heap->compact_offset)->sector_idx = heap->compact_cursor;
+            }
+
+            __heap_sector_data_t* sector_hole = __heap_sector_at(heap, heap->compact_cursor);
+            uint32_t next_sector_exists = sector->fields.next_sector_exists;
+            sector_hole->raw = sector->raw;
+            sector_hole->fields.next_sector_exists = 1;
+            sector->raw = 0;
+            sector->fields.next_sector_exists = next_sector_exists;
+
+        }
+
+        heap->compact_cursor++;
+        heap->compact_hole_end++;
+        heap->compact_offset += size;
+
+    }
+
+    return 0;
+}
+
+#define __heap_compact_step(heap) __remove_empty_chunks(heap, allocator_v2_compact_slice)
+
+#else
+
+// the indexed layout reuses unused sectors instead of leaving empty ones in the table
+#define __heap_compact_step(heap)
+
+#endif
+
+// counts a block of the sector table of size bytes (with its header) as live or not
+void __heap_stats_add_sector(heap_t* heap, size_t size) {
+    heap->live_bytes += size - __heap_block_header_size;
+    heap->n_live_sectors[31 - __builtin_clz((uint32_t)size)]++;
+}
+
+void __heap_stats_remove_sector(heap_t* heap, size_t size) {
+    heap->live_bytes -= size - __heap_block_header_size;
+    heap->n_live_sectors[31 - __builtin_clz((uint32_t)size)]--;
+}
+
+// returns the number of bytes a block needs to hold size bytes
+size_t __heap_block_size(size_t size) {
+    size_t size_alloc = size + __heap_block_header_size;
+    size_alloc = size_alloc > __heap_minimum_allocation_size ? size_alloc : __heap_minimum_allocation_size;
+    return (size_alloc + __heap_alignment - 1) & ~(__heap_alignment - 1);
+}
+
+// allocates a block of size_alloc bytes (with its header) and stores its offset, returns its
+// sector or NULL if the heap is full
+__heap_sector_data_t* __heap_alloc_block(heap_t* heap, size_t size_alloc, size_t* offset_out) {
+
+    __allocdebugprintf("\tsearching the free lists\n");
+
+    size_t offset;
+    __heap_sector_data_t* sector_free = __heap_free_list_find(heap, size_alloc, &offset);
+
+    if ( sector_free != NULL ) {
+
+        __allocdebugprintf("\tfound pre-existing sector that works\n");
+        __heap_free_list_remove(heap, sector_free, offset);
+
+        size_t size_remaining = sector_free->fields.allocation_size - size_alloc;
+
+        // segregated placement puts large blocks at the end of the free block and leaves its
+        // start free
+        if ( __heap_placement(heap) == heap_placement_segregated && size_alloc >= allocator_v2_segregation_size && size_remaining >= __heap_minimum_allocation_size ) {
+            __heap_sector_data_t* sector_split = __heap_sector_new(heap, sector_free, offset + size_remaining, size_alloc);
+            if ( sector_split != NULL ) {
+                __allocdebugprintf("\tsplitting sector at its end\n");
+                sector_free->fields.allocation_size = size_remaining;
+                __heap_mark_allocated(heap, sector_split, offset + size_remaining);
+                __heap_mark_free(heap, sector_free, offset);
+                __heap_free_list_insert(heap, sector_free, offset);
+                __heap_stats_add_sector(heap, size_alloc);
+                *offset_out = offset + size_remaining;
+                return sector_split;
+            }
+        }
+
+        // split the end of the block off into a new free sector if it is large enough
+        if ( size_remaining >= __heap_minimum_allocation_size ) {
+            __heap_sector_data_t* sector_split = __heap_sector_new(heap, sector_free, offset + size_alloc, size_remaining);
+            if ( sector_split != NULL ) {
+                __allocdebugprintf("\tsplitting sector\n");
+                sector_free->fields.allocation_size = size_alloc;
+                __heap_mark_free(heap, sector_split, offset + size_alloc);
+                __heap_free_list_insert(heap, sector_split, offset + size_alloc);
+            }
+        }
+
+        __heap_mark_allocated(heap, sector_free, offset);
+        __heap_stats_add_sector(heap, sector_free->fields.allocation_size);
+        heap->placement_rover = offset + sector_free->fields.allocation_size;
+        __allocdebugprintf("\tdone\n");
+        *offset_out = offset;
+        return sector_free;
+
+    }
+
+    __allocdebugprintf("\tfinding the top of the heap\n");
+
+    offset = heap->used_bytes;
+    __heap_sector_data_t* sector_new = __heap_sector_new(heap, NULL, offset, size_alloc);
+    if ( sector_new == NULL ) {
+        __allocdebugprintf("\tERROR: not enough space in the heap!\n");
+        return NULL;
+    }
+
+    heap->used_bytes += size_alloc;
+    __heap_mark_allocated(heap, sector_new, offset);
+    __heap_stats_add_sector(heap, size_alloc);
+    heap->placement_rover = heap->used_bytes;
+
+    __allocdebugprintf("\tdone\n");
+
+    *offset_out = offset;
+    return sector_new;
+
+}
+
+void* __heap_alloc_sector(heap_t* heap, size_t size) {
+
+    __allocdebugprintf("memalloc init:\n");
+
+    if ( size > __heap_maximum_allocation_size - __heap_block_header_size ) {
+        __allocdebugprintf("\tallocation size is greater than the maximum, exiting\n");
+        return NULL;
+    }
+
+    size_t offset;
+    if ( __heap_alloc_block(heap, __heap_block_size(size), &offset) == NULL ) { return NULL; }
+    return (void*)((char*)heap->base + offset + __heap_block_header_size);
+
+}
+
+void __heap_release_sector(heap_t* heap, __heap_sector_data_t* dealloc_sector, size_t dealloc_offset);
+
+void __heap_free_sector(heap_t* heap, void* user_ptr) {
+
+    __allocdebugprintf("memfree init:\n");
+
+    __heap_sector_data_t* dealloc_sector = __heap_sector_from_user_pointer(heap, user_ptr);
+    if ( dealloc_sector == NULL ) {
+        __allocdebugprintf("\tcould not find heap sector cooresponding to user pointer\n");
+        return;
+    }
+
+    if ( !dealloc_sector->fields.allocated ) {
+        __allocdebugprintf("\tsector is already free\n");
+        return;
+    }
+
+    __heap_stats_remove_sector(heap, dealloc_sector->fields.allocation_size);
+    __heap_release_sector(heap, dealloc_sector, (char*)user_ptr - (char*)heap->base - __heap_block_header_size);
+
+}
+
+// turns the allocated block of a sector into free space, merging it with the free blocks next to it
+void __heap_release_sector(heap_t* heap, __heap_sector_data_t* dealloc_sector, size_t dealloc_offset) {
+
+    // merge into the block before this one if it is free
+    __heap_sector_data_t* sector_prev = __heap_sector_prev_free(heap, dealloc_sector, dealloc_offset);
+    if ( sector_prev != NULL && sector_prev->fields.allocation_size + dealloc_sector->fields.allocation_size <= __heap_maximum_allocation_size ) {
+        __allocdebugprintf("\tmerging current sector and previous\n");
+        dealloc_offset -= sector_prev->fields.allocation_size;
+        __heap_free_list_remove(heap, sector_prev, dealloc_offset);
+        sector_prev->fields.allocation_size += dealloc_sector->fields.allocation_size;
+        __heap_sector_delete(heap, dealloc_sector);
+        dealloc_sector = sector_prev;
+    }
+
+    // merge the block after this one into it if it is free
+    __heap_sector_data_t* sector_next = __heap_sector_next(heap, dealloc_sector, dealloc_offset);
+    if ( sector_next != NULL && !sector_next->fields.allocated && sector_next->fields.allocation_size + dealloc_sector->fields.allocation_size <= __heap_maximum_allocation_size ) {
+        __allocdebugprintf("\tmerging current sector and next\n");
+        __heap_free_list_remove(heap, sector_next, dealloc_offset + dealloc_sector->fields.allocation_size);
+        dealloc_sector->fields.allocation_size += sector_next->fields.allocation_size;
+        __heap_sector_delete(heap, sector_next);
+    }
+
+    // free blocks at the end of the data segment are given back to the unused space of the heap
+    if ( __heap_sector_next(heap, dealloc_sector, dealloc_offset) == NULL ) {
+        while ( 1 ) {
+            __allocdebugprintf("\tdeleting top sector\n");
+            sector_prev = __heap_sector_prev_free(heap, dealloc_sector, dealloc_offset);
+            heap->used_bytes = dealloc_offset;
+            __heap_sector_delete(heap, dealloc_sector);
+            if ( sector_prev == NULL ) { break; }
+            dealloc_offset -= sector_prev->fields.allocation_size;
+            __heap_free_list_remove(heap, sector_prev, dealloc_offset);
+            dealloc_sector = sector_prev;
+        }
+        __heap_release_unused(heap);
+        __allocdebugprintf("\tdone\n");
+        return;
+    }
+
+    __heap_mark_free(heap, dealloc_sector, dealloc_offset);
+    __heap_free_list_insert(heap, dealloc_sector, dealloc_offset);
+    __heap_release_free_block(heap, dealloc_offset, dealloc_sector->fields.allocation_size);
+
+    __allocdebugprintf("\tdone\n");
+
+}
+
+// object sizes of the small size classes, which are multiples of __heap_alignment so every
+// object of a page is aligned
+const uint16_t __heap_small_class_sizes[__heap_small_n_classes] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 144, 160, 176, 192, 208, 224, 240, 256
+};
+
+// size class of every small request size, indexed by the size rounded up to 8 bytes
+const uint8_t __heap_small_class_lookup[(__heap_small_max_size >> 3) + 1] = {
+    0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+    8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15
+};
+
+size_t __heap_small_class(size_t size) {
+    return __heap_small_class_lookup[(size + 7) >> 3];
+}
+
+__heap_slab_page_t* __heap_slab_page_at(heap_t* heap, size_t idx) {
+    return (__heap_slab_page_t*)(heap->slab_base + idx*__heap_slab_page_size);
+}
+
+int __heap_slab_contains(heap_t* heap, void* ptr) {
+    return (char*)ptr >= heap->slab_base && (char*)ptr < heap->slab_base + heap->slab_n_pages*__heap_slab_page_size;
+}
+
+// returns the index of the object at ptr in its page, or -1 if ptr doesn't point at the start of
+// an object, only looks at the parts of the page header that stay the same while it is in use
+size_t __heap_slab_object_index(__heap_slab_page_t* page, void* ptr) {
+    size_t offset = (char*)ptr - (char*)page;
+    size_t size = __heap_small_class_sizes[page->size_class];
+    if ( offset < page->objects_offset || page->size_class >= __heap_small_n_classes ) { return (size_t)-1; }
+    offset -= page->objects_offset;
+    if ( offset % size || offset/size >= page->n_objects ) { return (size_t)-1; }
+    return offset/size;
+}
+
+// sets the allocated bit of the object at offset in its page
+void __heap_slab_set_allocated(__heap_slab_page_t* page, size_t offset) {
+    page->allocated[offset >> 9] |= (uint32_t)1 << (offset >> 4 & 31);
+}
+
+// clears the allocated bit of the object at offset in its page, returns 0 if it was clear
+int __heap_slab_clear_allocated(__heap_slab_page_t* page, size_t offset) {
+    uint32_t bit = (uint32_t)1 << (offset >> 4 & 31);
+    if ( !(page->allocated[offset >> 9] & bit) ) { return 0; }
+    page->allocated[offset >> 9] &= ~bit;
+    return 1;
+}
+
+// returns the page of the slab object at ptr, or NULL if ptr isn't an object that is allocated
+__heap_slab_page_t* __heap_slab_allocated_page(heap_t* heap, void* ptr) {
+    size_t page_idx = ((char*)ptr - heap->slab_base)/__heap_slab_page_size;
+    if ( page_idx >= heap->slab_page_bump ) { return NULL; }
+    __heap_slab_page_t* page = __heap_slab_page_at(heap, page_idx);
+    size_t offset = (char*)ptr - (char*)page;
+    if ( offset >= page->bump || __heap_slab_object_index(page, ptr) == (size_t)-1 ) { return NULL; }
+    return page->allocated[offset >> 9] & (uint32_t)1 << (offset >> 4 & 31) ? page : NULL;
+}
+
+void __heap_slab_list_insert(heap_t* heap, uint32_t* list, uint32_t page_idx) {
+    __heap_slab_page_t* page = __heap_slab_page_at(heap, page_idx);
+    page->prev_page = __heap_free_list_end;
+    page->next_page = *list;
+    if ( *list != __heap_free_list_end ) { __heap_slab_page_at(heap, *list)->prev_page = page_idx; }
+    *list = page_idx;
+}
+
+void __heap_slab_list_remove(heap_t* heap, uint32_t* list, uint32_t page_idx) {
+    __heap_slab_page_t* page = __heap_slab_page_at(heap, page_idx);
+    if ( page->next_page != __heap_free_list_end ) { __heap_slab_page_at(heap, page->next_page)->prev_page = page->prev_page; }
+    if ( page->prev_page != __heap_free_list_end ) { __heap_slab_page_at(heap, page->prev_page)->next_page = page->next_page; }
+    else { *list = page->next_page; }
+}
+
+// takes the slab arena out of the empty heap, the arena is never freed so its bounds don't
+// change while other threads look at them
+void __heap_slab_reserve(heap_t* heap) {
+
+    heap->slab_base = NULL;
+    heap->slab_n_pages = 0;
+    heap->slab_page_bump = 0;
+    heap->slab_free_pages = __heap_free_list_end;
+    memset(heap->slab_partial, 0xff, sizeof(heap->slab_partial));
+
+    size_t n_pages = (heap->max_size/4 < allocator_slab_arena_size ? heap->max_size/4 : allocator_slab_arena_size)/__heap_slab_page_size;
+    if ( !n_pages ) { return; }
+
+    __allocdebugprintf("slab init:\n\treserving %zu pages\n", n_pages);
+
+    // pages start on 16 byte boundaries
+    char* arena = (char*)__heap_alloc_sector(heap, n_pages*__heap_slab_page_size + 15);
+    if ( arena == NULL ) { return; }
+
+    heap->slab_base = (char*)(((uintptr_t)arena + 15) & ~(uintptr_t)15);
+    heap->slab_n_pages = n_pages;
+
+}
+
+// sets up an empty page for a size class, returns its index or __heap_free_list_end if the
+// arena is full
+uint32_t __heap_slab_page_new(heap_t* heap, size_t size_class) {
+
+    uint32_t page_idx;
+    if ( heap->slab_free_pages != __heap_free_list_end ) {
+        page_idx = heap->slab_free_pages;
+        __heap_slab_list_remove(heap, &heap->slab_free_pages, page_idx);
+        // the header of the page is set up again for the new size class
+        heap->slab_header_bytes -= __heap_slab_page_at(heap, page_idx)->objects_offset;
+    } else if ( heap->slab_page_bump < heap->slab_n_pages ) {
+        page_idx = heap->slab_page_bump++;
+    } else {
+        return __heap_free_list_end;
+    }
+
+    size_t size = __heap_small_class_sizes[size_class];
+    size_t objects_offset = sizeof(__heap_slab_page_t);
+#ifdef allocator_thread_safe
+    // the owner bytes of the objects sit between the page header and the objects
+    objects_offset += (__heap_slab_page_size - objects_offset)/(size + 1);
+#endif
+    objects_offset = (objects_offset + 15) & ~(size_t)15;
+
+    __heap_slab_page_t* page = __heap_slab_page_at(heap, page_idx);
+    heap->slab_header_bytes += objects_offset;
+    page->size_class = size_class;
+    page->objects_offset = objects_offset;
+    page->n_objects = (__heap_slab_page_size - objects_offset)/size;
+    page->n_free = page->n_objects;
+    page->free_head = 0;
+    page->bump = objects_offset;
+    memset(page->allocated, 0, sizeof(page->allocated));
+
+    __heap_slab_list_insert(heap, &heap->slab_partial[size_class], page_idx);
+    return page_idx;
+}
+
+// returns an object of a small size class, or NULL if the slab arena is full
+void* __heap_slab_alloc(heap_t* heap, size_t size_class) {
+
+    uint32_t page_idx = heap->slab_partial[size_class];
+    if ( page_idx == __heap_free_list_end ) {
+        page_idx = __heap_slab_page_new(heap, size_class);
+        if ( page_idx == __heap_free_list_end ) { return NULL; }
+    }
+
+    __heap_slab_page_t* page = __heap_slab_page_at(heap, page_idx);
+    char* ptr;
+    if ( page->free_head ) {
+        ptr = (char*)page + page->free_head;
+        page->free_head = *(uint16_t*)ptr;
+    } else {
+        ptr = (char*)page + page->bump;
+        page->bump += __heap_small_class_sizes[size_class];
+    }
+    __heap_slab_set_allocated(page, ptr - (char*)page);
+
+    // objects are always taken from the first page of the list, so full pages leave from there
+    if ( --page->n_free == 0 ) { __heap_slab_list_remove(heap, &heap->slab_partial[size_class], page_idx); }
+
+    heap->live_bytes += __heap_small_class_sizes[size_class];
+    heap->n_live_small[size_class]++;
+
+    return ptr;
+}
+
+void __heap_slab_free(heap_t* heap, void* user_ptr) {
+
+    size_t page_idx = ((char*)user_ptr - heap->slab_base)/__heap_slab_page_size;
+    __heap_slab_page_t* page = __heap_slab_page_at(heap, page_idx);
+    size_t offset = (char*)user_ptr - (char*)page;
+
+    // pages that are unused or empty have nothing to free
+    if ( page_idx >= heap->slab_page_bump || page->n_free == page->n_objects || offset >= page->bump || __heap_slab_object_index(page, user_ptr) == (size_t)-1 ) {
+        __allocdebugprintf("slab free:\n\tcould not find slab object cooresponding to user pointer\n");
+        return;
+    }
+
+    // linking a free object into the list a second time would hand it out twice
+    if ( !__heap_slab_clear_allocated(page, offset) ) {
+        __allocdebugprintf("slab free:\n\tslab object at user pointer is already free\n");
+        return;
+    }
+
+    *(uint16_t*)user_ptr = page->free_head;
+    page->free_head = offset;
+
+    heap->live_bytes -= __heap_small_class_sizes[page->size_class];
+    heap->n_live_small[page->size_class]--;
+
+    if ( page->n_free++ == 0 ) {
+        __heap_slab_list_insert(heap, &heap->slab_partial[page->size_class], page_idx);
+        return;
+    }
+
+    // empty pages can be used by any size class, unless they are the last page of their own
+    if ( page->n_free == page->n_objects && (heap->slab_partial[page->size_class] != page_idx || page->next_page != __heap_free_list_end) ) {
+        __heap_slab_list_remove(heap, &heap->slab_partial[page->size_class], page_idx);
+        __heap_slab_list_insert(heap, &heap->slab_free_pages, page_idx);
+    }
+
+}
+
+// takes up to n objects of a small size class, updating every page it takes them from once,
+// returns how many it got
+size_t __heap_slab_alloc_batch(heap_t* heap, size_t size_class, size_t n, void** ptrs) {
+
+    size_t size = __heap_small_class_sizes[size_class];
+    size_t k = 0;
+
+    while ( k < n ) {
+
+        uint32_t page_idx = heap->slab_partial[size_class];
+        if ( page_idx == __heap_free_list_end ) {
+            page_idx = __heap_slab_page_new(heap, size_class);
+            if ( page_idx == __heap_free_list_end ) { break; }
+        }
+
+        // freed objects first, then the never used end of the page as one run
+        __heap_slab_page_t* page = __heap_slab_page_at(heap, page_idx);
+        size_t n_take = n - k < page->n_free ? n - k : page->n_free;
+        for ( size_t i = 0; i < n_take; i++ ) {
+            char* ptr;
+            if ( page->free_head ) {
+                ptr = (char*)page + page->free_head;
+                page->free_head = *(uint16_t*)ptr;
+            } else {
+                ptr = (char*)page + page->bump;
+                page->bump += size;
+            }
+            __heap_slab_set_allocated(page, ptr - (char*)page);
+            ptrs[k++] = ptr;
+        }
+
+        page->n_free -= n_take;
+        if ( page->n_free == 0 ) { __heap_slab_list_remove(heap, &heap->slab_partial[size_class], page_idx); }
+
+        heap->live_bytes += n_take*size;
+        heap->n_live_small[size_class] += n_take;
+
+    }
+
+    return k;
+}
+
+// allocates from the slab tier or the sector table, the caller holds the heap lock
+void* __heap_alloc_shared(heap_t* heap, size_t size) {
+    __heap_compact_step(heap);
+    if ( size <= __heap_small_max_size ) {
+        void* ptr = __heap_slab_alloc(heap, __heap_small_class(size));
+        if ( ptr != NULL ) { return ptr; }
+    }
+    return __heap_alloc_sector(heap, size);
+}
+
+void __heap_free_shared(heap_t* heap, void* user_ptr) {
+    __heap_compact_step(heap);
+    if ( __heap_slab_contains(heap, user_ptr) ) { __heap_slab_free(heap, user_ptr); }
+    else { __heap_free_sector(heap, user_ptr); }
+}
+
+// resizes an allocated block without moving it, returns 0 if it has to move
+int __heap_resize_sector(heap_t* heap, __heap_sector_data_t* sector, size_t offset, size_t size_alloc) {
+
+    size_t size_cur = sector->fields.allocation_size;
+
+    if ( size_alloc <= size_cur ) {
+
+        // the tail is split off as an allocated block and released, which merges it with whatever
+        // free space follows
+        if ( size_cur - size_alloc < __heap_minimum_allocation_size ) { return 1; }
+        __heap_sector_data_t* sector_split = __heap_sector_new(heap, sector, offset + size_alloc, size_cur - size_alloc);
+        if ( sector_split == NULL ) { return 1; }
+
+        __allocdebugprintf("\tshrinking sector\n");
+        sector->fields.allocation_size = size_alloc;
+        __heap_mark_allocated(heap, sector_split, offset + size_alloc);
+        __heap_stats_remove_sector(heap, size_cur);
+        __heap_stats_add_sector(heap, size_alloc);
+        __heap_release_sector(heap, sector_split, offset + size_alloc);
+        return 1;
+
+    }
+
+    if ( size_alloc > __heap_maximum_allocation_size ) { return 0; }
+
+    __heap_sector_data_t* sector_next = __heap_sector_next(heap, sector, offset);
+
+    // the last block grows into the unused space of the heap
+    if ( sector_next == NULL ) {
+        if ( !__heap_fits(heap, offset + size_alloc, heap->sector_count) ) { return 0; }
+        __allocdebugprintf("\tgrowing top sector\n");
+        sector->fields.allocation_size = size_alloc;
+        heap->used_bytes = offset + size_alloc;
+        __heap_stats_remove_sector(heap, size_cur);
+        __heap_stats_add_sector(heap, size_alloc);
+        return 1;
+    }
+
+    size_t size_merged = size_cur + sector_next->fields.allocation_size;
+    if ( sector_next->fields.allocated || size_merged < size_alloc || size_merged > __heap_maximum_allocation_size ) { return 0; }
+
+    __allocdebugprintf("\tgrowing into next sector\n");
+    __heap_stats_remove_sector(heap, size_cur);
+    __heap_free_list_remove(heap, sector_next, offset + size_cur);
+    __heap_sector_delete(heap, sector_next);
+
+    // whatever is left of the next block stays free
+    if ( size_merged - size_alloc >= __heap_minimum_allocation_size ) {
+        __heap_sector_data_t* sector_split = __heap_sector_new(heap, sector, offset + size_alloc, size_merged - size_alloc);
+        if ( sector_split != NULL ) {
+            sector->fields.allocation_size = size_alloc;
+            __heap_mark_free(heap, sector_split, offset + size_alloc);
+            __heap_free_list_insert(heap, sector_split, offset + size_alloc);
+            __heap_stats_add_sector(heap, size_alloc);
+            return 1;
+        }
+    }
+
+    sector->fields.allocation_size = size_merged;
+    __heap_mark_allocated(heap, sector, offset);
+    __heap_stats_add_sector(heap, size_merged);
+    return 1;
+}
+
+// resizes a block of the shared heap, the caller holds the heap lock
+void* __heap_realloc_shared(heap_t* heap, void* ptr, size_t size) {
+
+    __allocdebugprintf("realloc init:\n");
+
+    size_t size_old;
+
+    if ( __heap_slab_contains(heap, ptr) ) {
+
+        // slab objects can only change size within their size class, one that was freed already
+        // is turned away like a second free of it is
+        __heap_slab_page_t* page = __heap_slab_allocated_page(heap, ptr);
+        if ( page == NULL ) {
+            __allocdebugprintf("\tcould not find allocated slab object cooresponding to user pointer\n");
+            return NULL;
+        }
+        size_old = __heap_small_class_sizes[page->size_class];
+        if ( size <= size_old ) { return ptr; }
+
+    } else {
+
+        __heap_sector_data_t* sector = __heap_sector_from_user_pointer(heap, ptr);
+        if ( sector == NULL || !sector->fields.allocated ) {
+            __allocdebugprintf("\tcould not find heap sector cooresponding to user pointer\n");
+            return NULL;
+        }
+        if ( size > __heap_maximum_allocation_size - __heap_block_header_size ) { return NULL; }
+
+        size_t offset = (char*)ptr - (char*)heap->base - __heap_block_header_size;
+        size_old = sector->fields.allocation_size - __heap_block_header_size;
+        if ( __heap_resize_sector(heap, sector, offset, __heap_block_size(size)) ) { return ptr; }
+
+    }
+
+    __allocdebugprintf("\tmoving the allocation\n");
+
+    void* ptr_new = __heap_alloc_shared(heap, size);
+    if ( ptr_new == NULL ) { return NULL; }
+    memcpy(ptr_new, ptr, size_old < size ? size_old : size);
+    __heap_free_shared(heap, ptr);
+    return ptr_new;
+}
+
+// allocates a block with room for an aligned one anywhere in it, then gives back the space in
+// front of the aligned block and behind it, the caller holds the heap lock
+void* __heap_alloc_aligned_shared(heap_t* heap, size_t size, size_t align) {
+
+    __heap_compact_step(heap);
+
+    __allocdebugprintf("aligned alloc init:\n");
+
+    if ( size > __heap_maximum_allocation_size - __heap_block_header_size - align ) { return NULL; }
+
+    size_t size_alloc = __heap_block_size(size);
+    size_t offset;
+    __heap_sector_data_t* sector = __heap_alloc_block(heap, size_alloc + align - __heap_alignment, &offset);
+    if ( sector == NULL ) { return NULL; }
+
+    // the block can be larger than asked for if the rest of the free block was too small to split
+    size_t size_block = sector->fields.allocation_size;
+    size_t pad = -((uintptr_t)heap->base + offset + __heap_block_header_size) & (align - 1);
+    __heap_stats_remove_sector(heap, size_block);
+
+    if ( pad ) {
+        __heap_sector_data_t* sector_aligned = __heap_sector_new(heap, sector, offset + pad, size_block - pad);
+        if ( sector_aligned == NULL ) {
+            __heap_release_sector(heap, sector, offset);
+            return NULL;
+        }
+        __allocdebugprintf("\tgiving back %zu bytes in front of the aligned block\n", pad);
+        sector->fields.allocation_size = pad;
+        __heap_mark_allocated(heap, sector_aligned, offset + pad);
+        __heap_release_sector(heap, sector, offset);
+        sector = sector_aligned;
+        offset += pad;
+        size_block -= pad;
+    }
+
+    // the space behind is split off like in a realloc that shrinks the block
+    __heap_stats_add_sector(heap, size_block);
+    __heap_resize_sector(heap, sector, offset, size_alloc);
+
+    return (void*)((char*)heap->base + offset + __heap_block_header_size);
+}
+
+// allocates the blocks of a batch, the caller holds the heap lock
+size_t __heap_alloc_batch_shared(heap_t* heap, size_t size, size_t count, void** ptrs) {
+
+    __heap_compact_step(heap);
+
+    size_t n = 0;
+    if ( size <= __heap_small_max_size ) { n = __heap_slab_alloc_batch(heap, __heap_small_class(size), count, ptrs); }
+    if ( n == count || size > __heap_maximum_allocation_size - __heap_block_header_size ) { return n; }
+
+    size_t size_alloc = __heap_block_size(size);
+    size_t n_run_max = __heap_maximum_allocation_size/size_alloc;
+
+    // every run is one block split into count blocks, runs get smaller while there's no free
+    // block large enough for them
+    while ( n < count ) {
+
+        size_t n_run = count - n < n_run_max ? count - n : n_run_max;
+        size_t offset;
+        __heap_sector_data_t* sector;
+        while ( (sector = __heap_alloc_block(heap, n_run*size_alloc, &offset)) == NULL && n_run > 1 ) { n_run = (n_run + 1)/2; }
+        if ( sector == NULL ) { break; }
+
+        __allocdebugprintf("\tsplitting a run of %zu blocks\n", n_run);
+        size_t size_total = sector->fields.allocation_size;
+        __heap_stats_remove_sector(heap, size_total);
+        size_t n_split = __heap_sector_split_run(heap, sector, offset, size_alloc, n_run);
+        for ( size_t i = 0; i < n_split; i++ ) {
+            __heap_stats_add_sector(heap, i + 1 < n_split ? size_alloc : size_total - i*size_alloc);
+            ptrs[n++] = (char*)heap->base + offset + i*size_alloc + __heap_block_header_size;
+        }
+
+    }
+
+    return n;
+}
+
+int __heap_compare_ptrs(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)*(void* const*)a;
+    uintptr_t y = (uintptr_t)*(void* const*)b;
+    return (x > y) - (x < y);
+}
+
+// frees the blocks of a batch in address order, so the blocks of a run that are next to each
+// other are merged into one block that is released once, the caller holds the heap lock
+void __heap_free_batch_shared(heap_t* heap, void** ptrs, size_t count) {
+
+    __heap_compact_step(heap);
+
+    qsort(ptrs, count, sizeof(void*), __heap_compare_ptrs);
+
+    size_t i = 0;
+    while ( i < count ) {
+
+        void* user_ptr = ptrs[i++];
+        if ( __heap_slab_contains(heap, user_ptr) ) {
+            __heap_slab_free(heap, user_ptr);
+            continue;
+        }
+
+        __heap_sector_data_t* sector = __heap_sector_from_user_pointer(heap, user_ptr);
+        if ( sector == NULL || !sector->fields.allocated ) {
+            __allocdebugprintf("batch free:\n\tcould not find heap sector cooresponding to user pointer\n");
+            continue;
+        }
+
+        size_t offset = (char*)user_ptr - (char*)heap->base - __heap_block_header_size;
+        __heap_stats_remove_sector(heap, sector->fields.allocation_size);
+
+        while ( i < count ) {
+            __heap_sector_data_t* sector_next = __heap_sector_next(heap, sector, offset);
+            size_t offset_next = offset + sector->fields.allocation_size;
+            if ( sector_next == NULL || !sector_next->fields.allocated || ptrs[i] != (char*)heap->base + offset_next + __heap_block_header_size ) { break; }
+            if ( sector->fields.allocation_size + sector_next->fields.allocation_size > __heap_maximum_allocation_size ) { break; }
+            __heap_stats_remove_sector(heap, sector_next->fields.allocation_size);
+            sector->fields.allocation_size += sector_next->fields.allocation_size;
+            __heap_sector_delete(heap, sector_next);
+            i++;
+        }
+
+        __heap_release_sector(heap, sector, offset);
+
+    }
+
+}
+
+#ifdef allocator_thread_safe
+
+void __heap_cache_push(__heap_thread_cache_t* cache, size_t size_class, void* ptr) {
+    *(void**)ptr = cache->bins[size_class];
+    cache->bins[size_class] = ptr;
+    cache->counts[size_class]++;
+}
+
+void* __heap_cache_pop(__heap_thread_cache_t* cache, size_t size_class) {
+    void* ptr = cache->bins[size_class];
+    cache->bins[size_class] = *(void**)ptr;
+    cache->counts[size_class]--;
+    return ptr;
+}
+
+__heap_block_header_t* __heap_cache_header(void* ptr) {
+    return (__heap_block_header_t*)((char*)ptr - __heap_block_header_size);
+}
+
+// returns the owner byte of a slab object, or NULL if ptr isn't the start of one
+uint8_t* __heap_slab_owner(heap_t* heap, void* ptr) {
+    __heap_slab_page_t* page = __heap_slab_page_at(heap, ((char*)ptr - heap->slab_base)/__heap_slab_page_size);
+    size_t idx = __heap_slab_object_index(page, ptr);
+    return idx != (size_t)-1 ? (uint8_t*)(page + 1) + idx : NULL;
+}
+
+// slab objects keep their owner in their page and their size class is the one of the page,
+// other blocks keep both in their header
+size_t __heap_block_owner(heap_t* heap, void* ptr) {
+    if ( !__heap_slab_contains(heap, ptr) ) { return __heap_cache_header(ptr)->owner; }
+    uint8_t* owner = __heap_slab_owner(heap, ptr);
+    return owner != NULL ? *owner : 0;
+}
+
+void __heap_block_set_owner(heap_t* heap, void* ptr, size_t owner, size_t size_class) {
+    if ( __heap_slab_contains(heap, ptr) ) {
+        *__heap_slab_owner(heap, ptr) = owner;
+    } else {
+        __heap_cache_header(ptr)->owner = owner;
+        __heap_cache_header(ptr)->size_class = size_class;
+    }
+}
+
+size_t __heap_block_class(heap_t* heap, void* ptr) {
+    if ( !__heap_slab_contains(heap, ptr) ) { return __heap_cache_header(ptr)->size_class; }
+    return __heap_slab_page_at(heap, ((char*)ptr - heap->slab_base)/__heap_slab_page_size)->size_class;
+}
+
+// moves blocks other threads freed into the cache, size classes at their limit send the rest
+// to the shared heap under one lock
+void __heap_cache_drain_remote(heap_t* heap, __heap_thread_cache_t* cache) {
+    if ( atomic_load_explicit(&cache->remote_free, memory_order_relaxed) == NULL ) { return; }
+    void* ptr = atomic_exchange_explicit(&cache->remote_free, NULL, memory_order_acquire);
+    int locked = 0;
+    while ( ptr != NULL ) {
+        void* ptr_next = *(void**)ptr;
+        size_t size_class = __heap_block_class(heap, ptr);
+        if ( cache->counts[size_class] < __heap_cache_limit ) {
+            __heap_cache_push(cache, size_class, ptr);
+        } else {
+            if ( !locked ) { __heap_lock_acquire(heap); locked = 1; }
+            __heap_block_set_owner(heap, ptr, 0, size_class);
+            __heap_free_shared(heap, ptr);
+        }
+        ptr = ptr_next;
+    }
+    if ( locked ) { __heap_lock_release(heap); }
+}
+
+// frees the blocks of a remote free list to the shared heap under one lock
+void __heap_free_remote_shared(heap_t* heap, void* ptr) {
+    if ( ptr == NULL ) { return; }
+    __heap_lock_acquire(heap);
+    while ( ptr != NULL ) {
+        void* ptr_next = *(void**)ptr;
+        __heap_block_set_owner(heap, ptr, 0, __heap_block_class(heap, ptr));
+        __heap_free_shared(heap, ptr);
+        ptr = ptr_next;
+    }
+    __heap_lock_release(heap);
+}
+
+// returns up to n blocks of a size class to the shared heap under one lock
+void __heap_cache_flush(heap_t* heap, __heap_thread_cache_t* cache, size_t size_class, size_t n) {
+    __heap_lock_acquire(heap);
+    while ( n-- && cache->bins[size_class] != NULL ) {
+        void* ptr = __heap_cache_pop(cache, size_class);
+        __heap_block_set_owner(heap, ptr, 0, size_class);
+        __heap_free_shared(heap, ptr);
+    }
+    __heap_lock_release(heap);
+}
+
+// takes a batch of blocks of a size class from the shared heap under one lock
+void __heap_cache_refill(heap_t* heap, __heap_thread_cache_t* cache, size_t size_class) {
+    __heap_lock_acquire(heap);
+    for ( size_t i = 0; i < __heap_cache_batch; i++ ) {
+        void* ptr = __heap_slab_alloc(heap, size_class);
+        if ( ptr == NULL ) { ptr = __heap_alloc_sector(heap, __heap_small_class_sizes[size_class]); }
+        if ( ptr == NULL ) { break; }
+        __heap_block_set_owner(heap, ptr, __heap_thread_id, size_class);
+        __heap_cache_push(cache, size_class, ptr);
+    }
+    __heap_lock_release(heap);
+}
+
+// hands the caches of an exiting thread back to their heaps
+#ifdef allocator_hardened
+void __heap_quarantine_flush(heap_t* heap, __heap_quarantine_t* quarantine);
+#endif
+
+void __heap_thread_exit(void* arg) {
+
+    (void)arg;
+
+    pthread_mutex_lock(&__heap_registry_lock);
+
+    for ( heap_t* heap = __heap_registry; heap != NULL; heap = heap->next_heap ) {
+        __heap_thread_cache_t* cache = &heap->thread_caches[__heap_thread_id - 1];
+#ifdef allocator_hardened
+        __heap_quarantine_flush(heap, &cache->quarantine);
+#endif
+        void* remote_free = atomic_exchange_explicit(&cache->remote_free, __heap_remote_orphaned, memory_order_acquire);
+        __heap_free_remote_shared(heap, remote_free);
+        for ( size_t i = 0; i < __heap_small_n_classes; i++ ) {
+            __heap_cache_flush(heap, cache, i, cache->counts[i]);
+        }
+    }
+
+    __heap_free_thread_ids[__heap_n_free_thread_ids++] = __heap_thread_id;
+    pthread_mutex_unlock(&__heap_registry_lock);
+
+    __heap_thread_id = -1;
+
+}
+
+void __heap_thread_key_init() {
+    pthread_key_create(&__heap_thread_key, __heap_thread_exit);
+}
+
+// returns the cache of the calling thread, or NULL if every thread id is taken
+__heap_thread_cache_t* __heap_thread_cache(heap_t* heap) {
+
+    if ( __heap_thread_id > 0 ) { return &heap->thread_caches[__heap_thread_id - 1]; }
+    if ( __heap_thread_id < 0 ) { return NULL; }
+
+    pthread_once(&__heap_thread_key_once, __heap_thread_key_init);
+
+    pthread_mutex_lock(&__heap_registry_lock);
+    if ( __heap_n_free_thread_ids ) {
+        __heap_thread_id = __heap_free_thread_ids[--__heap_n_free_thread_ids];
+        // the caches of the thread that had the id before are taken over
+        for ( heap_t* heap_other = __heap_registry; heap_other != NULL; heap_other = heap_other->next_heap ) {
+            atomic_store_explicit(&heap_other->thread_caches[__heap_thread_id - 1].remote_free, NULL, memory_order_relaxed);
+        }
+    } else if ( __heap_n_thread_ids < allocator_max_threads ) {
+        __heap_thread_id = ++__heap_n_thread_ids;
+    } else {
+        __heap_thread_id = -1;
+    }
+    pthread_mutex_unlock(&__heap_registry_lock);
+
+    if ( __heap_thread_id < 0 ) { return NULL; }
+
+    // the key destructor flushes the caches when the thread exits
+    pthread_setspecific(__heap_thread_key, (void*)1);
+    return &heap->thread_caches[__heap_thread_id - 1];
+}
+
+void* __heap_alloc_cached(heap_t* heap, size_t size) {
+
+    __heap_thread_cache_t* cache = size <= __heap_small_max_size ? __heap_thread_cache(heap) : NULL;
+
+    if ( cache != NULL ) {
+        size_t size_class = __heap_small_class(size);
+        if ( cache->bins[size_class] == NULL ) { __heap_cache_drain_remote(heap, cache); }
+        if ( cache->bins[size_class] == NULL ) { __heap_cache_refill(heap, cache, size_class); }
+        if ( cache->bins[size_class] == NULL ) { return NULL; }
+        return __heap_cache_pop(cache, size_class);
+    }
+
+    __heap_lock_acquire(heap);
+    void* ptr = __heap_alloc_shared(heap, size);
+    if ( ptr != NULL ) { __heap_block_set_owner(heap, ptr, 0, 0); }
+    __heap_lock_release(heap);
+    return ptr;
+
+}
+
+void __heap_free_cached(heap_t* heap, void* user_ptr);
+
+void* __heap_realloc_cached(heap_t* heap, void* ptr, size_t size) {
+
+    if ( (char*)ptr < (char*)heap->base + __heap_block_header_size || (char*)ptr >= (char*)heap->top ) {
+        __allocdebugprintf("realloc init:\n\tcould not find heap sector cooresponding to user pointer\n");
+        return NULL;
+    }
+
+    size_t owner = __heap_block_owner(heap, ptr);
+
+    if ( owner == 0 || owner > allocator_max_threads ) {
+        __heap_lock_acquire(heap);
+        void* ptr_new = __heap_realloc_shared(heap, ptr, size);
+        if ( ptr_new != NULL && ptr_new != ptr ) { __heap_block_set_owner(heap, ptr_new, 0, 0); }
+        __heap_lock_release(heap);
+        return ptr_new;
+    }
+
+    // blocks of the thread caches always hold their whole size class
+    size_t size_old = __heap_small_class_sizes[__heap_block_class(heap, ptr)];
+    if ( size <= size_old ) { return ptr; }
+
+    void* ptr_new = __heap_alloc_cached(heap, size);
+    if ( ptr_new == NULL ) { return NULL; }
+    memcpy(ptr_new, ptr, size_old);
+    __heap_free_cached(heap, ptr);
+    return ptr_new;
+
+}
+
+void __heap_free_cached(heap_t* heap, void* user_ptr) {
+
+    // only pointers inside the data segment can have a header to look at
+    if ( (char*)user_ptr < (char*)heap->base + __heap_block_header_size || (char*)user_ptr >= (char*)heap->top ) {
+        __allocdebugprintf("memfree init:\n\tcould not find heap sector cooresponding to user pointer\n");
+        return;
+    }
+
+    size_t owner = __heap_block_owner(heap, user_ptr);
+
+    if ( owner == 0 || owner > allocator_max_threads ) {
+        __heap_lock_acquire(heap);
+        __heap_free_shared(heap, user_ptr);
+        __heap_lock_release(heap);
+        return;
+    }
+
+    // blocks of other threads go back through their lock-free remote free list
+    if ( owner != (size_t)__heap_thread_id ) {
+        __heap_thread_cache_t* cache_owner = &heap->thread_caches[owner - 1];
+        void* ptr_head = atomic_load_explicit(&cache_owner->remote_free, memory_order_relaxed);
+        do {
+            if ( ptr_head == __heap_remote_orphaned ) {
+                __heap_lock_acquire(heap);
+                __heap_block_set_owner(heap, user_ptr, 0, __heap_block_class(heap, user_ptr));
+                __heap_free_shared(heap, user_ptr);
+                __heap_lock_release(heap);
+                return;
+            }
+            *(void**)user_ptr = ptr_head;
+        } while ( !atomic_compare_exchange_weak_explicit(&cache_owner->remote_free, &ptr_head, user_ptr, memory_order_release, memory_order_relaxed) );
+        return;
+    }
+
+    __heap_thread_cache_t* cache = &heap->thread_caches[__heap_thread_id - 1];
+    size_t size_class = __heap_block_class(heap, user_ptr);
+    // cached blocks still count as allocated in their slab page, so only a block freed twice in a
+    // row is caught here
+    if ( cache->bins[size_class] == user_ptr ) {
+        __allocdebugprintf("memfree init:\n\tblock at user pointer is already in the thread cache\n");
+        return;
+    }
+    __heap_cache_push(cache, size_class, user_ptr);
+    if ( cache->counts[size_class] > __heap_cache_limit ) {
+        __heap_cache_flush(heap, cache, size_class, __heap_cache_batch);
+    }
+
+}
+
+#else
+
+// without thread caches every block belongs to the shared heap
+#define __heap_alloc_cached __heap_alloc_shared
+#define __heap_realloc_cached __heap_realloc_shared
+#define __heap_free_cached __heap_free_shared
+
+#endif
+
+void* __heap_alloc_aligned_cached(heap_t* heap, size_t size, size_t align) {
+
+    if ( align <= __heap_alignment ) { return __heap_alloc_cached(heap, size); }
+
+    // aligned blocks always belong to the shared heap
+    __heap_lock_acquire(heap);
+    void* ptr = __heap_alloc_aligned_shared(heap, size, align);
+#ifdef allocator_thread_safe
+    if ( ptr != NULL ) { __heap_block_set_owner(heap, ptr, 0, 0); }
+#endif
+    __heap_lock_release(heap);
+
+    return ptr;
+}
+
+#ifdef allocator_hardened
+
+#include <stdarg.h>
+
+// reports misuse of the block at user_ptr
+void __heap_report(heap_t* heap, void* user_ptr, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "allocator: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, " (block %p, heap %p)\n", user_ptr, (void*)heap);
+    va_end(args);
+    allocator_hardened_fail();
+}
+
+uint32_t __heap_guard_check(heap_t* heap, void* user_ptr, uint32_t size, uint32_t offset) {
+    uint64_t x = ((uint64_t)size << 32 | offset) ^ (uintptr_t)user_ptr ^ ((uintptr_t)heap << 16);
+    x ^= x >> 29;
+    x *= 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(x >> 32);
+}
+
+__heap_guard_t* __heap_guard_of(void* user_ptr) {
+    return (__heap_guard_t*)((char*)user_ptr - __heap_guard_size);
+}
+
+// sets up the guard and the redzone of a block whose user data starts offset bytes into the
+// allocation at ptr, returns the user pointer
+void* __heap_guard_place(heap_t* heap, void* ptr, size_t size, size_t offset) {
+    char* user_ptr = (char*)ptr + offset;
+    __heap_guard_t* guard = __heap_guard_of(user_ptr);
+    guard->size = size;
+    guard->offset = offset;
+    guard->state = __heap_guard_live;
+    guard->check = __heap_guard_check(heap, user_ptr, size, offset);
+    memset(user_ptr + size, __heap_redzone_byte, __heap_redzone_size);
+    return user_ptr;
+}
+
+// returns the guard of a block passed in to call, or NULL once the misuse has been reported,
+// only the guard is looked at so this takes no lock
+__heap_guard_t* __heap_guard_validate(heap_t* heap, void* user_ptr, const char* call) {
+
+    // the guard of a pointer outside of the data segment can't be read, a block at the end of the
+    // data segment is cut off once it is freed
+    if ( (char*)user_ptr < (char*)heap->base + __heap_guard_size || (char*)user_ptr >= (char*)heap->top ) {
+        __heap_report(heap, user_ptr, "%s of a pointer outside of the heap", call);
+        return NULL;
+    }
+    if ( (char*)user_ptr >= (char*)heap->base + heap->used_bytes ) {
+        __heap_report(heap, user_ptr, "%s of a pointer past the end of the data segment, most likely a block that was already freed", call);
+        return NULL;
+    }
+    if ( (uintptr_t)user_ptr & (__heap_alignment - 1) ) {
+        __heap_report(heap, user_ptr, "%s of a pointer that isn't the start of a block", call);
+        return NULL;
+    }
+
+    // the state stays behind in a freed block after the allocator has written its own links
+    // over the rest of the guard, until the space is handed out again
+    __heap_guard_t* guard = __heap_guard_of(user_ptr);
+    if ( guard->state == __heap_guard_freed ) {
+        __heap_report(heap, user_ptr, "%s of a block that was already freed", call);
+        return NULL;
+    }
+    if ( guard->state != __heap_guard_live || guard->check != __heap_guard_check(heap, user_ptr, guard->size, guard->offset) ) {
+        __heap_report(heap, user_ptr, "%s of a pointer that was never allocated, or whose guard was overwritten", call);
+        return NULL;
+    }
+
+    unsigned char* redzone = (unsigned char*)user_ptr + guard->size;
+    for ( size_t i = 0; i < __heap_redzone_size; i++ ) {
+        if ( redzone[i] != __heap_redzone_byte ) {
+            __heap_report(heap, user_ptr, "heap buffer overflow, byte %zu past the end of the %u byte block was written", i, guard->size);
+            return NULL;
+        }
+    }
+
+    return guard;
+}
+
+// true if user_ptr is a live block of the heap, looks at the same guard as
+// __heap_guard_validate but doesn't report anything
+int __heap_guard_owned(heap_t* heap, void* user_ptr) {
+    if ( (char*)user_ptr < (char*)heap->base + __heap_guard_size || (char*)user_ptr >= (char*)heap->base + heap->used_bytes ) { return 0; }
+    if ( (uintptr_t)user_ptr & (__heap_alignment - 1) ) { return 0; }
+    __heap_guard_t* guard = __heap_guard_of(user_ptr);
+    return guard->state == __heap_guard_live && guard->check == __heap_guard_check(heap, user_ptr, guard->size, guard->offset);
+}
+
+void* __heap_alloc_guarded(heap_t* heap, size_t size) {
+    if ( size > __heap_maximum_allocation_size ) { return NULL; }
+    void* ptr = __heap_alloc_cached(heap, size + __heap_guard_size + __heap_redzone_size);
+    return ptr != NULL ? __heap_guard_place(heap, ptr, size, __heap_guard_size) : NULL;
+}
+
+void* __heap_alloc_aligned_guarded(heap_t* heap, size_t size, size_t align) {
+    if ( align <= __heap_alignment ) { return __heap_alloc_guarded(heap, size); }
+    if ( size > __heap_maximum_allocation_size ) { return NULL; }
+    // the guard goes into the first align bytes so the user data stays aligned
+    void* ptr = __heap_alloc_aligned_cached(heap, size + align + __heap_redzone_size, align);
+    return ptr != NULL ? __heap_guard_place(heap, ptr, size, align) : NULL;
+}
+
+// frees a block that has left the quarantine, after checking nothing was written to it
+void __heap_guard_release(heap_t* heap, void* user_ptr) {
+
+    __heap_guard_t* guard = __heap_guard_of(user_ptr);
+    size_t n_poisoned = guard->size < allocator_hardened_poison_max ? guard->size : allocator_hardened_poison_max;
+    unsigned char* data = (unsigned char*)user_ptr;
+    for ( size_t i = 0; i < n_poisoned; i++ ) {
+        if ( data[i] != __heap_poison_byte ) {
+            __heap_report(heap, user_ptr, "use after free, byte %zu of the %u byte block was written after it was freed", i, guard->size);
+            break;
+        }
+    }
+
+    __heap_free_cached(heap, (char*)user_ptr - guard->offset);
+
+}
+
+__heap_quarantine_t* __heap_quarantine(heap_t* heap) {
+#ifdef allocator_thread_safe
+    __heap_thread_cache_t* cache = __heap_thread_cache(heap);
+    return cache != NULL ? &cache->quarantine : NULL;
+#else
+    return &heap->quarantine;
+#endif
+}
+
+// frees every block held in a quarantine
+void __heap_quarantine_flush(heap_t* heap, __heap_quarantine_t* quarantine) {
+    for ( size_t i = 0; i < allocator_hardened_quarantine; i++ ) {
+        if ( quarantine->ptrs[i] != NULL ) { __heap_guard_release(heap, quarantine->ptrs[i]); }
+        quarantine->ptrs[i] = NULL;
+    }
+    quarantine->next = 0;
+}
+
+void __heap_free_guarded(heap_t* heap, void* user_ptr) {
+
+    if ( user_ptr == NULL ) { return; }
+
+    __heap_guard_t* guard = __heap_guard_validate(heap, user_ptr, "free");
+    if ( guard == NULL ) { return; }
+
+    guard->state = __heap_guard_freed;
+    memset(user_ptr, __heap_poison_byte, guard->size < allocator_hardened_poison_max ? guard->size : allocator_hardened_poison_max);
+
+    // the block takes the place of the oldest one in the quarantine, which is freed for real
+    __heap_quarantine_t* quarantine = __heap_quarantine(heap);
+    if ( quarantine == NULL ) {
+        __heap_guard_release(heap, user_ptr);
+        return;
+    }
+
+    void* ptr_oldest = quarantine->ptrs[quarantine->next];
+    quarantine->ptrs[quarantine->next] = user_ptr;
+    quarantine->next = (quarantine->next + 1) % allocator_hardened_quarantine;
+    if ( ptr_oldest != NULL ) { __heap_guard_release(heap, ptr_oldest); }
+
+}
+
+void* __heap_realloc_guarded(heap_t* heap, void* user_ptr, size_t size) {
+
+    __heap_guard_t* guard = __heap_guard_validate(heap, user_ptr, "realloc");
+    if ( guard == NULL || size > __heap_maximum_allocation_size ) { return NULL; }
+
+    // aligned blocks are moved by hand, since their guard isn't at the start of the allocation
+    if ( guard->offset != __heap_guard_size ) {
+        void* user_ptr_new = __heap_alloc_guarded(heap, size);
+        if ( user_ptr_new == NULL ) { return NULL; }
+        memcpy(user_ptr_new, user_ptr, guard->size < size ? guard->size : size);
+        __heap_free_guarded(heap, user_ptr);
+        return user_ptr_new;
+    }
+
+    void* ptr = __heap_realloc_cached(heap, (char*)user_ptr - __heap_guard_size, size + __heap_guard_size + __heap_redzone_size);
+    return ptr != NULL ? __heap_guard_place(heap, ptr, size, __heap_guard_size) : NULL;
+}
+
+#else
+
+#define __heap_alloc_guarded __heap_alloc_cached
+#define __heap_alloc_aligned_guarded __heap_alloc_aligned_cached
+#define __heap_realloc_guarded __heap_realloc_cached
+#define __heap_free_guarded __heap_free_cached
+
+#endif
+
+// true if an allocation of size bytes aligned to align gets a mapping of its own, never with a
+// large size of 0, where the compare would be against 0
+#if allocator_v2_large_size
+    #define __heap_is_large(size, align) ((size) >= allocator_v2_large_size && (align) < __heap_large_page_size)
+#else
+    #define __heap_is_large(size, align) 0
+#endif
+
+uintptr_t __heap_large_check(heap_t* heap, __heap_large_t* large) {
+    return ((uintptr_t)large ^ (uintptr_t)heap) * (uintptr_t)0x9e3779b97f4a7c15ull;
+}
+
+void __heap_large_link(heap_t* heap, __heap_large_t* large) {
+    large->check = __heap_large_check(heap, large);
+    large->prev = NULL;
+    large->next = heap->large;
+    if ( heap->large != NULL ) { heap->large->prev = large; }
+    heap->large = large;
+    heap->large_bytes += large->mapping_size;
+    heap->n_large++;
+    heap->live_bytes += large->size;
+}
+
+void __heap_large_unlink(heap_t* heap, __heap_large_t* large) {
+    if ( large->prev != NULL ) { large->prev->next = large->next; }
+    else { heap->large = large->next; }
+    if ( large->next != NULL ) { large->next->prev = large->prev; }
+    heap->large_bytes -= large->mapping_size;
+    heap->n_large--;
+    heap->live_bytes -= large->size;
+    large->check = 0;
+}
+
+// maps a large allocation of size bytes at a multiple of align, the heap lock is only taken to
+// add it to the list
+void* __heap_large_alloc(heap_t* heap, size_t size, size_t align) {
+
+    __allocdebugprintf("large alloc init:\n");
+
+    size_t offset = align > __heap_large_header_size ? align : __heap_large_header_size;
+    if ( size > SIZE_MAX - offset - __heap_large_page_size ) { return NULL; }
+    size_t mapping_size = (offset + size + __heap_large_page_size - 1) & ~(size_t)(__heap_large_page_size - 1);
+
+    char* mapping = (char*)mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ( mapping == MAP_FAILED ) {
+        __allocdebugprintf("\tERROR: could not map %zu bytes\n", mapping_size);
+        return NULL;
+    }
+
+    __heap_large_t* large = (__heap_large_t*)(mapping + offset - __heap_large_header_size);
+    large->size = mapping_size - offset;
+    large->mapping_size = mapping_size;
+    large->offset = offset;
+
+    __heap_lock_acquire(heap);
+    __heap_large_link(heap, large);
+    __heap_lock_release(heap);
+
+    __allocdebugprintf("\tmapped %zu bytes\n", mapping_size);
+    return mapping + offset;
+}
+
+// returns the header of user_ptr if it is a large allocation of the heap, or NULL
+__heap_large_t* __heap_large_of(heap_t* heap, void* user_ptr) {
+
+    if ( !allocator_v2_large_size ) { return NULL; }
+    if ( (char*)user_ptr >= (char*)heap->base && (char*)user_ptr < (char*)heap->base + heap->max_size ) { return NULL; }
+
+#ifdef allocator_hardened
+    // the header of a pointer that was freed already can't be read, so the pointer is looked up
+    // in the list instead
+    __heap_lock_acquire(heap);
+    __heap_large_t* large = heap->large;
+    while ( large != NULL && (char*)large + __heap_large_header_size != (char*)user_ptr ) { large = large->next; }
+    __heap_lock_release(heap);
+    return large;
+#else
+    // the header is in the same page as the user pointer, so it can be read even if the pointer
+    // came from somewhere else
+    if ( ((uintptr_t)user_ptr & (__heap_large_page_size - 1)) < __heap_large_header_size ) { return NULL; }
+    __heap_large_t* large = (__heap_large_t*)((char*)user_ptr - __heap_large_header_size);
+    return large->check == __heap_large_check(heap, large) ? large : NULL;
+#endif
+}
+
+void __heap_large_free(heap_t* heap, __heap_large_t* large) {
+
+    __allocdebugprintf("large free init:\n");
+
+    __heap_lock_acquire(heap);
+    __heap_large_unlink(heap, large);
+    __heap_lock_release(heap);
+
+    munmap((char*)large + __heap_large_header_size - large->offset, large->mapping_size);
+    __allocdebugprintf("\tunmapped %zu bytes\n", large->mapping_size);
+
+}
+
+// resizes a large allocation, which moves into the heap once it is below allocator_v2_large_size
+void* __heap_large_realloc(heap_t* heap, __heap_large_t* large, void* user_ptr, size_t size) {
+
+    if ( !__heap_is_large(size, __heap_alignment) ) {
+        void* ptr_new = __heap_alloc_guarded(heap, size);
+        if ( ptr_new == NULL ) { return size <= large->size ? user_ptr : NULL; }
+        memcpy(ptr_new, user_ptr, size);
+        __heap_large_free(heap, large);
+        return ptr_new;
+    }
+
+    size_t offset = large->offset;
+    if ( size > SIZE_MAX - offset - __heap_large_page_size ) { return NULL; }
+    size_t mapping_size = (offset + size + __heap_large_page_size - 1) & ~(size_t)(__heap_large_page_size - 1);
+    if ( mapping_size == large->mapping_size ) { return user_ptr; }
+
+#ifdef MREMAP_MAYMOVE
+    // the pages move to their new place without being copied
+    char* mapping = (char*)user_ptr - offset;
+    __heap_lock_acquire(heap);
+    __heap_large_unlink(heap, large);
+    __heap_lock_release(heap);
+
+    char* mapping_new = (char*)mremap(mapping, large->mapping_size, mapping_size, MREMAP_MAYMOVE);
+    if ( mapping_new != MAP_FAILED ) {
+        large = (__heap_large_t*)(mapping_new + offset - __heap_large_header_size);
+        large->size = mapping_size - offset;
+        large->mapping_size = mapping_size;
+    }
+
+    __heap_lock_acquire(heap);
+    __heap_large_link(heap, large);
+    __heap_lock_release(heap);
+
+    if ( mapping_new == MAP_FAILED ) { return size <= large->size ? user_ptr : NULL; }
+    __allocdebugprintf("large realloc:\n\tremapped to %zu bytes\n", mapping_size);
+    return mapping_new + offset;
+#else
+    if ( size <= large->size ) { return user_ptr; }
+    void* ptr_new = __heap_large_alloc(heap, size, __heap_alignment);
+    if ( ptr_new == NULL ) { return NULL; }
+    memcpy(ptr_new, user_ptr, large->size);
+    __heap_large_free(heap, large);
+    return ptr_new;
+#endif
+}
+
+void* __heap_alloc_unsampled(heap_t* heap, size_t size) {
+    void* ptr = __heap_is_large(size, __heap_alignment) ? __heap_large_alloc(heap, size, __heap_alignment) : __heap_alloc_guarded(heap, size);
+    __alloctrace(heap_trace_alloc, heap, NULL, ptr, size);
+    return ptr;
+}
+
+#ifdef allocator_profile_enable
+// allocations that use up the countdown are made and sampled out of line
+__attribute__((noinline, cold)) void* __heap_alloc_sampled(heap_t* heap, size_t size, void* caller) {
+    void* ptr = __heap_alloc_unsampled(heap, size);
+    if ( ptr != NULL ) { __heap_profile_sample(ptr, size, caller); }
+    return ptr;
+}
+#endif
+
+void* heap_alloc(heap_t* heap, size_t size) {
+#ifdef allocator_profile_enable
+    if ( __allocprofile_due(size) ) { return __heap_alloc_sampled(heap, size, __builtin_return_address(0)); }
+#endif
+    return __heap_alloc_unsampled(heap, size);
+}
+
+// stores the number of bytes to copy when the allocation at user_ptr moves, returns 0 if it isn't
+// an allocation of the heap
+int __heap_size_to_move(heap_t* heap, void* user_ptr, size_t* size_out) {
+#ifdef allocator_hardened
+    __heap_guard_t* guard = __heap_guard_validate(heap, user_ptr, "realloc");
+    if ( guard == NULL ) { return 0; }
+    *size_out = guard->size;
+    return 1;
+#else
+    // every block has room for at least one byte
+    *size_out = heap_usable_size(heap, user_ptr);
+    return *size_out != 0;
+#endif
+}
+
+void* heap_realloc(heap_t* heap, void* ptr, size_t size) {
+
+    void* ptr_new;
+    __heap_large_t* large;
+    if ( ptr == NULL ) {
+        ptr_new = __heap_is_large(size, __heap_alignment) ? __heap_large_alloc(heap, size, __heap_alignment) : __heap_alloc_guarded(heap, size);
+    } else if ( (large = __heap_large_of(heap, ptr)) != NULL ) {
+        if ( size == 0 ) { __heap_large_free(heap, large); }
+        ptr_new = size != 0 ? __heap_large_realloc(heap, large, ptr, size) : NULL;
+    } else if ( size == 0 ) {
+        __heap_free_guarded(heap, ptr);
+        ptr_new = NULL;
+    } else if ( __heap_is_large(size, __heap_alignment) ) {
+        // the allocation leaves the heap for a mapping of its own
+        size_t size_old;
+        ptr_new = __heap_size_to_move(heap, ptr, &size_old) ? __heap_large_alloc(heap, size, __heap_alignment) : NULL;
+        if ( ptr_new != NULL ) {
+            memcpy(ptr_new, ptr, size_old < size ? size_old : size);
+            __heap_free_guarded(heap, ptr);
+        }
+    } else {
+        ptr_new = __heap_realloc_guarded(heap, ptr, size);
+    }
+
+    __alloctrace(heap_trace_realloc, heap, ptr, ptr_new, size);
+    __allocprofile(heap_trace_realloc, ptr, ptr_new, size);
+    return ptr_new;
+
+}
+
+void* heap_alloc_aligned(heap_t* heap, size_t size, size_t align) {
+
+    if ( align & (align - 1) || align > __heap_max_alignment ) { return NULL; }
+
+    void* ptr = __heap_is_large(size, align) ? __heap_large_alloc(heap, size, align) : __heap_alloc_aligned_guarded(heap, size, align);
+    __alloctrace(heap_trace_alloc, heap, NULL, ptr, size);
+    __allocprofile(heap_trace_alloc, NULL, ptr, size);
+    return ptr;
+}
+
+size_t heap_alloc_batch(heap_t* heap, size_t size, size_t count, void** ptrs) {
+
+    if ( __heap_is_large(size, __heap_alignment) ) {
+        size_t n = 0;
+        while ( n < count && (ptrs[n] = heap_alloc(heap, size)) != NULL ) { n++; }
+        return n;
+    }
+
+#ifdef allocator_hardened
+    if ( size > __heap_maximum_allocation_size ) { return 0; }
+    size_t size_alloc = size + __heap_guard_size + __heap_redzone_size;
+#else
+    size_t size_alloc = size;
+#endif
+
+    // batches always come from the shared heap
+    __heap_lock_acquire(heap);
+    size_t n = __heap_alloc_batch_shared(heap, size_alloc, count, ptrs);
+#ifdef allocator_thread_safe
+    for ( size_t i = 0; i < n; i++ ) { __heap_block_set_owner(heap, ptrs[i], 0, 0); }
+#endif
+    __heap_lock_release(heap);
+
+#ifdef allocator_hardened
+    for ( size_t i = 0; i < n; i++ ) { ptrs[i] = __heap_guard_place(heap, ptrs[i], size, __heap_guard_size); }
+#endif
+
+    for ( size_t i = 0; i < n; i++ ) {
+        __alloctrace(heap_trace_alloc, heap, NULL, ptrs[i], size);
+        __allocprofile(heap_trace_alloc, NULL, ptrs[i], size);
+    }
+    return n;
+}
+
+void heap_free_batch(heap_t* heap, void** ptrs, size_t count) {
+
+    for ( size_t i = 0; i < count; i++ ) {
+        __alloctrace(heap_trace_free, heap, ptrs[i], NULL, 0);
+        __allocprofile(heap_trace_free, ptrs[i], NULL, 0);
+    }
+
+    // large allocations are unmapped on their own
+    if ( allocator_v2_large_size ) {
+        size_t n = 0;
+        for ( size_t i = 0; i < count; i++ ) {
+            __heap_large_t* large = __heap_large_of(heap, ptrs[i]);
+            if ( large != NULL ) { __heap_large_free(heap, large); }
+            else { ptrs[n++] = ptrs[i]; }
+        }
+        count = n;
+    }
+
+#ifdef allocator_hardened
+    // every block goes through the checks and the quarantine on its own
+    for ( size_t i = 0; i < count; i++ ) { __heap_free_guarded(heap, ptrs[i]); }
+#else
+
+#ifdef allocator_thread_safe
+    // blocks of the thread caches go back to their cache one by one, the rest are freed together
+    size_t n_shared = 0;
+    for ( size_t i = 0; i < count; i++ ) {
+        void* user_ptr = ptrs[i];
+        if ( (char*)user_ptr < (char*)heap->base + __heap_block_header_size || (char*)user_ptr >= (char*)heap->top ) { continue; }
+        size_t owner = __heap_block_owner(heap, user_ptr);
+        if ( owner == 0 || owner > allocator_max_threads ) { ptrs[n_shared++] = user_ptr; }
+        else { __heap_free_cached(heap, user_ptr); }
+    }
+    count = n_shared;
+#endif
+
+    __heap_lock_acquire(heap);
+    __heap_free_batch_shared(heap, ptrs, count);
+    __heap_lock_release(heap);
+
+#endif
+
+}
+
+void __heap_free_unsampled(heap_t* heap, void* user_ptr) {
+    __heap_large_t* large = __heap_large_of(heap, user_ptr);
+    if ( large != NULL ) { __heap_large_free(heap, large); }
+    else { __heap_free_guarded(heap, user_ptr); }
+}
+
+#ifdef allocator_profile_enable
+// pointers the filter of the profiler knows about are looked up and freed out of line
+__attribute__((noinline, cold)) void __heap_free_sampled(heap_t* heap, void* user_ptr) {
+    if ( user_ptr != NULL ) { __heap_profile_forget(user_ptr); }
+    __heap_free_unsampled(heap, user_ptr);
+}
+#endif
+
+// frees are traced before the block can be handed out again, so an allocation that reuses it
+// always comes after the free in the trace
+void heap_free(heap_t* heap, void* user_ptr) {
+    __alloctrace(heap_trace_free, heap, user_ptr, NULL, 0);
+#ifdef allocator_profile_enable
+    if ( __allocprofile_followed(user_ptr) ) {
+        __heap_free_sampled(heap, user_ptr);
+        return;
+    }
+#endif
+    __heap_free_unsampled(heap, user_ptr);
+}
+
+size_t __heap_usable_size_shared(heap_t* heap, void* user_ptr) {
+
+    if ( __heap_slab_contains(heap, user_ptr) ) {
+        __heap_slab_page_t* page = __heap_slab_allocated_page(heap, user_ptr);
+        return page != NULL ? __heap_small_class_sizes[page->size_class] : 0;
+    }
+
+    __heap_sector_data_t* sector = __heap_sector_from_user_pointer(heap, user_ptr);
+    if ( sector == NULL || !sector->fields.allocated ) { return 0; }
+    return sector->fields.allocation_size - __heap_block_header_size;
+}
+
+size_t heap_usable_size(heap_t* heap, void* user_ptr) {
+
+    if ( user_ptr == NULL ) { return 0; }
+
+    __heap_large_t* large = __heap_large_of(heap, user_ptr);
+    if ( large != NULL ) { return large->size; }
+
+#ifdef allocator_hardened
+    // pointers that aren't blocks of the heap aren't misuse here, only overflows of its blocks
+    // are reported, and the redzone behind the requested size isn't usable
+    if ( !__heap_guard_owned(heap, user_ptr) ) { return 0; }
+    __heap_guard_t* guard = __heap_guard_validate(heap, user_ptr, "heap_usable_size");
+    return guard != NULL ? guard->size : 0;
+#else
+    __heap_lock_acquire(heap);
+    size_t size = __heap_usable_size_shared(heap, user_ptr);
+    __heap_lock_release(heap);
+    return size;
+#endif
+
+}
+
+// handle allocations start with the index of their handle, padded so the user data stays as
+// aligned as the block
+#define __heap_handle_prefix_size __heap_alignment
+
+// grows the handle table, returns 0 if the heap is full
+int __heap_handles_grow(heap_t* heap) {
+
+    size_t capacity = heap->handles_capacity ? heap->handles_capacity*2 : 64;
+    if ( capacity > UINT32_MAX >> 1 ) { return 0; }
+
+    // the table is a block of the sector table so it never moves while it is in use
+    uint32_t* handles = (uint32_t*)__heap_alloc_sector(heap, capacity*sizeof(uint32_t));
+    if ( handles == NULL ) { return 0; }
+
+    if ( heap->handles != NULL ) {
+        memcpy(handles, heap->handles, heap->handles_capacity*sizeof(uint32_t));
+        __heap_free_sector(heap, heap->handles);
+    }
+
+    for ( size_t i = heap->handles_capacity; i < capacity; i++ ) {
+        handles[i] = ((i + 1 < capacity ? i + 1 : heap->handles_unused) << 1) | 1;
+    }
+    heap->handles_unused = heap->handles_capacity;
+    heap->handles = handles;
+    heap->handles_capacity = capacity;
+
+    return 1;
+}
+
+// returns the table entry of a handle in use, or NULL
+uint32_t* __heap_handle_entry(heap_t* heap, heap_handle_t handle) {
+    if ( handle == 0 || handle > heap->handles_capacity ) { return NULL; }
+    uint32_t* entry = &heap->handles[handle - 1];
+    return *entry & 1 ? NULL : entry;
+}
+
+// returns the table entry of the handle whose block starts at offset, or NULL if the block isn't
+// a handle allocation, the entry has to point back at the block so user data can't pass for one
+uint32_t* __heap_handle_of_block(heap_t* heap, size_t offset) {
+    uint32_t idx = *(uint32_t*)((char*)heap->base + offset + __heap_block_header_size);
+    return idx < heap->handles_capacity && heap->handles[idx] == offset ? &heap->handles[idx] : NULL;
+}
+
+heap_handle_t heap_alloc_handle(heap_t* heap, size_t size) {
+
+    if ( size > __heap_maximum_allocation_size - __heap_handle_prefix_size ) { return 0; }
+
+    __heap_lock_acquire(heap);
+
+    // handle allocations always come from the sector table, slab objects can't move
+    char* ptr = NULL;
+    if ( heap->handles_unused != __heap_handles_end || __heap_handles_grow(heap) ) {
+        ptr = (char*)__heap_alloc_sector(heap, size + __heap_handle_prefix_size);
+    }
+
+    if ( ptr == NULL ) {
+        __heap_lock_release(heap);
+        return 0;
+    }
+
+#ifdef allocator_thread_safe
+    __heap_block_set_owner(heap, ptr, 0, 0);
+#endif
+
+    uint32_t idx = heap->handles_unused;
+    heap->handles_unused = heap->handles[idx] >> 1;
+    heap->handles[idx] = ptr - (char*)heap->base - __heap_block_header_size;
+    *(uint32_t*)ptr = idx;
+
+    __heap_lock_release(heap);
+
+    return idx + 1;
+}
+
+void* heap_handle_deref(heap_t* heap, heap_handle_t handle) {
+    __heap_lock_acquire(heap);
+    uint32_t* entry = __heap_handle_entry(heap, handle);
+    void* ptr = entry != NULL ? (char*)heap->base + *entry + __heap_block_header_size + __heap_handle_prefix_size : NULL;
+    __heap_lock_release(heap);
+    return ptr;
+}
+
+void heap_free_handle(heap_t* heap, heap_handle_t handle) {
+
+    __heap_lock_acquire(heap);
+
+    uint32_t* entry = __heap_handle_entry(heap, handle);
+    if ( entry != NULL ) {
+        __heap_free_sector(heap, (char*)heap->base + *entry + __heap_block_header_size);
+        *entry = (heap->handles_unused << 1) | 1;
+        heap->handles_unused = handle - 1;
+    }
+
+    __heap_lock_release(heap);
+
+}
+
+size_t heap_compact(heap_t* heap) {
+
+    __allocdebugprintf("compact init:\n");
+
+    __heap_lock_acquire(heap);
+
+    size_t n_moved = 0;
+
+    // the free block right before the current one
+    __heap_sector_data_t* sector_free = NULL;
+    size_t offset_free = 0;
+
+    __heap_sector_data_t* sector_cur = heap->handles != NULL ? __heap_sector_first(heap) : NULL;
+    size_t offset = 0;
+
+    while ( sector_cur != NULL ) {
+
+        uint32_t* entry = NULL;
+        if ( !sector_cur->fields.allocated ) {
+            sector_free = sector_cur;
+            offset_free = offset;
+        } else if ( sector_free != NULL && (entry = __heap_handle_of_block(heap, offset)) != NULL ) {
+
+            // the block moves down and the free space it leaves behind merges with whatever free
+            // space follows it
+            __allocdebugprintf("\tmoving handle %u from %zu to %zu\n", *(uint32_t*)((char*)heap->base + offset + __heap_block_header_size) + 1, offset, offset_free);
+            size_t size = sector_cur->fields.allocation_size;
+            __heap_free_list_remove(heap, sector_free, offset_free);
+            __heap_sector_data_t* sector_left = __heap_sector_swap(heap, sector_free, offset_free, sector_cur, offset);
+            __heap_sector_data_t* sector_moved = sector_left == sector_cur ? sector_free : sector_cur;
+            *entry = offset_free;
+            __heap_release_sector(heap, sector_left, offset_free + size);
+            n_moved++;
+
+            sector_cur = sector_moved;
+            offset = offset_free;
+            sector_free = NULL;
+
+        } else {
+            sector_free = NULL;
+        }
+
+        __heap_sector_data_t* sector_next = __heap_sector_next(heap, sector_cur, offset);
+        offset += sector_cur->fields.allocation_size;
+        sector_cur = sector_next;
+
+    }
+
+#ifdef allocator_v2_compact_metadata
+    // one whole pass of the empty sector removal from the start of the table, after the merges
+    // of the moves have left their empty sectors behind
+    heap->compact_cursor = 0;
+    heap->compact_hole_end = 0;
+    heap->compact_offset = 0;
+    while ( !__remove_empty_chunks(heap, SIZE_MAX) ) {}
+    __heap_release_unused(heap);
+#endif
+
+    __heap_lock_release(heap);
+
+    __allocdebugprintf("\tmoved %zu allocations\n", n_moved);
+
+    return n_moved;
+}
+
+void heap_print(heap_t* heap) {
+
+    __heap_lock_acquire(heap);
+
+    __heap_sector_data_t* sector_cur = __heap_sector_first(heap);
+    size_t offset = 0;
+    int sector_idx = 0;
+
+    while ( sector_cur != NULL ) {
+        printf("sector %i:\n", sector_idx);
+        printf("\tsize: %i\n", sector_cur->fields.allocation_size);
+        printf("\tallocated: %i\n", sector_cur->fields.allocated);
+        __heap_sector_data_t* sector_next = __heap_sector_next(heap, sector_cur, offset);
+        offset += sector_cur->fields.allocation_size;
+        sector_cur = sector_next;
+        sector_idx++;
+    }
+
+    for ( __heap_large_t* large = heap->large; large != NULL; large = large->next ) {
+        printf("large allocation at %p:\n", (void*)((char*)large + __heap_large_header_size));
+        printf("\tsize: %zu\n", large->size);
+    }
+
+    __heap_lock_release(heap);
+
+}
+
+// returns the call site the profiler recorded for the allocation of a block, blocks that were
+// aligned past their start aren't found
+uint64_t __heap_snapshot_site(void* ptr) {
+#ifdef allocator_profile_enable
+#ifdef allocator_hardened
+    ptr = (char*)ptr + __heap_guard_size;
+#endif
+    return heap_profile_site(ptr);
+#else
+    (void)ptr;
+    return 0;
+#endif
+}
+
+// writes the pages of the slab arena, which is a block of the heap of its own
+void __heap_snapshot_write_slab(heap_t* heap, FILE* file, uint64_t* n_blocks) {
+    for ( size_t i = 0; i < heap->slab_n_pages; i++ ) {
+        heap_snapshot_block_t block;
+        memset(&block, 0, sizeof(block));
+        block.offset = heap->slab_base + i*__heap_slab_page_size - (char*)heap->base;
+        block.size = __heap_slab_page_size;
+        block.state = heap_snapshot_slab;
+        if ( i < heap->slab_page_bump ) {
+            __heap_slab_page_t* page = __heap_slab_page_at(heap, i);
+            block.object_size = __heap_small_class_sizes[page->size_class];
+            block.n_objects = page->n_objects;
+            block.n_used = page->n_objects - page->n_free;
+        }
+        fwrite(&block, sizeof(block), 1, file);
+        (*n_blocks)++;
+    }
+}
+
+int heap_snapshot_write(heap_t* heap, const char* path) {
+
+    FILE* file = fopen(path, "wb");
+    if ( file == NULL ) { return 0; }
+
+    heap_snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, heap_snapshot_file_magic, 4);
+    header.version = heap_snapshot_file_version;
+    header.block_size = sizeof(heap_snapshot_block_t);
+    header.allocator = 2;
+
+    // the header is written again once the blocks are counted
+    fwrite(&header, sizeof(header), 1, file);
+
+    __heap_lock_acquire(heap);
+
+    header.heap_size = heap->max_size;
+    header.data_bytes = heap->used_bytes;
+    header.metadata_bytes = heap->sector_count*sizeof(__heap_sector_data_t);
+
+    __heap_sector_data_t* sector = __heap_sector_first(heap);
+    size_t offset = 0;
+    while ( sector != NULL ) {
+        size_t size = sector->fields.allocation_size;
+        if ( heap->slab_base != NULL && heap->slab_base >= (char*)heap->base + offset && heap->slab_base < (char*)heap->base + offset + size ) {
+            __heap_snapshot_write_slab(heap, file, &header.n_blocks);
+        } else if ( size ) {
+            heap_snapshot_block_t block;
+            memset(&block, 0, sizeof(block));
+            block.offset = offset;
+            block.size = size;
+            block.state = sector->fields.allocated ? heap_snapshot_allocated : heap_snapshot_free;
+            if ( sector->fields.allocated ) { block.site = __heap_snapshot_site((char*)heap->base + offset + __heap_block_header_size); }
+            fwrite(&block, sizeof(block), 1, file);
+            header.n_blocks++;
+        }
+        __heap_sector_data_t* sector_next = __heap_sector_next(heap, sector, offset);
+        offset += size;
+        sector = sector_next;
+    }
+
+    for ( __heap_large_t* large = heap->large; large != NULL; large = large->next ) {
+        heap_snapshot_block_t block;
+        memset(&block, 0, sizeof(block));
+        block.offset = (uintptr_t)large + __heap_large_header_size;
+        block.size = large->size;
+        block.state = heap_snapshot_large;
+        block.site = __heap_snapshot_site((char*)large + __heap_large_header_size);
+        fwrite(&block, sizeof(block), 1, file);
+        header.n_blocks++;
+    }
+
+    __heap_lock_release(heap);
+
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    int ok = !ferror(file);
+    return !fclose(file) && ok;
+}
+
+void memalloc_init(void* heap_base, size_t heap_size) {
+    if ( __heap_default != NULL ) { heap_destroy(__heap_default); }
+    __heap_default = &__heap_default_storage;
+    heap_init(__heap_default, heap_base, heap_size);
+}
+
+void memalloc_init_placement(void* heap_base, size_t heap_size, uint32_t placement) {
+    memalloc_init(heap_base, heap_size);
+    heap_set_placement(__heap_default, placement);
+}
+
+int memalloc_init_reserved(size_t size) {
+    if ( __heap_default != NULL ) { heap_destroy(__heap_default); }
+    __heap_default = heap_create_reserved(size);
+    return __heap_default != NULL;
+}
+
+heap_t* memalloc_heap() {
+    return __heap_default;
+}
+
+void* memalloc(size_t size) {
+    return heap_alloc(__heap_default, size);
+}
+
+void* memalloc_aligned(size_t size, size_t align) {
+    return heap_alloc_aligned(__heap_default, size, align);
+}
+
+size_t memalloc_batch(size_t size, size_t count, void** ptrs) {
+    return heap_alloc_batch(__heap_default, size, count, ptrs);
+}
+
+void memfree_batch(void** ptrs, size_t count) {
+    heap_free_batch(__heap_default, ptrs, count);
+}
+
+void* memrealloc(void* ptr, size_t size) {
+    return heap_realloc(__heap_default, ptr, size);
+}
+
+void memfree(void* user_ptr) {
+    heap_free(__heap_default, user_ptr);
+}
+
+size_t memusable_size(void* user_ptr) {
+    return heap_usable_size(__heap_default, user_ptr);
+}
+
+void memprint() {
+    heap_print(__heap_default);
+}
+
+int memsnapshot(const char* path) {
+    return heap_snapshot_write(__heap_default, path);
+}
+
+heap_handle_t memalloc_handle(size_t size) {
+    return heap_alloc_handle(__heap_default, size);
+}
+
+void* handle_deref(heap_handle_t handle) {
+    return heap_handle_deref(__heap_default, handle);
+}
+
+void memfree_handle(heap_handle_t handle) {
+    heap_free_handle(__heap_default, handle);
+}
+
+size_t memcompact() {
+    return heap_compact(__heap_default);
+}
+
+#endif // allocator_v2_implementation
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "allocator_region.h"
+
+#endif
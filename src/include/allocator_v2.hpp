@@ -0,0 +1,131 @@
+#ifndef ALLOC_V2_HPP
+#define ALLOC_V2_HPP
+
+// C++ front end of allocator_v2.h, an allocator for the standard containers and a
+// std::pmr::memory_resource over a heap:
+//
+//   std::vector<int, allocator_v2::heap_allocator<int>> numbers(allocator_v2::heap_allocator<int>(heap));
+//
+//   allocator_v2::heap_resource resource(heap);
+//   std::pmr::unordered_map<std::pmr::string, int> counts(&resource);
+//
+// this header can be included from any number of source files, exactly one source file of the
+// program defines allocator_v2_implementation before including it or allocator_v2.h, which can be
+// a C++ file as well as a C file since the C header is declared with C linkage, C++17 is needed
+//
+// requests of up to __heap_small_max_size bytes at no more than the default alignment come from
+// the slab pages of the heap, so the nodes of lists, maps and sets don't search the free lists
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+#if __has_include(<memory_resource>)
+    #include <memory_resource>
+#endif
+
+#include "allocator_v2.h"
+
+namespace allocator_v2 {
+
+// allocates size bytes at align from heap, throws std::bad_alloc if the heap is full or the
+// alignment is above __heap_max_alignment
+inline void* allocate(heap_t* heap, std::size_t size, std::size_t align) {
+    // the heaps don't hand out empty blocks
+    if ( size == 0 ) { size = 1; }
+    void* ptr = align <= __heap_alignment ? heap_alloc(heap, size) : heap_alloc_aligned(heap, size, align);
+    if ( ptr == nullptr ) { throw std::bad_alloc(); }
+    return ptr;
+}
+
+// allocator of the standard library over a heap, which defaults to the heap memalloc_init set
+// up, copies allocate from the same heap and compare equal
+template <typename T>
+class heap_allocator {
+public:
+
+    typedef T value_type;
+
+    // containers that move or swap take their allocator with them, so their memory keeps going
+    // back to the heap it came from
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
+
+    heap_allocator() noexcept : heap(memalloc_heap()) {}
+    explicit heap_allocator(heap_t* heap) noexcept : heap(heap) {}
+
+    template <typename U>
+    heap_allocator(const heap_allocator<U>& other) noexcept : heap(other.get_heap()) {}
+
+    T* allocate(std::size_t n) {
+        if ( n > SIZE_MAX/sizeof(T) ) { throw std::bad_array_new_length(); }
+        return static_cast<T*>(allocator_v2::allocate(heap, n*sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t) noexcept {
+        heap_free(heap, ptr);
+    }
+
+    heap_t* get_heap() const noexcept {
+        return heap;
+    }
+
+private:
+
+    heap_t* heap;
+
+};
+
+template <typename T, typename U>
+bool operator==(const heap_allocator<T>& a, const heap_allocator<U>& b) noexcept {
+    return a.get_heap() == b.get_heap();
+}
+
+template <typename T, typename U>
+bool operator!=(const heap_allocator<T>& a, const heap_allocator<U>& b) noexcept {
+    return a.get_heap() != b.get_heap();
+}
+
+#ifdef __cpp_lib_memory_resource
+
+// memory resource over a heap for the std::pmr containers, the heap isn't destroyed with it
+class heap_resource : public std::pmr::memory_resource {
+public:
+
+    heap_resource() noexcept : heap(memalloc_heap()) {}
+    explicit heap_resource(heap_t* heap) noexcept : heap(heap) {}
+
+    heap_t* get_heap() const noexcept {
+        return heap;
+    }
+
+protected:
+
+    void* do_allocate(std::size_t size, std::size_t align) override {
+        return allocator_v2::allocate(heap, size, align);
+    }
+
+    void do_deallocate(void* ptr, std::size_t, std::size_t) override {
+        heap_free(heap, ptr);
+    }
+
+    // resources over the same heap can free each other's memory
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        const heap_resource* resource = dynamic_cast<const heap_resource*>(&other);
+        return resource != nullptr && resource->heap == heap;
+    }
+
+private:
+
+    heap_t* heap;
+
+};
+
+#endif
+
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#define allocator_v2_implementation
 #include "include/allocator_v2.h"
 
 int main() {
@@ -8,6 +9,12 @@ int main() {
 
     memalloc_init(hbase, 2048);
 
+#ifdef allocator_trace_enable
+    // trace builds write every call to the file in ALLOCATOR_TRACE_FILE for bench_replay
+    const char* trace_path = getenv("ALLOCATOR_TRACE_FILE");
+    if ( trace_path != NULL ) { heap_trace_record_start(trace_path); }
+#endif
+
     char* test0_ptr = (char*)memalloc(100);
     char* test1_ptr = (char*)memalloc(300);
     char* test2_ptr = (char*)memalloc(100);
@@ -20,6 +27,17 @@ int main() {
 
     memprint();
 
+#ifdef allocator_trace_enable
+    // trace builds show the calls that led up to the heap above
+    heap_trace_event_t events[16];
+    size_t n_events = heap_trace_read(events, 16);
+    for ( size_t i = 0; i < n_events; i++ ) {
+        const char* names[] = { "", "alloc", "realloc", "free" };
+        printf("%s %p %p %u\n", names[events[i].type], (void*)(uintptr_t)events[i].ptr, (void*)(uintptr_t)events[i].ptr_result, events[i].size);
+    }
+    if ( trace_path != NULL ) { heap_trace_record_stop(); }
+#endif
+
     free(hbase);
 
 
@@ -0,0 +1,243 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define allocator_v2_implementation
+#include "allocator_v2.h"
+
+// shared library that replaces malloc and friends with the thread safe v2 allocator, so existing
+// programs can run on it unchanged:
+//
+//   LD_PRELOAD=build/liballocator_preload.so program
+//
+// every allocation comes from one reserved heap of ALLOCATOR_PRELOAD_HEAP_SIZE bytes (4 GiB by
+// default), which only takes up memory for the pages it has committed, apart from allocations of
+// allocator_v2_large_size bytes or more, which get mappings of their own, allocations made while
+// that heap is set up come from a small bootstrap heap in static memory
+//
+// alignments above __heap_max_alignment fail with ENOMEM
+//
+// built with allocator_profile_enable the library samples allocations as allocator_profile.h
+// describes and writes the profile to ALLOCATOR_PROFILE_FILE when the program exits, in the
+// format ALLOCATOR_PROFILE_FORMAT names, pprof (the default), folded_live or folded_alloc
+
+#ifndef allocator_thread_safe
+    #error "the preload library needs allocator_thread_safe"
+#endif
+
+#define preload_export __attribute__((visibility("default")))
+
+#define preload_bootstrap_size (1u<<20)
+#define preload_default_heap_size ((size_t)UINT32_MAX)
+
+_Alignas(4096) char preload_bootstrap_region[preload_bootstrap_size];
+heap_t* preload_bootstrap_heap = NULL;
+
+_Atomic(heap_t*) preload_heap = NULL;
+
+// 0 before the first call, 1 while the heaps are set up and 2 once they are ready
+_Atomic int preload_state = 0;
+
+// set on the thread that sets up the heaps, whose own allocations go to the bootstrap heap
+_Thread_local int preload_initializing = 0;
+
+// set if allocations made while the heaps were set up got mappings of their own, which are
+// outside of the bootstrap region but still have to go back to the bootstrap heap
+_Atomic int preload_bootstrap_large = 0;
+
+// a fork in the middle of an allocation would leave the heap locks held in the child
+void preload_fork_prepare() {
+    heap_t* heap = atomic_load(&preload_heap);
+    pthread_mutex_lock(&__heap_registry_lock);
+    __heap_lock_acquire(preload_bootstrap_heap);
+    if ( heap != preload_bootstrap_heap ) { __heap_lock_acquire(heap); }
+#ifdef allocator_profile_enable
+    __heap_profile_lock_acquire();
+#endif
+}
+
+void preload_fork_release() {
+    heap_t* heap = atomic_load(&preload_heap);
+#ifdef allocator_profile_enable
+    __heap_profile_lock_release();
+#endif
+    if ( heap != preload_bootstrap_heap ) { __heap_lock_release(heap); }
+    __heap_lock_release(preload_bootstrap_heap);
+    pthread_mutex_unlock(&__heap_registry_lock);
+}
+
+#ifdef allocator_profile_enable
+
+const char* preload_profile_path = NULL;
+int preload_profile_format = heap_profile_pprof;
+
+void preload_profile_write() {
+    heap_profile_write(preload_profile_path, preload_profile_format);
+}
+
+void preload_profile_init() {
+    preload_profile_path = getenv("ALLOCATOR_PROFILE_FILE");
+    if ( preload_profile_path == NULL ) { return; }
+    const char* format = getenv("ALLOCATOR_PROFILE_FORMAT");
+    if ( format != NULL && !strcmp(format, "folded_live") ) { preload_profile_format = heap_profile_folded_live; }
+    if ( format != NULL && !strcmp(format, "folded_alloc") ) { preload_profile_format = heap_profile_folded_alloc; }
+    atexit(preload_profile_write);
+}
+
+#endif
+
+size_t preload_heap_size() {
+    const char* value = getenv("ALLOCATOR_PRELOAD_HEAP_SIZE");
+    size_t size = value != NULL ? strtoull(value, NULL, 10) : 0;
+    return size ? size : preload_default_heap_size;
+}
+
+void preload_init() {
+
+    preload_initializing = 1;
+    preload_bootstrap_heap = heap_create(preload_bootstrap_region, preload_bootstrap_size);
+
+    // without address space to reserve the bootstrap heap is all there is
+    heap_t* heap = heap_create_reserved(preload_heap_size());
+    atomic_store_explicit(&preload_heap, heap != NULL ? heap : preload_bootstrap_heap, memory_order_release);
+
+    pthread_atfork(preload_fork_prepare, preload_fork_release, preload_fork_release);
+#ifdef allocator_profile_enable
+    preload_profile_init();
+#endif
+
+    atomic_store_explicit(&preload_bootstrap_large, preload_bootstrap_heap->n_large != 0, memory_order_relaxed);
+    preload_initializing = 0;
+    atomic_store_explicit(&preload_state, 2, memory_order_release);
+
+}
+
+// returns the heap new allocations come from
+heap_t* preload_heap_get() {
+
+    if ( preload_initializing ) { return preload_bootstrap_heap; }
+    heap_t* heap = atomic_load_explicit(&preload_heap, memory_order_acquire);
+    if ( heap != NULL ) { return heap; }
+
+    int state = 0;
+    if ( atomic_compare_exchange_strong(&preload_state, &state, 1) ) {
+        preload_init();
+    } else {
+        while ( atomic_load_explicit(&preload_state, memory_order_acquire) != 2 ) { sched_yield(); }
+    }
+
+    return atomic_load_explicit(&preload_heap, memory_order_acquire);
+}
+
+// returns the heap ptr was allocated from, or NULL if it wasn't allocated by this library
+heap_t* preload_heap_of(void* ptr) {
+    if ( (char*)ptr >= preload_bootstrap_region && (char*)ptr < preload_bootstrap_region + preload_bootstrap_size ) { return preload_bootstrap_heap; }
+    if ( (preload_initializing || atomic_load_explicit(&preload_bootstrap_large, memory_order_relaxed)) && __heap_large_of(preload_bootstrap_heap, ptr) != NULL ) {
+        return preload_bootstrap_heap;
+    }
+    return atomic_load_explicit(&preload_heap, memory_order_acquire);
+}
+
+void* preload_alloc_aligned(size_t align, size_t size) {
+    if ( align > __heap_max_alignment ) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void* ptr = heap_alloc_aligned(preload_heap_get(), size ? size : 1, align);
+    if ( ptr == NULL ) { errno = ENOMEM; }
+    return ptr;
+}
+
+preload_export void* malloc(size_t size) {
+    void* ptr = heap_alloc(preload_heap_get(), size ? size : 1);
+    if ( ptr == NULL ) { errno = ENOMEM; }
+    return ptr;
+}
+
+preload_export void free(void* ptr) {
+    if ( ptr == NULL ) { return; }
+    heap_t* heap = preload_heap_of(ptr);
+    if ( heap != NULL ) { heap_free(heap, ptr); }
+}
+
+preload_export void* calloc(size_t count, size_t size) {
+    if ( size && count > SIZE_MAX/size ) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t bytes = count*size;
+    // not through malloc, since the compiler turns a malloc followed by a memset into a call to calloc
+    void* ptr = heap_alloc(preload_heap_get(), bytes ? bytes : 1);
+    if ( ptr == NULL ) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(ptr, 0, bytes);
+    return ptr;
+}
+
+preload_export void* realloc(void* ptr, size_t size) {
+
+    if ( ptr == NULL ) { return malloc(size); }
+    if ( size == 0 ) {
+        free(ptr);
+        return NULL;
+    }
+
+    heap_t* heap = preload_heap_of(ptr);
+    heap_t* heap_new = preload_heap_get();
+
+    void* ptr_new;
+    if ( heap == heap_new ) {
+        ptr_new = heap_realloc(heap, ptr, size);
+    } else {
+        // blocks of the bootstrap heap move to the main heap once it is ready
+        ptr_new = heap_alloc(heap_new, size);
+        if ( ptr_new != NULL ) {
+            size_t size_old = heap_usable_size(heap, ptr);
+            memcpy(ptr_new, ptr, size_old < size ? size_old : size);
+            heap_free(heap, ptr);
+        }
+    }
+
+    if ( ptr_new == NULL ) { errno = ENOMEM; }
+    return ptr_new;
+}
+
+preload_export int posix_memalign(void** ptr_out, size_t align, size_t size) {
+    if ( align & (align - 1) || align % sizeof(void*) ) { return EINVAL; }
+    void* ptr = preload_alloc_aligned(align, size);
+    if ( ptr == NULL ) { return ENOMEM; }
+    *ptr_out = ptr;
+    return 0;
+}
+
+preload_export void* aligned_alloc(size_t align, size_t size) {
+    if ( align & (align - 1) ) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return preload_alloc_aligned(align, size);
+}
+
+preload_export void* memalign(size_t align, size_t size) {
+    return aligned_alloc(align, size);
+}
+
+preload_export void* valloc(size_t size) {
+    return preload_alloc_aligned(__heap_max_alignment, size);
+}
+
+preload_export void* pvalloc(size_t size) {
+    return preload_alloc_aligned(__heap_max_alignment, (size + __heap_max_alignment - 1) & ~(size_t)(__heap_max_alignment - 1));
+}
+
+preload_export size_t malloc_usable_size(void* ptr) {
+    if ( ptr == NULL ) { return 0; }
+    heap_t* heap = preload_heap_of(ptr);
+    return heap != NULL ? heap_usable_size(heap, ptr) : 0;
+}
@@ -0,0 +1,89 @@
+#ifndef TEST_H
+#define TEST_H
+
+// checks shared by the tests in this directory, a failed check prints where it failed and exits
+// with 1 so make test stops at the first broken test, included after the allocator header
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "allocator_snapshot.h"
+
+#define test_check(cond) do { \
+    if ( !(cond) ) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while ( 0 )
+
+uint64_t test_rand(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// fills a block with a pattern that starts at seed, so overlapping blocks and contents lost by
+// realloc show up in test_verify
+void test_fill(void* ptr, size_t size, unsigned char seed) {
+    for ( size_t i = 0; i < size; i++ ) { ((unsigned char*)ptr)[i] = (unsigned char)(seed + i); }
+}
+
+int test_verify(const void* ptr, size_t size, unsigned char seed) {
+    for ( size_t i = 0; i < size; i++ ) {
+        if ( ((const unsigned char*)ptr)[i] != (unsigned char)(seed + i) ) { return 0; }
+    }
+    return 1;
+}
+
+// writes a snapshot of heap and reads it back, checks the header and that the blocks inside the
+// region are in address order up to data_bytes, returns the blocks, which the caller frees
+heap_snapshot_block_t* test_snapshot(heap_t* heap, heap_snapshot_header_t* header) {
+
+    char path[] = "/tmp/test_snapshot_XXXXXX";
+    int fd = mkstemp(path);
+    test_check(fd >= 0);
+    close(fd);
+    test_check(heap_snapshot_write(heap, path));
+
+    FILE* file = fopen(path, "rb");
+    test_check(file != NULL);
+    test_check(fread(header, sizeof(*header), 1, file) == 1);
+    test_check(memcmp(header->magic, heap_snapshot_file_magic, 4) == 0);
+    test_check(header->version == heap_snapshot_file_version);
+    test_check(header->block_size == sizeof(heap_snapshot_block_t));
+    heap_snapshot_block_t* blocks = (heap_snapshot_block_t*)malloc(header->n_blocks*sizeof(heap_snapshot_block_t) + 1);
+    test_check(blocks != NULL);
+    test_check(fread(blocks, sizeof(heap_snapshot_block_t), header->n_blocks, file) == header->n_blocks);
+    fclose(file);
+    unlink(path);
+
+    // the pages of the v2 slab arena leave out the header and the alignment of its block, so
+    // there can be gaps around them
+    uint64_t end = 0;
+    for ( uint64_t i = 0; i < header->n_blocks; i++ ) {
+        if ( blocks[i].state == heap_snapshot_large ) { continue; }
+        test_check(blocks[i].offset >= end);
+        test_check(blocks[i].size > 0);
+        end = blocks[i].offset + blocks[i].size;
+    }
+    test_check(end <= header->data_bytes);
+    test_check(header->data_bytes <= header->heap_size);
+
+    return blocks;
+
+}
+
+// returns the block of a snapshot that holds the address at offset from the heap base, or NULL
+heap_snapshot_block_t* test_snapshot_block(heap_snapshot_block_t* blocks, heap_snapshot_header_t* header, uint64_t offset) {
+    for ( uint64_t i = 0; i < header->n_blocks; i++ ) {
+        if ( blocks[i].state == heap_snapshot_large ) { continue; }
+        if ( offset >= blocks[i].offset && offset < blocks[i].offset + blocks[i].size ) { return &blocks[i]; }
+    }
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,148 @@
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#define allocator_v2_implementation
+#include "allocator_v2.hpp"
+
+#include "test.h"
+
+// tests of allocator_v2.hpp: standard containers over heap_allocator and std::pmr containers over
+// heap_resource keep their elements in the heap they were given and give all of it back, a full
+// heap and alignments it can't serve throw, make test builds it as C++17
+
+#define test_heap_size (16u<<20)
+
+size_t test_live_blocks(heap_t* heap) {
+    heap_stats_t stats;
+    heap_stats(heap, &stats);
+    return stats.live_blocks;
+}
+
+void test_allocator(heap_t* heap, heap_t* heap_other) {
+
+    {
+        std::vector<int, allocator_v2::heap_allocator<int>> numbers{allocator_v2::heap_allocator<int>(heap)};
+        for ( int i = 0; i < 100000; i++ ) { numbers.push_back(i); }
+        for ( int i = 0; i < 100000; i++ ) { test_check(numbers[i] == i); }
+
+        // the nodes of the list and the map come from the slab pages
+        typedef std::map<int, int, std::less<int>, allocator_v2::heap_allocator<std::pair<const int, int>>> test_map_t;
+        test_map_t squares{allocator_v2::heap_allocator<std::pair<const int, int>>(heap)};
+        std::list<int, allocator_v2::heap_allocator<int>> odd{allocator_v2::heap_allocator<int>(heap)};
+        for ( int i = 0; i < 10000; i++ ) {
+            squares[i] = i*i;
+            if ( i & 1 ) { odd.push_back(i); }
+        }
+        test_check(squares.size() == 10000 && odd.size() == 5000);
+        for ( int i = 0; i < 10000; i++ ) { test_check(squares.at(i) == i*i); }
+        test_check(test_live_blocks(heap) >= 15000);
+
+        // moving the map takes its allocator along, so the nodes still go back to heap
+        test_map_t moved{allocator_v2::heap_allocator<std::pair<const int, int>>(heap_other)};
+        moved = std::move(squares);
+        test_check(moved.get_allocator().get_heap() == heap);
+        test_check(test_live_blocks(heap_other) == 0);
+    }
+    test_check(test_live_blocks(heap) == 0);
+
+    allocator_v2::heap_allocator<int> a(heap);
+    allocator_v2::heap_allocator<double> b(a);
+    test_check(a == b && b.get_heap() == heap);
+    test_check(a != allocator_v2::heap_allocator<int>(heap_other));
+
+    bool thrown = false;
+    try { a.allocate(SIZE_MAX/sizeof(int) + 1); } catch ( const std::bad_array_new_length& ) { thrown = true; }
+    test_check(thrown);
+
+    // a heap that fills up throws, and takes everything back once the list is gone
+    thrown = false;
+    {
+        std::list<std::vector<char>, allocator_v2::heap_allocator<std::vector<char>>> chunks{allocator_v2::heap_allocator<std::vector<char>>(heap_other)};
+        try {
+            while ( 1 ) { chunks.emplace_back(4000, 'x'); chunks.back().shrink_to_fit(); }
+        } catch ( const std::bad_alloc& ) {
+            thrown = true;
+        }
+        test_check(chunks.size() > 100);
+        chunks.clear();
+    }
+    test_check(thrown);
+    test_check(test_live_blocks(heap_other) == 0);
+
+}
+
+#ifdef __cpp_lib_memory_resource
+
+void test_resource(heap_t* heap, heap_t* heap_other) {
+
+    allocator_v2::heap_resource resource(heap);
+    {
+        // strings longer than the small string buffer allocate from the resource too
+        std::pmr::map<std::pmr::string, std::pmr::vector<int>> lists(&resource);
+        for ( int i = 0; i < 2000; i++ ) {
+            std::pmr::string key("a key long enough to need memory of its own ", &resource);
+            key += std::to_string(i);
+            lists[key].assign(i % 64, i);
+        }
+        test_check(lists.size() == 2000);
+        for ( const auto& entry : lists ) {
+            test_check(entry.first.get_allocator().resource() == &resource);
+            int i = std::stoi(std::string(entry.first.substr(entry.first.rfind(' ') + 1)));
+            test_check(entry.second.size() == (size_t)(i % 64));
+            for ( int value : entry.second ) { test_check(value == i); }
+        }
+        test_check(test_live_blocks(heap) >= 2000);
+    }
+    test_check(test_live_blocks(heap) == 0);
+
+    void* ptr = resource.allocate(100, 256);
+    test_check((uintptr_t)ptr % 256 == 0);
+    resource.deallocate(ptr, 100, 256);
+
+    bool thrown = false;
+    try { ptr = resource.allocate(64, 2*__heap_max_alignment); } catch ( const std::bad_alloc& ) { thrown = true; }
+    test_check(thrown);
+
+    allocator_v2::heap_resource resource_same(heap);
+    allocator_v2::heap_resource resource_other(heap_other);
+    test_check(resource == resource_same);
+    test_check(resource != resource_other);
+    test_check(resource != *std::pmr::new_delete_resource());
+    test_check(test_live_blocks(heap) == 0);
+
+}
+
+#endif
+
+int main() {
+
+    void* region = malloc(test_heap_size);
+    void* region_other = malloc(1u<<20);
+    heap_t* heap = heap_create(region, test_heap_size);
+    heap_t* heap_other = heap_create(region_other, 1u<<20);
+    test_check(heap != NULL && heap_other != NULL);
+
+    test_allocator(heap, heap_other);
+#ifdef __cpp_lib_memory_resource
+    test_resource(heap, heap_other);
+#endif
+
+    // the default constructors take the heap of memalloc_init
+    void* region_default = malloc(1u<<20);
+    memalloc_init(region_default, 1u<<20);
+    test_check(allocator_v2::heap_allocator<int>().get_heap() == memalloc_heap());
+#ifdef __cpp_lib_memory_resource
+    test_check(allocator_v2::heap_resource().get_heap() == memalloc_heap());
+#endif
+
+    heap_destroy(heap);
+    heap_destroy(heap_other);
+    free(region);
+    free(region_other);
+    free(region_default);
+    printf("test_pmr: ok\n");
+    return 0;
+
+}
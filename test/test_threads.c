@@ -0,0 +1,295 @@
+#include <pthread.h>
+#include <string.h>
+
+// the 1 MiB allocation of test_orphaned_frees has to come from the heap, not from a mapping of
+// its own
+#define allocator_v2_large_size 0
+
+#define allocator_v2_implementation
+#include "allocator_v2.h"
+
+#include "test.h"
+
+// tests of the thread caches of the thread safe heap: frees of blocks whose owner has exited,
+// the limit on blocks drained from the remote free lists and a multi threaded stress with
+// blocks handed between threads and freed in batches, make test builds it with
+// allocator_thread_safe
+
+#define test_stress_threads 8
+#define test_stress_ops 200000
+#define test_stress_slots 512
+#define test_exchange_slots 1024
+
+// the main thread only frees, so it has no cache unless the hardened heap gives it one for its
+// quarantine, then it may still hold blocks at the end of a test
+#ifdef allocator_hardened
+    #define test_held_blocks (allocator_hardened_quarantine + __heap_small_n_classes*__heap_cache_limit)
+#else
+    #define test_held_blocks 0
+#endif
+
+typedef struct {
+    heap_t* heap;
+    void** ptrs;
+    size_t count;
+    size_t size;
+} test_alloc_job_t;
+
+// allocates up to count blocks and leaves the number it got in count
+void* test_alloc_thread(void* arg) {
+    test_alloc_job_t* job = (test_alloc_job_t*)arg;
+    for ( size_t i = 0; i < job->count; i++ ) {
+        job->ptrs[i] = heap_alloc(job->heap, job->size);
+        if ( job->ptrs[i] == NULL ) { job->count = i; }
+    }
+    return NULL;
+}
+
+// a thread fills most of a heap with small blocks and exits, the blocks are freed afterwards by
+// another thread and have to make it back to the shared heap
+void test_orphaned_frees() {
+
+    size_t size = 4u<<20;
+    size_t count = 50000;
+    void* region = malloc(size);
+    heap_t* heap = heap_create(region, size);
+    test_check(heap != NULL);
+
+    test_alloc_job_t job = { heap, (void**)malloc(count*sizeof(void*)), count, 64 };
+    pthread_t thread;
+    pthread_create(&thread, NULL, test_alloc_thread, &job);
+    pthread_join(thread, NULL);
+#ifndef allocator_hardened
+    // the guards of the hardened heap leave room for fewer blocks
+    test_check(job.count == count);
+#endif
+
+    for ( size_t i = 0; i < job.count; i++ ) { heap_free(heap, job.ptrs[i]); }
+
+    heap_stats_t stats;
+    heap_stats(heap, &stats);
+    test_check(stats.live_blocks <= test_held_blocks);
+
+    void* ptr = heap_alloc(heap, 1u<<20);
+    test_check(ptr != NULL);
+    heap_free(heap, ptr);
+
+    heap_destroy(heap);
+    free(job.ptrs);
+    free(region);
+
+}
+
+typedef struct {
+    heap_t* heap;
+    void** ptrs;
+    size_t count;
+    pthread_barrier_t* barrier;
+} test_drain_job_t;
+
+void* test_drain_thread(void* arg) {
+
+    test_drain_job_t* job = (test_drain_job_t*)arg;
+    for ( size_t i = 0; i < job->count; i++ ) {
+        job->ptrs[i] = heap_alloc(job->heap, 64);
+        test_check(job->ptrs[i] != NULL);
+    }
+
+    // the main thread frees all of them while this thread is still alive
+    pthread_barrier_wait(job->barrier);
+    pthread_barrier_wait(job->barrier);
+
+    __heap_thread_cache_t* cache = &job->heap->thread_caches[__heap_thread_id - 1];
+    __heap_cache_drain_remote(job->heap, cache);
+    for ( size_t i = 0; i < __heap_small_n_classes; i++ ) { test_check(cache->counts[i] <= __heap_cache_limit); }
+    return NULL;
+
+}
+
+// blocks freed by other threads don't grow a cache past __heap_cache_limit when they are drained
+void test_drain_limit() {
+
+    size_t size = 16u<<20;
+    size_t count = 16*__heap_cache_limit;
+    void* region = malloc(size);
+    heap_t* heap = heap_create(region, size);
+    test_check(heap != NULL);
+
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, 2);
+    test_drain_job_t job = { heap, (void**)malloc(count*sizeof(void*)), count, &barrier };
+    pthread_t thread;
+    pthread_create(&thread, NULL, test_drain_thread, &job);
+
+    pthread_barrier_wait(&barrier);
+    for ( size_t i = 0; i < count; i++ ) { heap_free(heap, job.ptrs[i]); }
+    pthread_barrier_wait(&barrier);
+    pthread_join(thread, NULL);
+
+    heap_stats_t stats;
+    heap_stats(heap, &stats);
+    test_check(stats.live_blocks <= test_held_blocks);
+
+    pthread_barrier_destroy(&barrier);
+    heap_destroy(heap);
+    free(job.ptrs);
+    free(region);
+
+}
+
+// blocks handed between threads start with their size and seed, the rest is the pattern of
+// test_fill
+typedef struct {
+    size_t size;
+    size_t seed;
+} test_block_t;
+
+heap_t* test_stress_heap;
+_Atomic(void*) test_exchange[test_exchange_slots];
+
+size_t test_stress_size(uint64_t* rng) {
+    uint64_t r = test_rand(rng);
+    if ( (r & 31) == 0 ) { return 257 + (r >> 8) % 8192; }
+    return sizeof(test_block_t) + (r >> 8) % (257 - sizeof(test_block_t));
+}
+
+void* test_stress_block(size_t size, uint64_t seed, size_t align) {
+    void* ptr = align ? heap_alloc_aligned(test_stress_heap, size, align) : heap_alloc(test_stress_heap, size);
+    test_check(ptr != NULL);
+    if ( align ) { test_check((uintptr_t)ptr % align == 0); }
+    test_block_t* block = (test_block_t*)ptr;
+    block->size = size;
+    block->seed = (unsigned char)seed;
+    test_fill(block + 1, size - sizeof(test_block_t), (unsigned char)block->seed);
+    return ptr;
+}
+
+void test_stress_verify(void* ptr) {
+    test_block_t* block = (test_block_t*)ptr;
+    test_check(test_verify(block + 1, block->size - sizeof(test_block_t), (unsigned char)block->seed));
+}
+
+// resizes a block and checks its contents moved with it
+void* test_stress_realloc(void* ptr, size_t size) {
+    test_block_t* block = (test_block_t*)ptr;
+    size_t size_old = block->size;
+    block = (test_block_t*)heap_realloc(test_stress_heap, ptr, size);
+    test_check(block != NULL);
+    size_t size_kept = size < size_old ? size : size_old;
+    test_check(test_verify(block + 1, size_kept - sizeof(test_block_t), (unsigned char)block->seed));
+    block->size = size;
+    test_fill(block + 1, size - sizeof(test_block_t), (unsigned char)block->seed);
+    return block;
+}
+
+// random allocations, frees and reallocs of blocks of this thread and of blocks taken from the
+// exchange, which may belong to threads that have exited already
+void* test_stress_thread(void* arg) {
+
+    uint64_t rng = (uintptr_t)arg*0x9e3779b97f4a7c15ull + 1;
+    void* slots[test_stress_slots] = {0};
+
+    for ( size_t i = 0; i < test_stress_ops; i++ ) {
+
+        size_t slot = test_rand(&rng) % test_stress_slots;
+        uint64_t r = test_rand(&rng);
+
+        if ( slots[slot] == NULL ) {
+            size_t align = (r & 15) == 0 ? (size_t)16 << (r >> 8) % 8 : 0;
+            slots[slot] = test_stress_block(test_stress_size(&rng), r >> 16, align);
+            continue;
+        }
+
+        test_stress_verify(slots[slot]);
+
+        switch ( r & 7 ) {
+            case 0:
+            case 1:
+                slots[slot] = test_stress_realloc(slots[slot], test_stress_size(&rng));
+                break;
+            case 2: {
+                // the block of another thread takes the place of this one
+                void* ptr = atomic_exchange(&test_exchange[(r >> 8) % test_exchange_slots], slots[slot]);
+                slots[slot] = ptr;
+                if ( ptr != NULL ) {
+                    test_stress_verify(ptr);
+                    if ( (r >> 32) & 1 ) { slots[slot] = test_stress_realloc(ptr, test_stress_size(&rng)); }
+                }
+                break;
+            }
+            case 3: {
+                // blocks of a batch, which belong to no cache, are freed together with one that
+                // may belong to this thread or to another one
+                void* batch[9];
+                test_check(heap_alloc_batch(test_stress_heap, test_stress_size(&rng), 8, batch) == 8);
+                batch[8] = slots[slot];
+                heap_free_batch(test_stress_heap, batch, 9);
+                slots[slot] = NULL;
+                break;
+            }
+            default:
+                heap_free(test_stress_heap, slots[slot]);
+                slots[slot] = NULL;
+                break;
+        }
+
+    }
+
+    // half of the threads leave their blocks for the next round of threads to free
+    for ( size_t i = 0; i < test_stress_slots; i++ ) {
+        if ( slots[i] == NULL ) { continue; }
+        if ( (uintptr_t)arg & 1 ) {
+            void* ptr = atomic_exchange(&test_exchange[i % test_exchange_slots], slots[i]);
+            if ( ptr != NULL ) { heap_free(test_stress_heap, ptr); }
+        } else {
+            heap_free(test_stress_heap, slots[i]);
+        }
+    }
+
+    return NULL;
+
+}
+
+void test_stress() {
+
+    size_t size = 64u<<20;
+    void* region = malloc(size);
+    test_stress_heap = heap_create(region, size);
+    test_check(test_stress_heap != NULL);
+
+    // the first round runs on a single thread, the later ones reuse the thread ids of the
+    // threads that exited before them
+    for ( size_t round = 0; round < 4; round++ ) {
+        size_t n_threads = round == 0 ? 1 : test_stress_threads;
+        pthread_t threads[test_stress_threads];
+        for ( size_t i = 0; i < n_threads; i++ ) { pthread_create(&threads[i], NULL, test_stress_thread, (void*)(round*test_stress_threads + i + 1)); }
+        for ( size_t i = 0; i < n_threads; i++ ) { pthread_join(threads[i], NULL); }
+    }
+
+    for ( size_t i = 0; i < test_exchange_slots; i++ ) {
+        void* ptr = atomic_exchange(&test_exchange[i], NULL);
+        if ( ptr == NULL ) { continue; }
+        test_stress_verify(ptr);
+        heap_free(test_stress_heap, ptr);
+    }
+
+    // every thread has exited and flushed its cache
+    heap_stats_t stats;
+    heap_stats(test_stress_heap, &stats);
+    test_check(stats.live_blocks <= test_held_blocks);
+
+    heap_destroy(test_stress_heap);
+    free(region);
+
+}
+
+int main() {
+
+    test_orphaned_frees();
+    test_drain_limit();
+    test_stress();
+
+    printf("test_threads: ok\n");
+    return 0;
+
+}
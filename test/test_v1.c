@@ -0,0 +1,192 @@
+#include <string.h>
+
+#define allocator_v1_implementation
+#include "allocator_v1.h"
+
+#include "test.h"
+
+// tests of the sector list of allocator_v1.h: splitting and merging of free sectors, frees and
+// reallocs of pointers that aren't allocations, snapshots of the sectors and a single threaded
+// stress of every call
+
+#define test_heap_size (16u<<20)
+#define test_slots 512
+#define test_ops 200000
+
+// blocks that are freed next to each other merge into one sector, which is split for smaller
+// allocations with the rest left free
+void test_merge_split(heap_t* heap) {
+
+    size_t size = 4*__heap_sector_alignment(heap);
+    char* ptr_a = (char*)heap_alloc(heap, size);
+    char* ptr_b = (char*)heap_alloc(heap, size);
+    char* ptr_c = (char*)heap_alloc(heap, size);
+    // keeps the three from going back to the free space at the top
+    void* ptr_top = heap_alloc(heap, size);
+    test_check(ptr_a != NULL && ptr_b != NULL && ptr_c != NULL && ptr_top != NULL);
+    test_check(ptr_a < ptr_b && ptr_b < ptr_c);
+
+    // freed in an order that merges with the next sector and then with both neighbours
+    heap_free(heap, ptr_b);
+    heap_free(heap, ptr_c);
+    heap_free(heap, ptr_a);
+
+    // the three merged into one free sector of 15 sectors, an allocation of 8 sectors takes its
+    // front and the 7 that are left stay free for an allocation of 4, both are found in the bins
+    // before the free space at the top
+    size_t sector_size = __heap_sector_alignment(heap);
+    test_check((size_t)(ptr_c - ptr_a) + size + __heap_sector_header_size <= 15*sector_size);
+    char* ptr_front = (char*)heap_alloc(heap, 8*sector_size - __heap_sector_header_size);
+    test_check(ptr_front == ptr_a);
+    char* ptr_rest = (char*)heap_alloc(heap, 4*sector_size - __heap_sector_header_size);
+    test_check(ptr_rest == ptr_a + 8*sector_size);
+
+    heap_free(heap, ptr_front);
+    heap_free(heap, ptr_rest);
+    heap_free(heap, ptr_top);
+
+    // the heap is empty again, so everything went back to the free space at the top
+    test_check(heap->top_sector == heap->base && heap->top_sector->sectors_used == 0);
+    test_check(heap->bin_bitmap == 0);
+
+}
+
+// pointers into the middle of an allocation, freed allocations and headers of sectors that were
+// merged away are all ignored
+void test_invalid_pointers(heap_t* heap) {
+
+    size_t size = 4*__heap_sector_alignment(heap);
+    char* ptr_a = (char*)heap_alloc(heap, size);
+    char* ptr_b = (char*)heap_alloc(heap, size);
+    char* ptr_c = (char*)heap_alloc(heap, size);
+    test_fill(ptr_a, size, 1);
+    test_fill(ptr_c, size, 3);
+
+    heap_free(heap, ptr_a + 64);
+    test_check(heap_realloc(heap, ptr_a + 64, 2*size) == NULL);
+    test_check(test_verify(ptr_a, size, 1));
+
+    // b is merged into the free sector of a, its header is still there but no longer linked
+    heap_free(heap, ptr_a);
+    heap_free(heap, ptr_b);
+    heap_free(heap, ptr_b);
+    test_check(heap_realloc(heap, ptr_b, 2*size) == NULL);
+    test_check(heap_realloc(heap, ptr_a, 2*size) == NULL);
+
+    // the freed space is still one free sector of 10 sectors in front of c
+    char* ptr = (char*)heap_alloc(heap, 8*__heap_sector_alignment(heap) - __heap_sector_header_size);
+    test_check(ptr == ptr_a);
+    test_check(test_verify(ptr_c, size, 3));
+
+    heap_free(heap, ptr);
+    heap_free(heap, ptr_c);
+    test_check(heap->top_sector == heap->base && heap->top_sector->sectors_used == 0);
+
+}
+
+typedef struct {
+    void* ptr;
+    size_t size;
+    unsigned char seed;
+} test_slot_t;
+
+void test_stress(heap_t* heap, uint64_t seed) {
+
+    static test_slot_t slots[test_slots];
+    memset(slots, 0, sizeof(slots));
+    uint64_t rng = seed;
+
+    for ( size_t i = 0; i < test_ops; i++ ) {
+
+        test_slot_t* slot = &slots[test_rand(&rng) % test_slots];
+        uint64_t r = test_rand(&rng);
+        size_t size = (r & 15) == 0 ? 1 + (r >> 8) % 32768 : 1 + (r >> 8) % 512;
+
+        if ( slot->ptr == NULL ) {
+            size_t align = (r & 7) == 0 ? (size_t)16 << (r >> 40) % 9 : 0;
+            slot->ptr = align ? heap_alloc_aligned(heap, size, align) : heap_alloc(heap, size);
+            test_check(slot->ptr != NULL);
+            if ( align ) { test_check((uintptr_t)slot->ptr % align == 0); }
+            slot->size = size;
+            slot->seed = (unsigned char)(r >> 48);
+            test_fill(slot->ptr, slot->size, slot->seed);
+            continue;
+        }
+
+        test_check(test_verify(slot->ptr, slot->size, slot->seed));
+
+        if ( (r & 3) == 0 ) {
+            void* ptr = heap_realloc(heap, slot->ptr, size);
+            test_check(ptr != NULL);
+            test_check(test_verify(ptr, size < slot->size ? size : slot->size, slot->seed));
+            slot->ptr = ptr;
+            slot->size = size;
+            test_fill(slot->ptr, slot->size, slot->seed);
+        } else {
+            heap_free(heap, slot->ptr);
+            slot->ptr = NULL;
+        }
+
+    }
+
+    for ( size_t i = 0; i < test_slots; i++ ) {
+        if ( slots[i].ptr == NULL ) { continue; }
+        test_check(test_verify(slots[i].ptr, slots[i].size, slots[i].seed));
+        heap_free(heap, slots[i].ptr);
+    }
+
+    test_check(heap->top_sector == heap->base && heap->top_sector->sectors_used == 0);
+    test_check(heap->bin_bitmap == 0);
+
+}
+
+// a snapshot has every sector of the heap in address order from the base up, the allocated
+// ones and the free ones between them
+void test_snapshot_sectors(heap_t* heap) {
+
+    size_t size = 4*__heap_sector_alignment(heap);
+    void* ptrs[3];
+    for ( size_t i = 0; i < 3; i++ ) { ptrs[i] = heap_alloc(heap, size); }
+    heap_free(heap, ptrs[1]);
+
+    heap_snapshot_header_t header;
+    heap_snapshot_block_t* blocks = test_snapshot(heap, &header);
+    test_check(header.allocator == 1);
+    test_check(header.heap_size == test_heap_size);
+    test_check(header.n_blocks > 0 && blocks[0].offset == 0);
+    test_check(blocks[header.n_blocks - 1].offset + blocks[header.n_blocks - 1].size == header.data_bytes);
+
+    for ( size_t i = 0; i < 3; i++ ) {
+        heap_snapshot_block_t* block = test_snapshot_block(blocks, &header, (char*)ptrs[i] - (char*)heap->base);
+        test_check(block != NULL);
+        test_check(block->state == (i == 1 ? heap_snapshot_free : heap_snapshot_allocated));
+        test_check(block->size >= size);
+    }
+    free(blocks);
+
+    heap_free(heap, ptrs[0]);
+    heap_free(heap, ptrs[2]);
+
+}
+
+int main() {
+
+    void* region = malloc(test_heap_size);
+
+    // the smallest sectors and the default ones
+    size_t sector_sizes[] = { __heap_min_sector_size, allocator_v1_default_sector_size };
+    for ( size_t i = 0; i < sizeof(sector_sizes)/sizeof(sector_sizes[0]); i++ ) {
+        heap_t heap;
+        heap_init_sectors(&heap, region, test_heap_size, sector_sizes[i]);
+        test_merge_split(&heap);
+        test_invalid_pointers(&heap);
+        test_snapshot_sectors(&heap);
+        test_stress(&heap, (i + 1)*0x9e3779b97f4a7c15ull);
+        heap_destroy(&heap);
+    }
+
+    free(region);
+    printf("test_v1: ok\n");
+    return 0;
+
+}
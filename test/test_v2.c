@@ -0,0 +1,442 @@
+#include <string.h>
+
+#define allocator_v2_implementation
+#include "allocator_v2.h"
+
+#include "test.h"
+
+// single threaded stress of heap_alloc, heap_alloc_aligned, heap_realloc and heap_free with the
+// contents of every block checked before it is resized or freed, followed by tests of double
+// frees, next fit, usable sizes, batches, regions, large mappings and snapshots, make test builds it for
+// each layout of the sector table and for the hardened heap
+
+#define test_heap_size (64u<<20)
+#define test_slots 1024
+#define test_ops 400000
+
+typedef struct {
+    void* ptr;
+    size_t size;
+    size_t align;
+    unsigned char seed;
+} test_slot_t;
+
+// mostly small objects, some medium buffers and the odd allocation for the large path
+size_t test_size(uint64_t* rng) {
+    uint64_t r = test_rand(rng);
+    if ( (r & 1023) == 0 ) { return (1u<<20) + (r >> 10) % (1u<<18); }
+    if ( (r & 15) == 0 ) { return 257 + (r >> 10) % 16384; }
+    return 1 + (r >> 10) % 256;
+}
+
+void test_stress(heap_t* heap, uint64_t seed) {
+
+    static test_slot_t slots[test_slots];
+    memset(slots, 0, sizeof(slots));
+    uint64_t rng = seed;
+
+    for ( size_t i = 0; i < test_ops; i++ ) {
+
+        test_slot_t* slot = &slots[test_rand(&rng) % test_slots];
+        uint64_t r = test_rand(&rng);
+
+        if ( slot->ptr == NULL ) {
+            slot->size = test_size(&rng);
+            slot->align = (r & 7) == 0 ? (size_t)16 << (r >> 8) % 9 : 0;
+            slot->ptr = slot->align ? heap_alloc_aligned(heap, slot->size, slot->align) : heap_alloc(heap, slot->size);
+            test_check(slot->ptr != NULL);
+            if ( slot->align ) { test_check((uintptr_t)slot->ptr % slot->align == 0); }
+            test_check(heap_usable_size(heap, slot->ptr) >= slot->size);
+            slot->seed = (unsigned char)r;
+            test_fill(slot->ptr, slot->size, slot->seed);
+            continue;
+        }
+
+        test_check(test_verify(slot->ptr, slot->size, slot->seed));
+
+        if ( (r & 3) == 0 ) {
+            // the contents up to the smaller of both sizes survive the move
+            size_t size = test_size(&rng);
+            void* ptr = heap_realloc(heap, slot->ptr, size);
+            test_check(ptr != NULL);
+            test_check(test_verify(ptr, size < slot->size ? size : slot->size, slot->seed));
+            slot->ptr = ptr;
+            slot->size = size;
+            test_fill(slot->ptr, slot->size, slot->seed);
+        } else {
+            heap_free(heap, slot->ptr);
+            slot->ptr = NULL;
+        }
+
+    }
+
+    for ( size_t i = 0; i < test_slots; i++ ) {
+        if ( slots[i].ptr == NULL ) { continue; }
+        test_check(test_verify(slots[i].ptr, slots[i].size, slots[i].seed));
+        heap_free(heap, slots[i].ptr);
+    }
+
+}
+
+// a slab object freed twice is only linked into the free list of its page once and can't be
+// resized once it is freed, the hardened heap aborts on both instead
+void test_double_free(heap_t* heap) {
+
+    // the first object keeps the page from being empty, which frees would catch anyway
+    void* ptr_kept = heap_alloc(heap, 32);
+    void* ptr_a = heap_alloc(heap, 32);
+    void* ptr_b = heap_alloc(heap, 32);
+    heap_free(heap, ptr_a);
+    heap_free(heap, ptr_b);
+    heap_free(heap, ptr_a);
+
+    // resizing a freed object neither copies it nor hands its slot out again
+    test_check(heap_realloc(heap, ptr_a, 16) == NULL);
+    test_check(heap_realloc(heap, ptr_a, 100) == NULL);
+    test_check(heap_usable_size(heap, ptr_a) == 0);
+
+    heap_stats_t stats;
+    heap_stats(heap, &stats);
+    test_check(stats.live_blocks == 1);
+
+    void* ptrs[3];
+    for ( size_t i = 0; i < 3; i++ ) { ptrs[i] = heap_alloc(heap, 32); }
+    test_check(ptrs[0] != ptrs[1] && ptrs[0] != ptrs[2] && ptrs[1] != ptrs[2]);
+
+    for ( size_t i = 0; i < 3; i++ ) { heap_free(heap, ptrs[i]); }
+    heap_free(heap, ptr_kept);
+
+}
+
+// pointers that aren't allocations of the heap have no usable size, in the hardened heap too
+void test_usable_size(heap_t* heap) {
+
+    void* buffer = heap_alloc(heap, 5000);
+    void* object = heap_alloc(heap, 32);
+    test_check(heap_usable_size(heap, buffer) >= 5000);
+    test_check(heap_usable_size(heap, object) >= 32);
+    test_check(heap_usable_size(heap, (char*)buffer + 64) == 0);
+    test_check(heap_usable_size(heap, (char*)object + 16) == 0);
+
+    // far enough into a block of malloc that the large path can look in front of it
+    char* foreign = (char*)malloc(4096);
+    test_check(heap_usable_size(heap, foreign + 2048) == 0);
+    free(foreign);
+
+    heap_free(heap, buffer);
+    heap_free(heap, object);
+
+}
+
+// blocks of a batch don't overlap, keep their contents while other blocks of the batch are freed
+// and merge back into one piece once all of them are
+void test_batch(heap_t* heap) {
+
+    static const size_t sizes[] = { 24, 200, 1000, 5000 };
+    void* ptrs[256];
+
+    for ( size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++ ) {
+
+        size_t size = sizes[s];
+        test_check(heap_alloc_batch(heap, size, 256, ptrs) == 256);
+        for ( size_t i = 0; i < 256; i++ ) {
+            test_check(ptrs[i] != NULL);
+            test_check(heap_usable_size(heap, ptrs[i]) >= size);
+            test_fill(ptrs[i], size, (unsigned char)i);
+        }
+        for ( size_t i = 0; i < 256; i++ ) { test_check(test_verify(ptrs[i], size, (unsigned char)i)); }
+
+        // every other block goes first, backwards, so the batch has neighbours to merge with
+        // and to keep apart
+        void* odd[128];
+        for ( size_t i = 0; i < 128; i++ ) { odd[i] = ptrs[255 - 2*i]; }
+        heap_free_batch(heap, odd, 128);
+        for ( size_t i = 0; i < 256; i += 2 ) {
+            test_check(test_verify(ptrs[i], size, (unsigned char)i));
+            ptrs[i/2] = ptrs[i];
+        }
+        heap_free_batch(heap, ptrs, 128);
+
+    }
+
+    // a heap too small for the batch hands out what it can and takes all of it back
+    size_t size_small = 1u<<20;
+    void* region = malloc(size_small);
+    heap_t* heap_small = heap_create(region, size_small);
+    test_check(heap_small != NULL);
+    size_t n = heap_alloc_batch(heap_small, 4096, 256, ptrs);
+    test_check(n > 0 && n < 256);
+    heap_free_batch(heap_small, ptrs, n);
+#ifndef allocator_hardened
+    test_check(heap_alloc_batch(heap_small, 4096, 256, ptrs) == n);
+    heap_free_batch(heap_small, ptrs, n);
+#endif
+    heap_destroy(heap_small);
+    free(region);
+
+    heap_stats_t stats;
+    heap_stats(heap, &stats);
+#ifdef allocator_hardened
+    test_check(stats.live_blocks <= allocator_hardened_quarantine);
+#else
+    test_check(stats.live_blocks == 0);
+    test_check(stats.largest_free_block >= test_heap_size/2);
+#endif
+
+}
+
+// next fit takes the free blocks in address order, going on after the last one it took and
+// starting over from the base once there is none after it
+void test_next_fit() {
+
+    size_t size = 1u<<20;
+    void* region = malloc(size);
+    heap_t* heap = heap_create(region, size);
+    test_check(heap != NULL);
+    heap_set_placement(heap, heap_placement_next_fit);
+
+    void* ptrs[16];
+    for ( size_t i = 0; i < 16; i++ ) {
+        ptrs[i] = heap_alloc(heap, 2000);
+        test_check(ptrs[i] != NULL);
+    }
+    for ( size_t i = 0; i < 16; i += 2 ) { heap_free(heap, ptrs[i]); }
+
+    // the rest of each block is too small for the next allocation, so it moves on to the next
+    // block every time
+    for ( size_t i = 0; i < 16; i += 2 ) { test_check(heap_alloc(heap, 1500) == ptrs[i]); }
+
+    // the rest of the first block merges with the second one, which lies behind the last
+    // allocation
+    heap_free(heap, ptrs[1]);
+    void* ptr = heap_alloc(heap, 1500);
+    test_check((char*)ptr > (char*)ptrs[0] && (char*)ptr < (char*)ptrs[2]);
+
+    heap_destroy(heap);
+    free(region);
+
+}
+
+size_t test_live_blocks(heap_t* heap) {
+    heap_stats_t stats;
+    heap_stats(heap, &stats);
+    return stats.live_blocks;
+}
+
+// allocations of a region are aligned and don't overlap, a reset keeps the first chunk and hands
+// out its memory again, a nested region gives its space back to its parent and ending the
+// region frees every chunk
+void test_regions(heap_t* heap) {
+
+    static void* ptrs[4096];
+    static size_t sizes[4096];
+    uint64_t rng = 0x2545f4914f6cdd1dull;
+#ifndef allocator_hardened
+    // the quarantine of the hardened heap changes how many blocks are live
+    size_t live = test_live_blocks(heap);
+#endif
+
+    region_t region;
+    heap_region_begin(heap, &region);
+    void* first = NULL;
+
+    for ( size_t round = 0; round < 2; round++ ) {
+
+        for ( size_t i = 0; i < 4096; i++ ) {
+            // empty allocations and ones larger than any chunk too
+            uint64_t r = test_rand(&rng);
+            sizes[i] = (r & 255) == 0 ? allocator_region_chunk_max + (r >> 8) % 4096 : (r >> 8) % 3000;
+            ptrs[i] = region_alloc(&region, sizes[i]);
+            test_check(ptrs[i] != NULL);
+            test_check((uintptr_t)ptrs[i] % __region_alignment == 0);
+            test_fill(ptrs[i], sizes[i], (unsigned char)i);
+        }
+        for ( size_t i = 0; i < 4096; i++ ) { test_check(test_verify(ptrs[i], sizes[i], (unsigned char)i)); }
+
+        // the first allocation after a reset is where the first one before it was
+        if ( round == 0 ) { first = ptrs[0]; }
+        else { test_check(ptrs[0] == first); }
+
+        region_reset(&region);
+#ifndef allocator_hardened
+        test_check(test_live_blocks(heap) == live + 1);
+#endif
+
+    }
+
+    void* outer = region_alloc(&region, 100);
+    region_t nested;
+    region_begin(&nested, &region);
+    void* inner = region_alloc(&nested, 100);
+    test_check(inner != outer);
+    for ( size_t i = 0; i < 1024; i++ ) { test_check(region_alloc(&nested, 1000) != NULL); }
+    region_end(&nested);
+#ifndef allocator_hardened
+    test_check(test_live_blocks(heap) == live + 1);
+#endif
+    test_check(region_alloc(&region, 100) == inner);
+
+    region_end(&region);
+#ifndef allocator_hardened
+    test_check(test_live_blocks(heap) == live);
+#endif
+
+}
+
+// allocations of allocator_v2_large_size bytes and more get mappings of their own, even ones
+// larger than the heap, are counted in the stats, keep their contents when they are resized
+// within the large path and across it and are unmapped by batch frees as well
+void test_large(heap_t* heap) {
+
+    static const size_t sizes[] = { 1u<<20, (1u<<20) + 12345, 3u<<20 };
+    void* ptrs[4];
+#ifndef allocator_hardened
+    // the quarantine of the hardened heap changes how many blocks are live
+    size_t live = test_live_blocks(heap);
+#endif
+
+    for ( size_t i = 0; i < 3; i++ ) {
+        ptrs[i] = i == 2 ? heap_alloc_aligned(heap, sizes[i], 256) : heap_alloc(heap, sizes[i]);
+        test_check(ptrs[i] != NULL);
+        test_check(heap_usable_size(heap, ptrs[i]) >= sizes[i]);
+        test_fill(ptrs[i], sizes[i], (unsigned char)i);
+    }
+    test_check((uintptr_t)ptrs[2] % 256 == 0);
+
+    // only the end of it is touched
+    size_t size_huge = 2*test_heap_size;
+    ptrs[3] = heap_alloc(heap, size_huge);
+    test_check(ptrs[3] != NULL);
+    test_fill((char*)ptrs[3] + size_huge - 4096, 4096, 3);
+
+    heap_stats_t stats;
+    heap_stats(heap, &stats);
+    test_check(stats.large_blocks == 4);
+    test_check(stats.large_bytes >= sizes[0] + sizes[1] + sizes[2] + size_huge);
+
+    // grows in place or moves its pages, then moves into the heap and back out of it
+    ptrs[0] = heap_realloc(heap, ptrs[0], 8u<<20);
+    test_check(ptrs[0] != NULL);
+    test_check(test_verify(ptrs[0], sizes[0], 0));
+    ptrs[0] = heap_realloc(heap, ptrs[0], 1000);
+    test_check(ptrs[0] != NULL);
+    test_check(test_verify(ptrs[0], 1000, 0));
+    heap_stats(heap, &stats);
+    test_check(stats.large_blocks == 3);
+    ptrs[0] = heap_realloc(heap, ptrs[0], 2u<<20);
+    test_check(ptrs[0] != NULL);
+    test_check(test_verify(ptrs[0], 1000, 0));
+    heap_stats(heap, &stats);
+    test_check(stats.large_blocks == 4);
+
+    test_check(test_verify(ptrs[1], sizes[1], 1));
+    test_check(test_verify(ptrs[2], sizes[2], 2));
+    test_check(test_verify((char*)ptrs[3] + size_huge - 4096, 4096, 3));
+
+    void* batch[4] = { ptrs[0], heap_alloc(heap, 100), ptrs[1], heap_alloc(heap, 5000) };
+    heap_free_batch(heap, batch, 4);
+    heap_free(heap, ptrs[2]);
+    heap_free(heap, ptrs[3]);
+
+    heap_stats(heap, &stats);
+    test_check(stats.large_blocks == 0);
+    test_check(stats.large_bytes == 0);
+#ifndef allocator_hardened
+    test_check(stats.live_blocks == live);
+#endif
+
+}
+
+// a snapshot has every block of the heap in address order, the slab pages with the objects in
+// use and the large allocations after them
+void test_snapshot_blocks(heap_t* heap) {
+
+    void* objects[100];
+    for ( size_t i = 0; i < 100; i++ ) { objects[i] = heap_alloc(heap, 32); }
+    void* buffers[3];
+    for ( size_t i = 0; i < 3; i++ ) { buffers[i] = heap_alloc(heap, 5000); }
+    heap_free(heap, buffers[1]);
+    void* large = heap_alloc(heap, 2u<<20);
+
+    heap_snapshot_header_t header;
+    heap_snapshot_block_t* blocks = test_snapshot(heap, &header);
+    test_check(header.allocator == 2);
+    test_check(header.heap_size <= test_heap_size);
+
+    uint64_t n_used = 0, n_used_32 = 0, n_large = 0;
+    for ( uint64_t i = 0; i < header.n_blocks; i++ ) {
+        if ( blocks[i].state == heap_snapshot_slab ) {
+            test_check(blocks[i].n_used <= blocks[i].n_objects);
+            n_used += blocks[i].n_used;
+            if ( blocks[i].object_size == 32 ) { n_used_32 += blocks[i].n_used; }
+        } else if ( blocks[i].state == heap_snapshot_large ) {
+            test_check(blocks[i].offset == (uintptr_t)large);
+            test_check(blocks[i].size >= (2u<<20));
+            n_large++;
+        }
+    }
+    test_check(n_large == 1);
+    test_check(n_used >= 100);
+
+    for ( size_t i = 0; i < 3; i += 2 ) {
+        heap_snapshot_block_t* block = test_snapshot_block(blocks, &header, (char*)buffers[i] - (char*)heap->base);
+        test_check(block != NULL && block->state == heap_snapshot_allocated);
+        test_check(block->size >= 5000);
+    }
+#ifndef allocator_hardened
+    // the hardened heap adds its guards to the objects and keeps the freed buffer in quarantine
+    test_check(n_used_32 == 100);
+    heap_snapshot_block_t* block = test_snapshot_block(blocks, &header, (char*)buffers[1] - (char*)heap->base);
+    test_check(block != NULL && block->state == heap_snapshot_free);
+#endif
+    free(blocks);
+
+    for ( size_t i = 0; i < 100; i++ ) { heap_free(heap, objects[i]); }
+    heap_free(heap, buffers[0]);
+    heap_free(heap, buffers[2]);
+    heap_free(heap, large);
+
+}
+
+int main() {
+
+    void* region = malloc(test_heap_size);
+    heap_t* heap = heap_create(region, test_heap_size);
+    test_check(heap != NULL);
+
+    for ( uint64_t seed = 1; seed <= 4; seed++ ) {
+
+        test_stress(heap, seed*0x9e3779b97f4a7c15ull);
+
+        heap_stats_t stats;
+        heap_stats(heap, &stats);
+        test_check(stats.large_blocks == 0);
+#ifdef allocator_hardened
+        // the quarantine still holds the last blocks that were freed
+        test_check(stats.live_blocks <= allocator_hardened_quarantine);
+#else
+        // everything was freed, so the free blocks have merged back into one piece
+        test_check(stats.live_blocks == 0);
+        test_check(stats.largest_free_block >= test_heap_size/2);
+#endif
+
+    }
+
+    test_usable_size(heap);
+    test_batch(heap);
+    test_regions(heap);
+    test_large(heap);
+    test_snapshot_blocks(heap);
+
+    heap_free(heap, NULL);
+#ifndef allocator_hardened
+    test_double_free(heap);
+    test_next_fit();
+#endif
+
+    heap_destroy(heap);
+    free(region);
+    printf("test_v2: ok\n");
+    return 0;
+
+}
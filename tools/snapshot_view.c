@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "allocator_snapshot.h"
+
+// reads a snapshot written by heap_snapshot_write and prints a summary of the heap, a map of
+// where its allocated and free space is, the sizes of its free blocks and, if the snapshot
+// recorded them, the call sites holding the most memory:
+//
+//   snapshot_view snapshot_file [columns [rows]]
+//   snapshot_view snapshot_file json
+//
+// every character of the map covers an equal share of the heap region:
+//
+//   #  allocated       +  mostly allocated      -  mostly free      .  free
+//   s  slab pages      m  sector table            never used
+
+#define view_n_buckets 64
+#define view_n_sites 16
+
+// kinds of space in the map
+#define view_allocated 0
+#define view_free 1
+#define view_slab 2
+#define view_metadata 3
+#define view_n_kinds 4
+
+// bytes of every kind of space that fall into one character of the map
+typedef struct {
+    uint64_t bytes[view_n_kinds];
+} view_cell_t;
+
+typedef struct {
+    uint64_t site;
+    uint64_t bytes;
+    uint64_t n_blocks;
+} view_site_t;
+
+heap_snapshot_block_t* view_load(const char* path, heap_snapshot_header_t* header) {
+
+    FILE* file = fopen(path, "rb");
+    if ( file == NULL ) {
+        fprintf(stderr, "could not open %s\n", path);
+        return NULL;
+    }
+
+    if ( fread(header, sizeof(*header), 1, file) != 1 || memcmp(header->magic, heap_snapshot_file_magic, 4) || header->version != heap_snapshot_file_version || header->block_size != sizeof(heap_snapshot_block_t) ) {
+        fprintf(stderr, "%s is not a snapshot this build can read\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    heap_snapshot_block_t* blocks = malloc(header->n_blocks*sizeof(heap_snapshot_block_t) + 1);
+    if ( blocks == NULL || fread(blocks, sizeof(heap_snapshot_block_t), header->n_blocks, file) != header->n_blocks ) {
+        fprintf(stderr, "%s is cut short\n", path);
+        free(blocks);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    return blocks;
+}
+
+const char* view_state_name(uint16_t state) {
+    switch ( state ) {
+        case heap_snapshot_allocated: return "allocated";
+        case heap_snapshot_free: return "free";
+        case heap_snapshot_slab: return "slab";
+        case heap_snapshot_large: return "large";
+    }
+    return "unknown";
+}
+
+void view_print_json(heap_snapshot_header_t* header, heap_snapshot_block_t* blocks) {
+
+    printf("{\"allocator\":%u,\"heap_size\":%llu,\"data_bytes\":%llu,\"metadata_bytes\":%llu,\"blocks\":[",
+        header->allocator, (unsigned long long)header->heap_size, (unsigned long long)header->data_bytes, (unsigned long long)header->metadata_bytes);
+
+    for ( uint64_t i = 0; i < header->n_blocks; i++ ) {
+        heap_snapshot_block_t* block = &blocks[i];
+        printf("%s\n{\"offset\":%llu,\"size\":%llu,\"state\":\"%s\"", i ? "," : "", (unsigned long long)block->offset, (unsigned long long)block->size, view_state_name(block->state));
+        if ( block->state == heap_snapshot_slab ) { printf(",\"object_size\":%u,\"n_objects\":%u,\"n_used\":%u", block->object_size, block->n_objects, block->n_used); }
+        if ( block->site ) { printf(",\"site\":\"0x%llx\"", (unsigned long long)block->site); }
+        printf("}");
+    }
+
+    printf("\n]}\n");
+}
+
+// adds the bytes from start to end of a kind of space to the cells of the map they cover
+void view_cells_add(view_cell_t* cells, size_t n_cells, uint64_t heap_size, uint64_t start, uint64_t end, size_t kind) {
+    if ( !heap_size ) { return; }
+    if ( end > heap_size ) { end = heap_size; }
+    while ( start < end ) {
+        size_t cell = (size_t)((double)start/heap_size*n_cells);
+        if ( cell >= n_cells ) { cell = n_cells - 1; }
+        uint64_t cell_end = (uint64_t)((double)(cell + 1)/n_cells*heap_size);
+        if ( cell_end <= start ) { cell_end = start + 1; }
+        uint64_t bytes = (cell_end < end ? cell_end : end) - start;
+        cells[cell].bytes[kind] += bytes;
+        start += bytes;
+    }
+}
+
+char view_cell_char(view_cell_t* cell) {
+    uint64_t allocated = cell->bytes[view_allocated];
+    uint64_t unallocated = cell->bytes[view_free];
+    uint64_t slab = cell->bytes[view_slab];
+    if ( cell->bytes[view_metadata] > allocated + unallocated + slab ) { return 'm'; }
+    if ( slab && slab >= allocated + unallocated ) { return 's'; }
+    if ( allocated && unallocated ) { return allocated >= unallocated ? '+' : '-'; }
+    if ( allocated ) { return '#'; }
+    if ( unallocated ) { return '.'; }
+    return ' ';
+}
+
+int view_compare_sites(const void* a, const void* b) {
+    const view_site_t* x = a;
+    const view_site_t* y = b;
+    return (x->bytes < y->bytes) - (x->bytes > y->bytes);
+}
+
+int main(int argc, char** argv) {
+
+    if ( argc < 2 ) {
+        fprintf(stderr, "usage: %s snapshot_file [columns [rows] | json]\n", argv[0]);
+        return 1;
+    }
+
+    heap_snapshot_header_t header;
+    heap_snapshot_block_t* blocks = view_load(argv[1], &header);
+    if ( blocks == NULL ) { return 1; }
+
+    if ( argc > 2 && !strcmp(argv[2], "json") ) {
+        view_print_json(&header, blocks);
+        return 0;
+    }
+
+    size_t n_columns = argc > 2 ? (size_t)atoi(argv[2]) : 64;
+    size_t n_rows = argc > 3 ? (size_t)atoi(argv[3]) : 16;
+    if ( !n_columns || !n_rows ) {
+        fprintf(stderr, "the map needs at least one column and one row\n");
+        return 1;
+    }
+
+    size_t n_cells = n_columns*n_rows;
+    view_cell_t* cells = calloc(n_cells, sizeof(view_cell_t));
+
+    uint64_t allocated_bytes = 0, n_allocated = 0;
+    uint64_t free_bytes = 0, n_free = 0, largest_free = 0;
+    uint64_t large_bytes = 0, n_large = 0;
+    uint64_t slab_bytes = 0, slab_objects = 0, slab_used = 0, slab_used_bytes = 0;
+    uint64_t bucket_blocks[view_n_buckets] = {0};
+    uint64_t bucket_bytes[view_n_buckets] = {0};
+
+    view_site_t* sites = calloc(header.n_blocks + 1, sizeof(view_site_t));
+    size_t n_sites = 0;
+
+    for ( uint64_t i = 0; i < header.n_blocks; i++ ) {
+
+        heap_snapshot_block_t* block = &blocks[i];
+
+        switch ( block->state ) {
+            case heap_snapshot_allocated:
+                allocated_bytes += block->size;
+                n_allocated++;
+                view_cells_add(cells, n_cells, header.heap_size, block->offset, block->offset + block->size, view_allocated);
+                break;
+            case heap_snapshot_free: {
+                free_bytes += block->size;
+                n_free++;
+                if ( block->size > largest_free ) { largest_free = block->size; }
+                size_t bucket = block->size ? 63 - __builtin_clzll(block->size) : 0;
+                bucket_blocks[bucket]++;
+                bucket_bytes[bucket] += block->size;
+                view_cells_add(cells, n_cells, header.heap_size, block->offset, block->offset + block->size, view_free);
+                break;
+            }
+            case heap_snapshot_slab:
+                slab_bytes += block->size;
+                slab_objects += block->n_objects;
+                slab_used += block->n_used;
+                slab_used_bytes += (uint64_t)block->n_used*block->object_size;
+                view_cells_add(cells, n_cells, header.heap_size, block->offset, block->offset + block->size, view_slab);
+                break;
+            case heap_snapshot_large:
+                large_bytes += block->size;
+                n_large++;
+                break;
+        }
+
+        // the blocks of a site are few compared to the blocks of the heap, so a linear search is
+        // enough to sum them up
+        if ( block->site ) {
+            size_t j = 0;
+            while ( j < n_sites && sites[j].site != block->site ) { j++; }
+            if ( j == n_sites ) { sites[n_sites++].site = block->site; }
+            sites[j].bytes += block->size;
+            sites[j].n_blocks++;
+        }
+
+    }
+
+    // the sector table of v2 sits at the end of the region
+    if ( header.allocator == 2 ) { view_cells_add(cells, n_cells, header.heap_size, header.heap_size - header.metadata_bytes, header.heap_size, view_metadata); }
+
+    // free space inside the heap and the space it hasn't used yet
+    uint64_t unused = header.heap_size - header.data_bytes - (header.allocator == 2 ? header.metadata_bytes : 0);
+
+    printf("allocator v%u, %llu byte region, %llu bytes in use by the data segment, %llu bytes of metadata\n",
+        header.allocator, (unsigned long long)header.heap_size, (unsigned long long)header.data_bytes, (unsigned long long)header.metadata_bytes);
+    printf("allocated: %llu blocks, %llu bytes\n", (unsigned long long)n_allocated, (unsigned long long)allocated_bytes);
+    printf("free:      %llu blocks, %llu bytes, largest %llu bytes\n", (unsigned long long)n_free, (unsigned long long)free_bytes, (unsigned long long)largest_free);
+    printf("unused:    %llu bytes past the data segment\n", (unsigned long long)unused);
+    if ( slab_bytes ) {
+        printf("slab:      %llu bytes, %llu of %llu objects in use (%llu bytes)\n", (unsigned long long)slab_bytes,
+            (unsigned long long)slab_used, (unsigned long long)slab_objects, (unsigned long long)slab_used_bytes);
+    }
+    if ( n_large ) { printf("large:     %llu allocations, %llu bytes outside of the region\n", (unsigned long long)n_large, (unsigned long long)large_bytes); }
+
+    // the space at the end of the data segment can be handed out in one piece
+    uint64_t largest_piece = largest_free > unused ? largest_free : unused;
+    double fragmentation = free_bytes + unused ? 1.0 - (double)largest_piece/(free_bytes + unused) : 0.0;
+    printf("external fragmentation: %.4f\n\n", fragmentation);
+
+    printf("map, %.0f bytes per character:\n", header.heap_size/(double)n_cells);
+    for ( size_t row = 0; row < n_rows; row++ ) {
+        putchar('|');
+        for ( size_t column = 0; column < n_columns; column++ ) { putchar(view_cell_char(&cells[row*n_columns + column])); }
+        printf("|\n");
+    }
+
+    if ( n_free ) {
+        printf("\nfree blocks by size:\n");
+        uint64_t bucket_max = 0;
+        for ( size_t i = 0; i < view_n_buckets; i++ ) {
+            if ( bucket_bytes[i] > bucket_max ) { bucket_max = bucket_bytes[i]; }
+        }
+        for ( size_t i = 0; i < view_n_buckets; i++ ) {
+            if ( !bucket_blocks[i] ) { continue; }
+            printf("%12llu+ %8llu blocks %12llu bytes ", 1ull << i, (unsigned long long)bucket_blocks[i], (unsigned long long)bucket_bytes[i]);
+            size_t bar = (size_t)(40.0*bucket_bytes[i]/bucket_max + 0.5);
+            for ( size_t j = 0; j < bar; j++ ) { putchar('*'); }
+            putchar('\n');
+        }
+    }
+
+    if ( n_sites ) {
+        qsort(sites, n_sites, sizeof(view_site_t), view_compare_sites);
+        printf("\ncall sites holding the most memory:\n");
+        for ( size_t i = 0; i < n_sites && i < view_n_sites; i++ ) {
+            printf("  0x%-16llx %8llu blocks %12llu bytes\n", (unsigned long long)sites[i].site, (unsigned long long)sites[i].n_blocks, (unsigned long long)sites[i].bytes);
+        }
+    }
+
+    free(sites);
+    free(cells);
+    free(blocks);
+    return 0;
+
+}